@@ -0,0 +1,297 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+#ifndef ACTIONS_H
+#define ACTIONS_H
+
+#include "../Bricks/port.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "schema.h"
+
+#include "../Bricks/cerealize/cerealize.h"
+#include "../Bricks/strings/printf.h"
+
+// The HTML table of the Actions page, users by questions, with the links to change each answer.
+//
+// The table is rendered once, and then kept up to date by the `Consumer` as the records come in: each cell
+// is cached, and each record only re-renders the cells it affects and marks their rows as dirty.
+//
+// The Actions page shows one `Window` of the table at a time: a range of questions (rows) and a range of users
+// (columns), so that the cost of the page only depends on the size of the window, not on the size of the demo.
+// `Page()` takes the rows of a window of all the users from the cached HTML of the rows, re-assembling only
+// the dirty ones, and assembles the rows of a narrower window from the cached cells.
+//
+// The rows are copy-on-write: the table of a forked demo starts sharing them with its parent, see
+// `ShareFrom()`, and each of the two only copies a row when it changes it.
+//
+// The client-side Actions page, `static/actions.html`, starts from the `Matrix` instead, and keeps itself
+// up to date by following the stream of records from `Matrix::next_record` on.
+namespace actions {
+
+// All the users, questions and answers of the demo, as of the record `next_record` of the stream of records.
+struct Matrix {
+  struct Answer {
+    size_t qid;
+    schema::UID uid;
+    int answer;
+
+    template <typename A>
+    void serialize(A& ar) {
+      ar(CEREAL_NVP(qid), CEREAL_NVP(uid), CEREAL_NVP(answer));
+    }
+  };
+
+  size_t next_record = 0;
+  std::vector<schema::UID> users;
+  std::vector<std::string> questions;  // The text of the question `qid` is `questions[qid - 1]`.
+  std::vector<Answer> answers;         // Only `AGREE` and `DISAGREE`, `NA` is the default.
+
+  template <typename A>
+  void serialize(A& ar) {
+    ar(CEREAL_NVP(next_record), CEREAL_NVP(users), CEREAL_NVP(questions), CEREAL_NVP(answers));
+  }
+};
+
+// Questions are the rows of the table, users are its columns.
+struct Window {
+  static constexpr size_t kDefaultLimit = 50;
+  static constexpr size_t kMaxLimit = 500;
+
+  size_t q_offset = 0;
+  size_t q_limit = kDefaultLimit;
+  size_t u_offset = 0;
+  size_t u_limit = kDefaultLimit;
+
+  void ClampLimits() {
+    q_limit = q_limit ? (q_limit < kMaxLimit ? q_limit : kMaxLimit) : 1;
+    u_limit = u_limit ? (u_limit < kMaxLimit ? u_limit : kMaxLimit) : 1;
+  }
+
+  // The URL query of this window, to link to the neighboring pages.
+  std::string Query() const {
+    return bricks::strings::Printf("?q_offset=%d&q_limit=%d&u_offset=%d&u_limit=%d",
+                                   static_cast<int>(q_offset),
+                                   static_cast<int>(q_limit),
+                                   static_cast<int>(u_offset),
+                                   static_cast<int>(u_limit));
+  }
+};
+
+class TableCache final {
+ public:
+  TableCache() = default;
+
+  void AddUser(const schema::UID& uid) {
+    columns_[uid].push_back(users_.size());
+    users_.push_back(uid);
+    header_cells_.push_back("<td align=center><b>" + uid + "</b></td>");
+    for (size_t qi = 0; qi < rows_.size(); ++qi) {
+      Row& row = MutableRow(qi);
+      row.cells.push_back(RenderCell(uid, qi, 0));
+      row.dirty = true;
+    }
+  }
+
+  void AddQuestion(const std::string& text) {
+    const size_t qi = rows_.size();
+    rows_.push_back(std::make_shared<Row>());
+    Row& row = *rows_.back();
+    row.title = "<tr><td align=right><b>" + text + "</b></td>";
+    row.cells.reserve(users_.size());
+    for (const auto& uid : users_) {
+      row.cells.push_back(RenderCell(uid, qi, 0));
+    }
+  }
+
+  void SetAnswer(schema::QID qid, const schema::UID& uid, schema::ANSWER answer) {
+    const size_t qi = static_cast<size_t>(qid) - 1;
+    const auto cit = columns_.find(uid);
+    if (qi < rows_.size() && cit != columns_.end()) {
+      Row& row = MutableRow(qi);
+      for (const size_t column : cit->second) {
+        row.cells[column] = RenderCell(uid, qi, static_cast<int>(answer));
+      }
+      row.dirty = true;
+    }
+  }
+
+  // The window of the table as a sequence of chunks to send: the header row, one chunk per question,
+  // and the row with the links to the neighboring windows.
+  std::vector<std::string> Page(const Window& window) {
+    const size_t q_begin = std::min(window.q_offset, rows_.size());
+    const size_t q_end = std::min(q_begin + window.q_limit, rows_.size());
+    const size_t u_begin = std::min(window.u_offset, users_.size());
+    const size_t u_end = std::min(u_begin + window.u_limit, users_.size());
+
+    std::vector<std::string> chunks;
+    chunks.reserve(q_end - q_begin + 2);
+    std::string header = "<tr><td></td>";
+    for (size_t u = u_begin; u < u_end; ++u) {
+      header += header_cells_[u];
+    }
+    header += "<tr>\n";
+    chunks.push_back(std::move(header));
+    const bool all_users = (u_begin == 0 && u_end == users_.size());
+    for (size_t qi = q_begin; qi < q_end; ++qi) {
+      if (all_users) {
+        chunks.push_back(RowHTML(qi));
+      } else {
+        const Row& row = *rows_[qi];
+        std::string html = row.title;
+        for (size_t u = u_begin; u < u_end; ++u) {
+          html += row.cells[u];
+        }
+        html += "</tr>\n";
+        chunks.push_back(std::move(html));
+      }
+    }
+    chunks.push_back(RenderNavigation(window, q_begin, q_end, u_begin, u_end));
+    return chunks;
+  }
+
+  size_t UsersCount() const { return users_.size(); }
+  size_t QuestionsCount() const { return rows_.size(); }
+
+  // Makes this table a copy of `other`, which shares the rows with it until either of the two changes them.
+  void ShareFrom(const TableCache& other) {
+    users_ = other.users_;
+    columns_ = other.columns_;
+    header_cells_ = other.header_cells_;
+    rows_ = other.rows_;
+  }
+
+ private:
+  struct Row {
+    std::string title;
+    std::vector<std::string> cells;
+    std::string html;   // The whole row, once assembled.
+    bool dirty = true;  // Whether `html` is behind `title` and `cells`.
+  };
+
+  static std::string RenderCell(const schema::UID& uid, size_t qi, int current_answer) {
+    struct VTC {  // VTC = { Value, Text, Color }.
+      int value;
+      const char* text;
+      const char* color;
+    };
+    static const VTC options[3] = {{-1, "No", "red"}, {0, "N/A", "gray"}, {+1, "Yes", "green"}};
+    std::string cell = "<td align=center>";
+    for (size_t i = 0; i < 3; ++i) {
+      if (i) {
+        cell += " | ";
+      }
+      if (options[i].value != current_answer) {
+        cell += bricks::strings::Printf("<a href='add_answer?uid=%s&qid=%d&answer=%d'>%s</a>",
+                                        uid.c_str(),
+                                        static_cast<int>(qi + 1),
+                                        options[i].value,
+                                        options[i].text);
+      } else {
+        cell += bricks::strings::Printf("<b><font color=%s>%s</font></b>", options[i].color, options[i].text);
+      }
+    }
+    cell += "</td>";
+    return cell;
+  }
+
+  std::string RenderNavigation(
+      const Window& window, size_t q_begin, size_t q_end, size_t u_begin, size_t u_end) const {
+    const auto link = [](const Window& target, const char* text) {
+      return "<a href='" + target.Query() + "'>" + text + "</a>";
+    };
+    std::string html =
+        bricks::strings::Printf("<tr><td colspan=%d align=center>", static_cast<int>(u_end - u_begin + 1));
+    if (q_begin) {
+      Window previous = window;
+      previous.q_offset = q_begin - std::min(q_begin, window.q_limit);
+      html += link(previous, "&uarr; Questions") + ' ';
+    }
+    html += bricks::strings::Printf("Questions %d&ndash;%d of %d",
+                                    static_cast<int>(q_begin + (q_end > q_begin)),
+                                    static_cast<int>(q_end),
+                                    static_cast<int>(rows_.size()));
+    if (q_end < rows_.size()) {
+      Window next = window;
+      next.q_offset = q_end;
+      html += ' ' + link(next, "Questions &darr;");
+    }
+    html += " | ";
+    if (u_begin) {
+      Window previous = window;
+      previous.u_offset = u_begin - std::min(u_begin, window.u_limit);
+      html += link(previous, "&larr; Users") + ' ';
+    }
+    html += bricks::strings::Printf("Users %d&ndash;%d of %d",
+                                    static_cast<int>(u_begin + (u_end > u_begin)),
+                                    static_cast<int>(u_end),
+                                    static_cast<int>(users_.size()));
+    if (u_end < users_.size()) {
+      Window next = window;
+      next.u_offset = u_end;
+      html += ' ' + link(next, "Users &rarr;");
+    }
+    html += "</td></tr>\n";
+    return html;
+  }
+
+  // The row to change, copied first if it is shared with another table.
+  Row& MutableRow(size_t qi) {
+    if (rows_[qi].use_count() > 1) {
+      rows_[qi] = std::make_shared<Row>(*rows_[qi]);
+    }
+    return *rows_[qi];
+  }
+
+  // The whole row, re-assembled first if it is dirty.
+  const std::string& RowHTML(size_t qi) {
+    if (rows_[qi]->dirty) {
+      Row& row = MutableRow(qi);
+      row.html = row.title;
+      for (const auto& cell : row.cells) {
+        row.html += cell;
+      }
+      row.html += "</tr>\n";
+      row.dirty = false;
+    }
+    return rows_[qi]->html;
+  }
+
+  std::vector<schema::UID> users_;
+  std::map<schema::UID, std::vector<size_t>> columns_;  // More than one column if the user is added twice.
+  std::vector<std::string> header_cells_;
+  std::vector<std::shared_ptr<Row>> rows_;
+
+  TableCache(const TableCache&) = delete;
+  void operator=(const TableCache&) = delete;
+};
+
+}  // namespace actions
+
+#endif  // ACTIONS_H
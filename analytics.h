@@ -0,0 +1,335 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+#ifndef ANALYTICS_H
+#define ANALYTICS_H
+
+#include "../Bricks/port.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "schema.h"
+
+#include "../Bricks/cerealize/cerealize.h"
+#include "../Bricks/rtti/dispatcher.h"
+
+// TODO(dkorolev): Move this into Bricks.
+#include "bricks-cerealize-multikeyjson.h"
+
+// Export of the `User` and `Answer` events from the stream of records into external analytics systems.
+//
+// One `Exporter` listens to the stream on behalf of all the sinks enabled for the demo. It encodes each event
+// into JSON once, and hands the same `Event` to every sink.
+namespace analytics {
+
+// The events, in the format of Mixpanel, which the other sinks use as well.
+struct UserEvent {
+  struct Properties {
+    // The identifier of the user who caused the event to happen.
+    std::string distinct_id;
+
+    // The time of the event, in seconds.
+    uint64_t time;
+
+    template <typename A>
+    void serialize(A& ar) {
+      ar(CEREAL_NVP(distinct_id), CEREAL_NVP(time));
+    }
+  };
+
+  std::string event;
+  Properties properties;
+
+  explicit UserEvent(const schema::UserRecord& u) {
+    event = "User";
+    properties.distinct_id = u.uid;
+    properties.time = static_cast<uint64_t>(u.ms) / 1000;
+  }
+
+  template <typename A>
+  void serialize(A& ar) {
+    ar(CEREAL_NVP(event), CEREAL_NVP(properties));
+  }
+};
+
+struct AnswerEvent {
+  struct Properties {
+    // The identifier of the user who caused the event to happen.
+    std::string distinct_id;
+
+    // The time of the event, in seconds.
+    uint64_t time;
+
+    // Question identifier.
+    schema::QID qid;
+
+    // Answer identifier.
+    schema::ANSWER answer;
+
+    template <typename A>
+    void serialize(A& ar) {
+      ar(CEREAL_NVP(distinct_id),
+         CEREAL_NVP(time),
+         cereal::make_nvp("Question", static_cast<size_t>(qid)),
+         cereal::make_nvp("Answer", static_cast<int>(answer)));
+    }
+  };
+
+  std::string event;
+  Properties properties;
+
+  explicit AnswerEvent(const schema::AnswerRecord& a) {
+    event = "Answer";
+    properties.distinct_id = a.uid;
+    properties.time = static_cast<uint64_t>(a.ms) / 1000;
+    properties.qid = a.qid;
+    properties.answer = a.answer;
+  }
+
+  template <typename A>
+  void serialize(A& ar) {
+    ar(CEREAL_NVP(event), CEREAL_NVP(properties));
+  }
+};
+
+// An event encoded once, as `{"event":...,"properties":{...}}`.
+struct Event {
+  std::string json;
+
+  template <typename T>
+  explicit Event(T&& event)
+      : json(bricks::cerealize::MultiKeyJSON(event)) {}
+
+  // Returns the JSON with one more string property prepended, such as the token of the destination.
+  // Cheaper than encoding the event once again.
+  std::string WithProperty(const std::string& key, const std::string& value) const {
+    return WithProperty(json, key, value);
+  }
+
+  // The same for the JSON of an event returned by the above, to add more than one property.
+  static std::string WithProperty(const std::string& json, const std::string& key, const std::string& value) {
+    static const std::string properties = "\"properties\":{";
+    const size_t pos = json.find(properties);
+    if (pos == std::string::npos) {
+      return json;
+    }
+    const size_t insert_pos = pos + properties.length();
+    std::string property = '"' + key + "\":\"";
+    for (const char c : value) {
+      if (c == '"' || c == '\\') {
+        property += '\\';
+      }
+      property += c;
+    }
+    property += '"';
+    if (insert_pos < json.length() && json[insert_pos] != '}') {
+      property += ',';
+    }
+    return json.substr(0, insert_pos) + property + json.substr(insert_pos);
+  }
+};
+
+// The interface of a destination for the events. `source_index` is the index of the record in the stream,
+// which the sinks can use to not export the same event twice when the stream is replayed.
+class Sink {
+ public:
+  virtual ~Sink() = default;
+  virtual void Push(size_t source_index, const Event& event) = 0;
+  // The index of the first stream entry the sink has not got yet, for the export to resume from after
+  // a restart or a wake-up, when the stream has `live` entries already. The sinks that do not keep track
+  // of it are at-most-once, and get the entries from `live` on.
+  virtual size_t NextSourceIndex(size_t live) const { return live; }
+};
+
+// The single listener of the stream of records for all the sinks of the demo.
+class Exporter final {
+ public:
+  explicit Exporter(const std::string& demo_id) : demo_id_(demo_id) {}
+
+  void AddSink(std::unique_ptr<Sink> sink) {
+    sinks_.push_back(std::move(sink));
+    first_indexes_.push_back(0u);
+  }
+
+  size_t SinksCount() const { return sinks_.size(); }
+
+  // The index of the stream entry to subscribe from, when the stream has `live` entries already: the earliest
+  // of the `Sink::NextSourceIndex()`-s. Each sink then only gets the entries from its own one on.
+  size_t ResumeFrom(size_t live) {
+    size_t first = live;
+    for (size_t i = 0; i < sinks_.size(); ++i) {
+      first_indexes_[i] = std::min(sinks_[i]->NextSourceIndex(live), live);
+      first = std::min(first, first_indexes_[i]);
+    }
+    return first;
+  }
+
+  inline bool Entry(const std::unique_ptr<schema::Base>& entry, size_t index, size_t total) {
+    static_cast<void>(total);
+
+    if (!sinks_.empty()) {
+      current_index_ = index;
+      struct types {
+        typedef schema::Base base;
+        typedef std::tuple<schema::UserRecord, schema::AnswerRecord> derived_list;
+        typedef bricks::rtti::RuntimeTupleDispatcher<base, derived_list> dispatcher;
+      };
+      types::dispatcher::DispatchCall(*entry, *this);
+    }
+
+    return true;
+  }
+
+  inline void Terminate() { std::cerr << '@' << demo_id_ << " analytics::Exporter is done.\n"; }
+
+  inline void operator()(schema::Base&) {
+    // Sink for ignored events; currently `Question`-s.
+  }
+
+  inline void operator()(schema::UserRecord& u) { Export(Event(UserEvent(u))); }
+
+  inline void operator()(schema::AnswerRecord& a) { Export(Event(AnswerEvent(a))); }
+
+ private:
+  void Export(const Event& event) {
+    for (size_t i = 0; i < sinks_.size(); ++i) {
+      if (current_index_ >= first_indexes_[i]) {
+        sinks_[i]->Push(current_index_, event);
+      }
+    }
+  }
+
+  const std::string demo_id_;
+  std::vector<std::unique_ptr<Sink>> sinks_;
+  std::vector<size_t> first_indexes_;  // Of the entries to push into each of the `sinks_`.
+  size_t current_index_ = 0;
+
+  Exporter() = delete;
+  Exporter(const Exporter&) = delete;
+  void operator=(const Exporter&) = delete;
+};
+
+// Appends the events to a local newline-delimited JSON file. At-most-once: the events of the entries the demo
+// has stored but not yet exported when it is hibernated, or when the process dies, are not appended.
+class NDJSONFileSink final : public Sink {
+ public:
+  explicit NDJSONFileSink(const std::string& path) : file_(std::fopen(path.c_str(), "a")) {
+    if (!file_) {
+      std::cerr << "NDJSONFileSink can not open `" << path << "`.\n";
+    }
+  }
+
+  ~NDJSONFileSink() {
+    if (file_) {
+      std::fclose(file_);
+    }
+  }
+
+  void Push(size_t, const Event& event) override {
+    if (file_) {
+      std::fwrite(event.json.data(), 1, event.json.length(), file_);
+      std::fputc('\n', file_);
+      std::fflush(file_);
+    }
+  }
+
+ private:
+  FILE* file_;
+
+  NDJSONFileSink(const NDJSONFileSink&) = delete;
+  void operator=(const NDJSONFileSink&) = delete;
+};
+
+// Sends each event as a UDP datagram to a local collector at `host:port`. Fire-and-forget, so at-most-once,
+// like the `NDJSONFileSink`.
+class UDPSink final : public Sink {
+ public:
+  explicit UDPSink(const std::string& host_and_port) : socket_(::socket(AF_INET, SOCK_DGRAM, 0)) {
+    std::memset(&address_, 0, sizeof(address_));
+    address_.sin_family = AF_INET;
+    // The port is required, all digits, and from 1 to 65535.
+    const size_t colon = host_and_port.rfind(':');
+    const std::string port = (colon == std::string::npos) ? "" : host_and_port.substr(colon + 1);
+    unsigned long port_number = 0u;
+    bool port_valid = !port.empty() && port.length() <= 5u;
+    for (const char c : port) {
+      port_valid = port_valid && std::isdigit(static_cast<unsigned char>(c));
+      port_number = port_number * 10u + static_cast<unsigned long>(c - '0');
+    }
+    port_valid = port_valid && port_number >= 1u && port_number <= 65535u;
+    std::string host = (colon == std::string::npos) ? "" : host_and_port.substr(0, colon);
+    if (host.empty() || host == "localhost") {
+      host = "127.0.0.1";
+    }
+    address_.sin_port = htons(static_cast<uint16_t>(port_valid ? port_number : 0u));
+    if (socket_ < 0 || !port_valid || ::inet_pton(AF_INET, host.c_str(), &address_.sin_addr) != 1) {
+      std::cerr << "UDPSink can not send to `" << host_and_port << "`.\n";
+      Close();
+    }
+  }
+
+  ~UDPSink() { Close(); }
+
+  bool IsOpen() const { return socket_ >= 0; }
+
+  void Push(size_t, const Event& event) override {
+    if (socket_ >= 0) {
+      ::sendto(socket_,
+               event.json.data(),
+               event.json.length(),
+               0,
+               reinterpret_cast<const struct sockaddr*>(&address_),
+               sizeof(address_));
+    }
+  }
+
+ private:
+  void Close() {
+    if (socket_ >= 0) {
+      ::close(socket_);
+      socket_ = -1;
+    }
+  }
+
+  int socket_;
+  struct sockaddr_in address_;
+
+  UDPSink(const UDPSink&) = delete;
+  void operator=(const UDPSink&) = delete;
+};
+
+}  // namespace analytics
+
+#endif  // ANALYTICS_H
@@ -0,0 +1,197 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "../Bricks/port.h"
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <new>
+#include <scoped_allocator>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+
+// Per-demo memory arenas, for the node-based containers of a demo, which churn through small allocations.
+//
+// An `Arena` carves the blocks out of large chunks mapped straight from the OS, one size class per 16 bytes,
+// and keeps the freed blocks on per-class free lists for reuse. The chunks are unmapped all at once when the
+// arena is destroyed, along with its demo, so that the nodes of the demos do not fragment the global heap,
+// and the memory of a torn down demo goes back to the OS rather than into the free lists of `malloc`.
+//
+// Use `Map` and `Set`, constructed with `Allocator<char>(&arena)`. A default-constructed `Allocator` uses the
+// global heap. The allocator does not propagate on assignment: a container keeps allocating from the arena
+// it has been constructed with, so that copying the state of one demo into another does not tie it to the
+// arena of the first one.
+namespace arena {
+
+const size_t kChunkSize = 256 * 1024;
+const size_t kAlignment = 16;
+const size_t kMaxPooledSize = 512;  // The larger blocks, such as the arrays of the vectors, go to the heap.
+
+class Arena final {
+ public:
+  Arena() {
+    for (auto& head : free_lists_) {
+      head = nullptr;
+    }
+  }
+
+  ~Arena() {
+    for (char* chunk : chunks_) {
+      ::munmap(chunk, kChunkSize);
+    }
+    TotalBytesReserved() -= chunks_.size() * kChunkSize;
+  }
+
+  void* Allocate(size_t bytes) {
+    if (bytes > kMaxPooledSize) {
+      return ::operator new(bytes);
+    }
+    const size_t size_class = SizeClass(bytes);
+    std::lock_guard<std::mutex> lock(mutex_);
+    bytes_in_use_ += size_class * kAlignment;
+    FreeBlock*& head = free_lists_[size_class];
+    if (head) {
+      FreeBlock* block = head;
+      head = block->next;
+      return block;
+    }
+    if (chunks_.empty() || offset_ + size_class * kAlignment > kChunkSize) {
+      void* chunk = ::mmap(nullptr, kChunkSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (chunk == MAP_FAILED) {
+        bytes_in_use_ -= size_class * kAlignment;
+        throw std::bad_alloc();
+      }
+      chunks_.push_back(static_cast<char*>(chunk));
+      offset_ = 0;
+      TotalBytesReserved() += kChunkSize;
+    }
+    void* block = chunks_.back() + offset_;
+    offset_ += size_class * kAlignment;
+    return block;
+  }
+
+  void Deallocate(void* ptr, size_t bytes) {
+    if (bytes > kMaxPooledSize) {
+      ::operator delete(ptr);
+      return;
+    }
+    const size_t size_class = SizeClass(bytes);
+    std::lock_guard<std::mutex> lock(mutex_);
+    bytes_in_use_ -= size_class * kAlignment;
+    FreeBlock* block = static_cast<FreeBlock*>(ptr);
+    block->next = free_lists_[size_class];
+    free_lists_[size_class] = block;
+  }
+
+  size_t BytesReserved() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return chunks_.size() * kChunkSize;
+  }
+
+  size_t BytesInUse() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_in_use_;
+  }
+
+  // Of all the arenas of the process.
+  static std::atomic<size_t>& TotalBytesReserved() {
+    static std::atomic<size_t> bytes(0u);
+    return bytes;
+  }
+
+ private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  static size_t SizeClass(size_t bytes) { return bytes ? (bytes + kAlignment - 1) / kAlignment : 1u; }
+
+  mutable std::mutex mutex_;
+  std::vector<char*> chunks_;
+  size_t offset_ = 0;
+  size_t bytes_in_use_ = 0;
+  FreeBlock* free_lists_[kMaxPooledSize / kAlignment + 1];
+
+  Arena(const Arena&) = delete;
+  void operator=(const Arena&) = delete;
+};
+
+template <typename T>
+struct Allocator {
+  typedef T value_type;
+
+  Allocator() noexcept : arena(nullptr) {}
+  explicit Allocator(Arena* arena) noexcept : arena(arena) {}
+  template <typename U>
+  Allocator(const Allocator<U>& other) noexcept : arena(other.arena) {}
+
+  template <typename U>
+  struct rebind {
+    typedef Allocator<U> other;
+  };
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(arena ? arena->Allocate(n * sizeof(T)) : ::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T* ptr, size_t n) {
+    if (arena) {
+      arena->Deallocate(ptr, n * sizeof(T));
+    } else {
+      ::operator delete(ptr);
+    }
+  }
+
+  Arena* arena;
+};
+
+template <typename T, typename U>
+bool operator==(const Allocator<T>& lhs, const Allocator<U>& rhs) {
+  return lhs.arena == rhs.arena;
+}
+
+template <typename T, typename U>
+bool operator!=(const Allocator<T>& lhs, const Allocator<U>& rhs) {
+  return lhs.arena != rhs.arena;
+}
+
+// The nested containers of a `Map`, such as the maps of maps, allocate from the same arena.
+template <typename K, typename V>
+using Map = std::map<K, V, std::less<K>, std::scoped_allocator_adaptor<Allocator<std::pair<const K, V>>>>;
+
+template <typename K>
+using Set = std::set<K, std::less<K>, Allocator<K>>;
+
+}  // namespace arena
+
+#endif  // ARENA_H
@@ -0,0 +1,228 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+#ifndef ASSETS_H
+#define ASSETS_H
+
+#include "../Bricks/port.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "compression.h"
+#include "fanout.h"
+
+#include "../Bricks/file/file.h"
+#include "../Bricks/net/api/api.h"
+#include "../Bricks/strings/printf.h"
+
+// The process-wide cache of the static assets, loaded once at startup and shared by all the demos.
+//
+// Each asset is kept along with its `gzip` and `br` variants, compressed once with the best ratio,
+// and with an `ETag` of its content. The clients get the smallest variant they accept, and a `304`
+// if they already have the current version.
+namespace assets {
+
+// Long-lived, for the scripts and styles. The HTML pages, which refer to them, are revalidated.
+constexpr const char* kCacheForever = "public, max-age=31536000";
+constexpr const char* kRevalidate = "no-cache";
+
+struct Asset {
+  std::string content_type;
+  std::string etag;
+  std::string identity;
+  std::string gzip;    // Empty if it would not be smaller than `identity`.
+  std::string brotli;  // Empty if it would not be smaller than `identity`.
+};
+
+inline std::string ContentType(const std::string& path) {
+  static const std::map<std::string, std::string> types = {{"html", "text/html; charset=utf-8"},
+                                                           {"js", "application/javascript; charset=utf-8"},
+                                                           {"css", "text/css; charset=utf-8"},
+                                                           {"json", "application/json; charset=utf-8"},
+                                                           {"png", "image/png"},
+                                                           {"svg", "image/svg+xml"},
+                                                           {"ico", "image/x-icon"}};
+  const size_t dot = path.rfind('.');
+  const auto cit = types.find(dot == std::string::npos ? "" : path.substr(dot + 1));
+  return cit != types.end() ? cit->second : "application/octet-stream";
+}
+
+// FNV-1a, 64 bit. Only needs to tell the versions of the same file apart.
+inline std::string ETag(const std::string& content) {
+  uint64_t hash = 14695981039346656037ull;
+  for (const char c : content) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+  }
+  return bricks::strings::Printf("\"%016llx\"", static_cast<unsigned long long>(hash));
+}
+
+class Cache final {
+ public:
+  Cache() = default;
+
+  // Loads all the files under `directory`, keyed by their paths relative to it, such as `js/app.js`.
+  void LoadDirectory(const std::string& directory, const std::string& prefix = "") {
+    DIR* dir = ::opendir(directory.c_str());
+    if (!dir) {
+      throw std::runtime_error("Can not read the directory `" + directory + "`.");
+    }
+    std::vector<std::string> names;
+    while (const struct dirent* entry = ::readdir(dir)) {
+      const std::string name = entry->d_name;
+      if (name != "." && name != "..") {
+        names.push_back(name);
+      }
+    }
+    ::closedir(dir);
+    for (const auto& name : names) {
+      const std::string path = bricks::FileSystem::JoinPath(directory, name);
+      struct stat info;
+      if (!::stat(path.c_str(), &info) && S_ISDIR(info.st_mode)) {
+        LoadDirectory(path, prefix + name + '/');
+      } else {
+        Add(prefix + name, bricks::FileSystem::ReadFileAsString(path));
+      }
+    }
+  }
+
+  void Add(const std::string& name, const std::string& content) {
+    std::unique_ptr<Asset> asset(new Asset());
+    asset->content_type = ContentType(name);
+    asset->etag = ETag(content);
+    asset->identity = content;
+    // The images other than SVG are compressed already.
+    if (asset->content_type.compare(0, 6, "image/") || asset->content_type == "image/svg+xml") {
+      asset->gzip = compression::Compress(compression::Encoding::GZIP, content);
+      if (asset->gzip.length() >= content.length()) {
+        asset->gzip.clear();
+      }
+      asset->brotli = compression::Compress(compression::Encoding::BROTLI, content);
+      if (asset->brotli.length() >= content.length()) {
+        asset->brotli.clear();
+      }
+    }
+    assets_[name] = std::move(asset);
+  }
+
+  // Throws if the asset is not there, as all the assets are loaded at startup.
+  const Asset& Get(const std::string& name) const {
+    const auto cit = assets_.find(name);
+    if (cit == assets_.end()) {
+      throw std::logic_error("No asset `" + name + "`.");
+    }
+    return *cit->second;
+  }
+
+  // The names of the assets under `directory`, such as `js/`.
+  std::vector<std::string> List(const std::string& directory = "") const {
+    std::vector<std::string> names;
+    for (const auto& kv : assets_) {
+      if (!kv.first.compare(0, directory.length(), directory)) {
+        names.push_back(kv.first);
+      }
+    }
+    return names;
+  }
+
+  // Responds with the smallest variant the client accepts, or with `304 Not Modified`.
+  void Serve(const std::string& name, Request r, const char* cache_control = kCacheForever) const {
+    const Asset& asset = Get(name);
+    if (fanout::RequestHeader(r, "If-None-Match") == asset.etag) {
+      ++requests_not_modified_;
+      r("", HTTPResponseCode.NotModified, asset.content_type, Headers(asset, cache_control));
+      return;
+    }
+    compression::Encoding encoding =
+        compression::NegotiateEncoding(fanout::RequestHeader(r, "Accept-Encoding"), !asset.brotli.empty());
+    if ((encoding == compression::Encoding::GZIP && asset.gzip.empty()) ||
+        encoding == compression::Encoding::DEFLATE) {
+      encoding = compression::Encoding::IDENTITY;
+    }
+    const std::string& body = encoding == compression::Encoding::BROTLI
+                                  ? asset.brotli
+                                  : (encoding == compression::Encoding::GZIP ? asset.gzip : asset.identity);
+    bytes_identity_ += asset.identity.length();
+    bytes_sent_ += body.length();
+    if (encoding != compression::Encoding::IDENTITY) {
+      r(body,
+        HTTPResponseCode.OK,
+        asset.content_type,
+        Headers(asset, cache_control).Set("Content-Encoding", compression::EncodingName(encoding)));
+    } else {
+      r(body, HTTPResponseCode.OK, asset.content_type, Headers(asset, cache_control));
+    }
+  }
+
+  // The HTTP handler to register for one asset.
+  std::function<void(Request)> Handler(const std::string& name,
+                                       const char* cache_control = kCacheForever) const {
+    Get(name);  // Fail early if the asset is not there.
+    return [this, name, cache_control](Request r) { Serve(name, std::move(r), cache_control); };
+  }
+
+  // The bytes of the assets served uncompressed would have taken, and the bytes actually sent.
+  uint64_t BytesIdentity() const { return bytes_identity_; }
+  uint64_t BytesSent() const { return bytes_sent_; }
+  uint64_t RequestsNotModified() const { return requests_not_modified_; }
+
+ private:
+  static HTTPHeaders Headers(const Asset& asset, const char* cache_control) {
+    return HTTPHeaders()
+        .Set("ETag", asset.etag)
+        .Set("Cache-Control", cache_control)
+        .Set("Vary", "Accept-Encoding");
+  }
+
+  std::map<std::string, std::unique_ptr<Asset>> assets_;
+  mutable std::atomic<uint64_t> bytes_identity_{0u};
+  mutable std::atomic<uint64_t> bytes_sent_{0u};
+  mutable std::atomic<uint64_t> requests_not_modified_{0u};
+
+  Cache(const Cache&) = delete;
+  void operator=(const Cache&) = delete;
+};
+
+// The assets of the process, from the `static` directory. Loaded on the first use, which `main()` makes sure
+// happens before serving.
+inline const Cache& Static() {
+  static const std::unique_ptr<Cache> cache = []() {
+    std::unique_ptr<Cache> cache(new Cache());
+    cache->LoadDirectory("static");
+    return cache;
+  }();
+  return *cache;
+}
+
+}  // namespace assets
+
+#endif  // ASSETS_H
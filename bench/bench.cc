@@ -0,0 +1,1244 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// The microbenchmarks of the hot paths of the demo.
+//
+// Each benchmark is a setup function, which prepares the state and returns the function to run `n` operations
+// against it. The number of operations is doubled until one run takes at least `--bench_min_ms`, and the time
+// per operation of that run is reported, along with the CPU time the whole process, all of its threads, spent
+// per operation. The state is set up anew for each run, so that it does not grow.
+//
+// The footprints, the memory and the threads some of the paths take, are measured once each, after the
+// benchmarks.
+//
+// With `--bench_output`, the results are saved as JSON. With `--bench_baseline`, the results are compared to
+// the previously saved ones, and the binary fails if any benchmark got slower by more than the allowed ratio.
+
+#define AGREE_DISAGREE_DEMO_NO_MAIN
+
+#include "../../Bricks/port.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../demo.cc"
+
+DEFINE_int32(bench_port, 8092, "Local port to use for the benchmarks of the HTTP handlers.");
+DEFINE_string(bench_filter, "", "Only run the benchmarks with this substring in their names.");
+DEFINE_int32(bench_min_ms, 250, "Keep doubling the number of operations until one run takes this long.");
+DEFINE_string(bench_output, "", "Save the results as JSON into this file.");
+DEFINE_string(bench_baseline, "", "Compare the results to the ones saved before into this file.");
+DEFINE_double(bench_max_regression,
+              1.25,
+              "With `--bench_baseline`, fail if any benchmark is this many times slower than its baseline.");
+
+struct BenchmarkResult {
+  std::string name;
+  uint64_t operations;
+  double ns_per_operation;
+  double cpu_ns_per_operation;
+
+  template <typename A>
+  void serialize(A& ar) {
+    ar(CEREAL_NVP(name),
+       CEREAL_NVP(operations),
+       CEREAL_NVP(ns_per_operation),
+       CEREAL_NVP(cpu_ns_per_operation));
+  }
+};
+
+// Sets up the state and returns the function to run the given number of operations against it.
+// Returns an empty function if the benchmark can not run here, ex. without `gnuplot`.
+typedef std::function<std::function<void(size_t)>()> benchmark_type;
+
+// The answers of `users` users to `questions` questions, in three camps that mostly agree within themselves.
+inline Snapshot::Box MakeBox(size_t users, size_t questions) {
+  Snapshot::Box box;
+  std::mt19937 random(42);
+  std::uniform_real_distribution<double> distribution(0.0, 1.0);
+  for (size_t u = 0; u < users; ++u) {
+    box.users.push_back(Printf("user%d", static_cast<int>(u)));
+  }
+  for (size_t q = 1; q <= questions; ++q) {
+    box.questions.push_back(Printf("Question %d?", static_cast<int>(q)));
+    for (size_t u = 0; u < users; ++u) {
+      const bool camp_agrees = ((q + u % 3) % 2) == 0;
+      const bool agrees = (distribution(random) < 0.8) ? camp_agrees : !camp_agrees;
+      box.answers[static_cast<schema::QID>(q)][box.users[u]] =
+          agrees ? schema::ANSWER::AGREE : schema::ANSWER::DISAGREE;
+    }
+  }
+  return box;
+}
+
+inline schema::AnswerRecord MakeAnswer(size_t i) {
+  schema::AnswerRecord record;
+  record.ms = Now();
+  record.uid = Printf("user%d", static_cast<int>(i % 10));
+  record.qid = static_cast<schema::QID>(1 + i % 20);
+  record.answer = (i % 2) ? schema::ANSWER::AGREE : schema::ANSWER::DISAGREE;
+  return record;
+}
+
+// Counts the entries it gets, for the publisher to wait for all the listeners to catch up.
+struct CountingListener {
+  std::atomic_size_t entries{0u};
+  bool Entry(VizPoint<int>&, size_t, size_t) {
+    ++entries;
+    return true;
+  }
+  void Terminate() {}
+};
+
+// Publishes `n` points into a stream with `listeners` in-process subscribers, until all of them get them all.
+inline benchmark_type PublishWithListeners(size_t listeners) {
+  return [listeners]() -> std::function<void(size_t)> {
+    struct State {
+      fanout::Stream<VizPoint<int>> stream{"bench_publish", "point"};
+      std::vector<std::unique_ptr<CountingListener>> listeners;
+      std::vector<fanout::ListenerScope> scopes;
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+    for (size_t i = 0; i < listeners; ++i) {
+      state->listeners.emplace_back(new CountingListener());
+      state->scopes.push_back(state->stream.Subscribe(*state->listeners.back()));
+    }
+    return [state](size_t n) {
+      const double t = static_cast<double>(Now());
+      for (size_t i = 0; i < n; ++i) {
+        state->stream.Publish(VizPoint<int>{t, static_cast<int>(i)});
+      }
+      for (const auto& listener : state->listeners) {
+        while (listener->entries < n) {
+          std::this_thread::yield();
+        }
+      }
+    };
+  };
+}
+
+// Connects to the port of the benchmarks and sends a `GET` request, without reading the response yet.
+inline int OpenSubscriberConnection(const std::string& path) {
+  const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address;
+  std::memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(static_cast<uint16_t>(FLAGS_bench_port));
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (fd < 0 || ::connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address))) {
+    throw std::runtime_error("Can not connect to the port of the benchmarks.");
+  }
+  const std::string request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  ::send(fd, request.data(), request.length(), MSG_NOSIGNAL);
+  return fd;
+}
+
+// Publishes `n` points into each of `streams` streams served over HTTP to `viewers` viewers, until each viewer
+// has read all the points. Each viewer opens one connection per stream, or, with `feed`, one connection to the
+// `fanout::Feed` of all the streams. The CPU time per point is what the fanout costs, plus reading the
+// responses in this thread.
+inline benchmark_type PublishToHTTPViewers(size_t viewers, size_t streams, bool feed) {
+  return [viewers, streams, feed]() -> std::function<void(size_t)> {
+    struct State {
+      std::vector<std::unique_ptr<fanout::Stream<VizPoint<int>>>> streams;
+      fanout::Feed feed;
+      std::vector<int> fds;
+      explicit State(size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+          streams.emplace_back(
+              new fanout::Stream<VizPoint<int>>(Printf("bench_http_publish_%d", static_cast<int>(i)), "point"));
+          feed.Add(Printf("/d/%d", static_cast<int>(i)), streams.back()->Source());
+          HTTP(FLAGS_bench_port).Register(Printf("/bench_http_publish/%d", static_cast<int>(i)),
+                                          std::ref(*streams.back()));
+        }
+        HTTP(FLAGS_bench_port).Register("/bench_http_publish/feed", std::ref(feed));
+      }
+      ~State() {
+        for (size_t i = 0; i < streams.size(); ++i) {
+          HTTP(FLAGS_bench_port).UnRegister(Printf("/bench_http_publish/%d", static_cast<int>(i)));
+        }
+        HTTP(FLAGS_bench_port).UnRegister("/bench_http_publish/feed");
+        for (int fd : fds) {
+          ::close(fd);
+        }
+      }
+    };
+    std::shared_ptr<State> state = std::make_shared<State>(streams);
+    for (size_t i = 0; i < viewers; ++i) {
+      if (feed) {
+        std::string since = "0";
+        for (size_t j = 1; j < streams; ++j) {
+          since += ",0";
+        }
+        state->fds.push_back(
+            OpenSubscriberConnection("/bench_http_publish/feed?since=" + since + "&compress=0"));
+      } else {
+        for (size_t j = 0; j < streams; ++j) {
+          const std::string path = Printf("/bench_http_publish/%d?since=0&compress=0", static_cast<int>(j));
+          state->fds.push_back(OpenSubscriberConnection(path));
+        }
+      }
+    }
+    const size_t points_per_connection = feed ? streams : 1u;
+    return [state, points_per_connection](size_t n) {
+      const double t = static_cast<double>(Now());
+      for (size_t i = 0; i < n; ++i) {
+        for (const auto& stream : state->streams) {
+          stream->Publish(VizPoint<int>{t, static_cast<int>(i)});
+        }
+      }
+      const size_t total = n * points_per_connection;
+      // Each point is one line ending with `}`, while the chunk headers and trailers end with `\r\n`.
+      std::vector<struct pollfd> pending;
+      for (int fd : state->fds) {
+        pending.push_back(pollfd{fd, POLLIN, 0});
+      }
+      std::vector<size_t> points(pending.size(), 0u);
+      std::vector<char> last(pending.size(), '\0');
+      char buffer[65536];
+      while (!pending.empty()) {
+        if (::poll(pending.data(), pending.size(), 10000) <= 0) {
+          throw std::runtime_error("The subscribers stopped receiving the points.");
+        }
+        for (size_t i = 0; i < pending.size(); ++i) {
+          if (pending[i].revents) {
+            const ssize_t length = ::recv(pending[i].fd, buffer, sizeof(buffer), 0);
+            if (length <= 0) {
+              throw std::runtime_error("A subscriber has been disconnected.");
+            }
+            for (ssize_t j = 0; j < length; ++j) {
+              if (buffer[j] == '\n' && last[i] == '}') {
+                ++points[i];
+              }
+              last[i] = buffer[j];
+            }
+          }
+        }
+        for (size_t i = 0; i < pending.size();) {
+          if (points[i] >= total) {
+            pending[i] = pending.back();
+            pending.pop_back();
+            points[i] = points.back();
+            points.pop_back();
+            last[i] = last.back();
+            last.pop_back();
+          } else {
+            ++i;
+          }
+        }
+      }
+    };
+  };
+}
+
+// Compresses `n` encoded records for one subscriber, `per_chunk` records per chunk, counted in the totals.
+inline benchmark_type CompressRecords(size_t per_chunk) {
+  return [per_chunk]() -> std::function<void(size_t)> {
+    std::vector<std::string> records;
+    for (size_t i = 0; i < 1000; ++i) {
+      records.push_back(fanout::Encoder<std::unique_ptr<schema::Base>>::Encode(MakeAnswer(i), "record"));
+    }
+    return [per_chunk, records](size_t n) {
+      compression::StreamingDeflater deflater(compression::Encoding::GZIP);
+      std::string chunk;
+      for (size_t i = 0; i < n; ++i) {
+        chunk += records[i % records.size()];
+        if ((i + 1) % per_chunk == 0 || i + 1 == n) {
+          fanout::CompressChunk(deflater, chunk, nullptr);
+          chunk.clear();
+        }
+      }
+    };
+  };
+}
+
+// Feeds `n` records of the kind `make(i)` returns to the consumer of a demo, the way its message queue does.
+// No users are added, so that the visualization thread does not run the optimizer in the background.
+template <typename F>
+inline benchmark_type ConsumeRecords(F make) {
+  return [make]() -> std::function<void(size_t)> {
+    struct State {
+      const std::string demo_id = "bench_consumer";
+      fanout::Stream<VizPoint<std::string>> image{"bench_consumer_image", "point"};
+      Cruncher::Consumer consumer{demo_id, image, nullptr};
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+    for (size_t q = 1; q <= 20; ++q) {
+      schema::QuestionRecord record;
+      record.qid = static_cast<schema::QID>(q);
+      record.text = Printf("Question %d?", static_cast<int>(q));
+      std::unique_ptr<schema::Base> message(new schema::QuestionRecord(record));
+      state->consumer.OnMessage(message, 0u);
+    }
+    return [state, make](size_t n) {
+      for (size_t i = 0; i < n; ++i) {
+        std::unique_ptr<schema::Base> message(make(i));
+        state->consumer.OnMessage(message, 0u);
+      }
+    };
+  };
+}
+
+// Feeds `n` changed answers to the consumer of a demo that already has `answers` answers to 1000 questions,
+// the way its message queue does. As in `ConsumeRecords()`, no users are added.
+inline benchmark_type ConsumeAnswerChanges(size_t answers) {
+  return [answers]() -> std::function<void(size_t)> {
+    struct State {
+      const std::string demo_id = "bench_consumer_answers";
+      fanout::Stream<VizPoint<std::string>> image{"bench_consumer_answers_image", "point"};
+      Cruncher::Consumer consumer{demo_id, image, nullptr};
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+    // The `i`-th answer of the user `i / 1000` to the question `1 + i % 1000`, changed every `answers` answers.
+    const auto answer = [answers](size_t i) {
+      std::unique_ptr<schema::AnswerRecord> record(new schema::AnswerRecord());
+      record->ms = Now();
+      record->uid = Printf("user%d", static_cast<int>((i % answers) / 1000));
+      record->qid = static_cast<schema::QID>(1 + i % 1000);
+      record->answer = ((i / answers) % 2) ? schema::ANSWER::AGREE : schema::ANSWER::DISAGREE;
+      return std::unique_ptr<schema::Base>(std::move(record));
+    };
+    for (size_t q = 1; q <= 1000; ++q) {
+      schema::QuestionRecord record;
+      record.qid = static_cast<schema::QID>(q);
+      record.text = Printf("Question %d?", static_cast<int>(q));
+      std::unique_ptr<schema::Base> message(new schema::QuestionRecord(record));
+      state->consumer.OnMessage(message, 0u);
+    }
+    for (size_t i = 0; i < answers; ++i) {
+      std::unique_ptr<schema::Base> message(answer(i));
+      state->consumer.OnMessage(message, 0u);
+    }
+    return [state, answers, answer](size_t n) {
+      for (size_t i = 0; i < n; ++i) {
+        std::unique_ptr<schema::Base> message(answer(answers + i));
+        state->consumer.OnMessage(message, 0u);
+      }
+    };
+  };
+}
+
+// Changes `n` answers of the demo with `answers` answers to 1000 questions, taking the previous ones back.
+inline benchmark_type ChangeAnswers(size_t answers) {
+  return [answers]() -> std::function<void(size_t)> {
+    struct State {
+      stats::Tallies tallies;
+      std::vector<schema::ANSWER> previous;
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+    state->previous.resize(answers, schema::ANSWER::DISAGREE);
+    for (size_t i = 0; i < answers; ++i) {
+      state->tallies.Add(static_cast<schema::QID>(1 + i % 1000), schema::ANSWER::DISAGREE);
+    }
+    return [state, answers](size_t n) {
+      for (size_t i = 0; i < n; ++i) {
+        const size_t index = i % answers;
+        const schema::QID qid = static_cast<schema::QID>(1 + index % 1000);
+        const schema::ANSWER answer = (i % 2) ? schema::ANSWER::AGREE : schema::ANSWER::DISAGREE;
+        state->tallies.Remove(qid, state->previous[index]);
+        state->tallies.Add(qid, answer);
+        state->previous[index] = answer;
+      }
+    };
+  };
+}
+
+// Looks up `n` random paths among the 20 paths of each of 10k demos, in the table `T` that `add` fills in.
+// The table is not attached to an HTTP server, whose own exact-match table of all the paths is not counted.
+template <typename T, typename ADD, typename LOOKUP>
+inline benchmark_type LookUpDemoRoutes(ADD add, LOOKUP lookup) {
+  return [add, lookup]() -> std::function<void(size_t)> {
+    struct State {
+      T table;
+      std::vector<std::string> requests;
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+    const std::vector<std::string> sub_routes = {"/u", "/q", "/a/answer", "/a/raw", "/a/matrix", "/a/table",
+                                                 "/a", "/a/", "/", "/config", "/layout", "/layout/meta",
+                                                 "/layout/d/u", "/layout/d/q", "/layout/d/e", "/layout/d/i",
+                                                 "/layout/d/i/viz.png", "/static/app.js", "/static/vendor.js",
+                                                 "/data"};
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < 10000; ++i) {
+      for (const auto& sub_route : sub_routes) {
+        paths.push_back("/demo" + std::to_string(i) + sub_route);
+        add(state->table, paths.back());
+      }
+    }
+    std::mt19937 random(42);
+    for (size_t i = 0; i < 100000; ++i) {
+      state->requests.push_back(paths[random() % paths.size()]);
+    }
+    return [state, lookup](size_t n) {
+      for (size_t i = 0; i < n; ++i) {
+        if (!lookup(state->table, state->requests[i % state->requests.size()])) {
+          throw std::logic_error("The path is not found.");
+        }
+      }
+    };
+  };
+}
+
+// Erases and inserts `n` strings in a set of 1000 strings, allocated from an arena or, without `use_arena`,
+// from the heap.
+inline benchmark_type ChurnSetNodes(bool use_arena) {
+  return [use_arena]() -> std::function<void(size_t)> {
+    struct State {
+      arena::Arena chunks;
+      arena::Set<std::string> set;
+      std::vector<std::string> keys;
+      explicit State(bool use_arena)
+          : set(use_arena ? arena::Allocator<std::string>(&chunks) : arena::Allocator<std::string>()) {}
+    };
+    std::shared_ptr<State> state = std::make_shared<State>(use_arena);
+    for (size_t i = 0; i < 2000; ++i) {
+      state->keys.push_back(Printf("user%d", static_cast<int>(i)));
+    }
+    for (size_t i = 0; i < 1000; ++i) {
+      state->set.insert(state->keys[i]);
+    }
+    return [state](size_t n) {
+      for (size_t i = 0; i < n; ++i) {
+        state->set.erase(state->keys[i % 2000]);
+        state->set.insert(state->keys[(i + 1000) % 2000]);
+      }
+    };
+  };
+}
+
+// A keep-alive HTTP endpoint on a raw socket, serving one connection at a time, which responds `1` to every
+// request right away.
+class KeepAliveEndpoint final {
+ public:
+  KeepAliveEndpoint() : stop_(false), listen_fd_(::socket(AF_INET, SOCK_STREAM, 0)) {
+    struct sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (::bind(listen_fd_, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) ||
+        ::listen(listen_fd_, 64) ||
+        ::getsockname(listen_fd_, reinterpret_cast<struct sockaddr*>(&address), &length)) {
+      throw std::runtime_error("Can not listen for the keep-alive benchmarks.");
+    }
+    port_ = ntohs(address.sin_port);
+    thread_ = std::thread(&KeepAliveEndpoint::Serve, this);
+  }
+
+  ~KeepAliveEndpoint() {
+    stop_ = true;
+    thread_.join();
+    ::close(listen_fd_);
+  }
+
+  std::string URL() const { return Printf("http://localhost:%d/track", port_); }
+
+ private:
+  void Serve() {
+    while (!stop_) {
+      struct pollfd p{listen_fd_, POLLIN, 0};
+      if (::poll(&p, 1, 10) > 0) {
+        const int fd = ::accept(listen_fd_, nullptr, nullptr);
+        std::string buffer;
+        char chunk[16384];
+        ssize_t length;
+        while (!stop_ && (length = ::recv(fd, chunk, sizeof(chunk), 0)) > 0) {
+          buffer.append(chunk, static_cast<size_t>(length));
+          std::string responses;
+          size_t headers_end;
+          while ((headers_end = buffer.find("\r\n\r\n")) != std::string::npos) {
+            const size_t content_length_pos = buffer.find("Content-Length: ");
+            const size_t content_length =
+                (content_length_pos < headers_end)
+                    ? static_cast<size_t>(atoi(buffer.c_str() + content_length_pos + 16))
+                    : 0u;
+            if (buffer.length() < headers_end + 4 + content_length) {
+              break;
+            }
+            buffer.erase(0, headers_end + 4 + content_length);
+            responses += "HTTP/1.1 200 OK\r\nContent-Length: 1\r\n\r\n1";
+          }
+          ::send(fd, responses.data(), responses.length(), MSG_NOSIGNAL);
+        }
+        ::close(fd);
+      }
+    }
+  }
+
+  std::atomic_bool stop_;
+  int listen_fd_;
+  int port_;
+  std::thread thread_;
+
+  KeepAliveEndpoint(const KeepAliveEndpoint&) = delete;
+  void operator=(const KeepAliveEndpoint&) = delete;
+};
+
+// Sends `n` requests to a local endpoint: each over a new connection, over one keep-alive connection, or
+// pipelined over it `pipelined` at a time.
+inline benchmark_type PostToLocalEndpoint(size_t max_idle_connections, size_t pipelined) {
+  return [max_idle_connections, pipelined]() -> std::function<void(size_t)> {
+    struct State {
+      KeepAliveEndpoint endpoint;
+      http_client::Pool pool;
+      std::unique_ptr<http_client::Client> client;
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+    http_client::Options options;
+    options.max_idle_connections_per_host = max_idle_connections;
+    state->client.reset(new http_client::Client(state->endpoint.URL(), options, state->pool));
+    const std::vector<http_client::Request> requests(
+        pipelined, http_client::Request{"POST", "/track", "data=1", "application/x-www-form-urlencoded", {}});
+    return [state, requests](size_t n) {
+      for (size_t i = 0; i < n; i += requests.size()) {
+        if (state->client->Pipeline(requests).back().body != "1") {
+          throw std::logic_error("Unexpected response.");
+        }
+      }
+    };
+  };
+}
+
+// The Actions table of `users` users and `questions` questions, with no answers yet.
+inline void FillActionsTable(actions::TableCache& table, size_t users, size_t questions) {
+  for (size_t u = 0; u < users; ++u) {
+    table.AddUser(Printf("user%d", static_cast<int>(u)));
+  }
+  for (size_t q = 1; q <= questions; ++q) {
+    table.AddQuestion(Printf("Question %d?", static_cast<int>(q)));
+  }
+}
+
+// Sets `n` answers in the Actions table, rendering the page of the `window` after each one.
+inline benchmark_type SetActionsAnswerAndRender(size_t users, size_t questions, const actions::Window& window) {
+  return [users, questions, window]() -> std::function<void(size_t)> {
+    std::shared_ptr<actions::TableCache> table = std::make_shared<actions::TableCache>();
+    FillActionsTable(*table, users, questions);
+    table->Page(window);
+    return [table, users, questions, window](size_t n) {
+      for (size_t i = 0; i < n; ++i) {
+        table->SetAnswer(static_cast<schema::QID>(1 + (i * 7) % questions),
+                         Printf("user%d", static_cast<int>((i * 13) % users)),
+                         (i % 2) ? schema::ANSWER::AGREE : schema::ANSWER::DISAGREE);
+        table->Page(window);
+      }
+    };
+  };
+}
+
+// Renders the first page, of the default window, of `n` new Actions tables.
+inline benchmark_type RenderActionsFromScratch(size_t users, size_t questions) {
+  return [users, questions]() -> std::function<void(size_t)> {
+    return [users, questions](size_t n) {
+      for (size_t i = 0; i < n; ++i) {
+        actions::TableCache table;
+        FillActionsTable(table, users, questions);
+        table.Page(actions::Window());
+      }
+    };
+  };
+}
+
+// Renders the `/config` response `n` times from a dashboard template of 200 paragraphs with three placeholders,
+// either by finding and replacing them in the text, or from the `dashboard::Template` parsed once.
+inline benchmark_type RenderDashboardConfig(bool parsed) {
+  return [parsed]() -> std::function<void(size_t)> {
+    struct State {
+      std::vector<std::string> placeholders = {"<style id=\"a-placeholder\"></style>",
+                                               "<div id=\"b-placeholder\"></div>"};
+      std::string text;
+      std::map<std::string, std::string> replacements;
+      std::unique_ptr<dashboard::Template> parsed;
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+    state->text = "<html><head>" + state->placeholders[0] + "</head><body>";
+    for (size_t i = 0; i < 200; ++i) {
+      state->text +=
+          Printf("<p>Paragraph %d, to make the template realistically long.</p>\n", static_cast<int>(i));
+      if (i == 100) {
+        state->text += state->placeholders[1] + state->placeholders[1];
+      }
+    }
+    state->text += state->placeholders[1] + "</body></html>";
+    state->replacements = {{state->placeholders[0], "<style></style>"},
+                           {state->placeholders[1], "<div>Actions</div>"}};
+    if (parsed) {
+      state->parsed.reset(new dashboard::Template(state->text, state->placeholders));
+    }
+    return [state](size_t n) {
+      for (size_t i = 0; i < n; ++i) {
+        std::string output;
+        if (state->parsed) {
+          output = state->parsed->Render(state->replacements);
+        } else {
+          output = state->text;
+          for (const auto& kv : state->replacements) {
+            std::size_t pos = 0;
+            while (std::string::npos != (pos = output.find(kv.first, pos))) {
+              output.replace(pos, kv.first.length(), kv.second);
+              pos += kv.second.length();
+            }
+          }
+        }
+        JSON(dashboard::Config("/demo/layout", output), "config");
+      }
+    };
+  };
+}
+
+// Renders the `/bootstrap` response of a dashboard of two streams `n` times, publishing a new point into one of
+// the streams before each rendering with `publish`, or serving it from the cache otherwise.
+inline benchmark_type RenderDashboardBootstrap(bool publish) {
+  return [publish]() -> std::function<void(size_t)> {
+    struct State {
+      fanout::Stream<VizPoint<int>> u{"bench_bootstrap_u", "point"};
+      fanout::Stream<VizPoint<int>> q{"bench_bootstrap_q", "point"};
+      dashboard::Bootstrap bootstrap{"{}\n", "{}\n", {{"/u_meta", "{}\n"}, {"/q_meta", "{}\n"}}};
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+    State& s = *state;
+    s.bootstrap.AddStream("/d/u", [&s]() { return s.u.Size(); }, [&s]() { return s.u.Latest(); });
+    s.bootstrap.AddStream("/d/q", [&s]() { return s.q.Size(); }, [&s]() { return s.q.Latest(); });
+    s.u.Publish(VizPoint<int>{static_cast<double>(Now()), 0});
+    s.q.Publish(VizPoint<int>{static_cast<double>(Now()), 0});
+    s.bootstrap.Render();
+    return [state, publish](size_t n) {
+      const double t = static_cast<double>(Now());
+      for (size_t i = 0; i < n; ++i) {
+        if (publish) {
+          state->u.Publish(VizPoint<int>{t, static_cast<int>(i)});
+        }
+        state->bootstrap.Render();
+      }
+    };
+  };
+}
+
+inline std::vector<std::pair<std::string, benchmark_type>> Benchmarks() {
+  typedef std::function<void(size_t)> run_type;
+  std::vector<std::pair<std::string, benchmark_type>> benchmarks;
+
+  // The `Storage`, directly and via its HTTP handler.
+  benchmarks.emplace_back("storage/do_add_user", []() -> run_type {
+    std::shared_ptr<db::Storage> storage = std::make_shared<db::Storage>(FLAGS_bench_port, "bench");
+    return [storage](size_t n) {
+      for (size_t i = 0; i < n; ++i) {
+        storage->DoAddUser(Printf("user%d", static_cast<int>(i)), Now());
+      }
+    };
+  });
+  benchmarks.emplace_back("storage/do_add_question", []() -> run_type {
+    std::shared_ptr<db::Storage> storage = std::make_shared<db::Storage>(FLAGS_bench_port, "bench");
+    return [storage](size_t n) {
+      for (size_t i = 0; i < n; ++i) {
+        storage->DoAddQuestion(Printf("Question %d?", static_cast<int>(i)), Now());
+      }
+    };
+  });
+  benchmarks.emplace_back("storage/do_add_answer", []() -> run_type {
+    std::shared_ptr<db::Storage> storage = std::make_shared<db::Storage>(FLAGS_bench_port, "bench");
+    return [storage](size_t n) {
+      for (size_t i = 0; i < n; ++i) {
+        const schema::AnswerRecord a = MakeAnswer(i);
+        storage->DoAddAnswer(a.uid, a.qid, a.answer, a.ms);
+      }
+    };
+  });
+  benchmarks.emplace_back("storage/http_answer", []() -> run_type {
+    std::shared_ptr<db::Storage> storage = std::make_shared<db::Storage>(FLAGS_bench_port, "bench");
+    storage->DoAddUser("adam", Now());
+    storage->DoAddQuestion("Why?", Now());
+    const std::string url =
+        Printf("http://localhost:%d/bench/a/answer?uid=adam&qid=1&answer=", FLAGS_bench_port);
+    return [storage, url](size_t n) {
+      for (size_t i = 0; i < n; ++i) {
+        if (static_cast<int>(HTTP(POST(url + ((i % 2) ? "1" : "-1"), "")).code) != 204) {
+          throw std::logic_error("POST `/a/answer` failed.");
+        }
+      }
+    };
+  });
+
+  // The lookup of the handler of a request among the routes of 10k demos: the dispatcher, and one exact-match
+  // table of all the paths, the way the HTTP server keeps them.
+  struct Dispatcher {
+    routes::Dispatcher dispatcher{0};
+  };
+  benchmarks.emplace_back(
+      "routes/dispatcher_10k_demos",
+      LookUpDemoRoutes<Dispatcher>(
+          [](Dispatcher& table, const std::string& path) {
+            table.dispatcher.Add(path, std::make_shared<const routes::handler_type>([](Request) {}));
+          },
+          [](Dispatcher& table, const std::string& path) {
+            return static_cast<bool>(table.dispatcher.Resolve(path));
+          }));
+  typedef std::map<std::string, routes::handler_type> ExactMatch;
+  benchmarks.emplace_back(
+      "routes/exact_match_10k_demos",
+      LookUpDemoRoutes<ExactMatch>(
+          [](ExactMatch& table, const std::string& path) { table[path] = [](Request) {}; },
+          [](ExactMatch& table, const std::string& path) { return table.find(path) != table.end(); }));
+
+  // The fanout of the streams to their subscribers.
+  benchmarks.emplace_back("fanout/publish_1_listener", PublishWithListeners(1));
+  benchmarks.emplace_back("fanout/publish_16_listeners", PublishWithListeners(16));
+  benchmarks.emplace_back("fanout/publish_1_http_subscriber", PublishToHTTPViewers(1, 1, false));
+  benchmarks.emplace_back("fanout/publish_100_http_subscribers", PublishToHTTPViewers(100, 1, false));
+  benchmarks.emplace_back("fanout/publish_1000_http_subscribers", PublishToHTTPViewers(1000, 1, false));
+  // Four cells of a dashboard, over four connections per viewer or over one feed.
+  benchmarks.emplace_back("fanout/publish_4_streams_to_100_viewers", PublishToHTTPViewers(100, 4, false));
+  benchmarks.emplace_back("fanout/feed_4_streams_to_100_viewers", PublishToHTTPViewers(100, 4, true));
+  // The compression of the records for one gzip subscriber, one chunk per record as they come live,
+  // and 64 records per chunk as when catching up.
+  benchmarks.emplace_back("fanout/gzip_1_record_per_chunk", CompressRecords(1));
+  benchmarks.emplace_back("fanout/gzip_64_records_per_chunk", CompressRecords(64));
+
+  // The dispatch of the messages of the demo.
+  benchmarks.emplace_back("consumer/on_message_question", ConsumeRecords([](size_t i) {
+    schema::QuestionRecord* record = new schema::QuestionRecord();
+    record->qid = static_cast<schema::QID>(21 + i);
+    record->text = "Why?";
+    return record;
+  }));
+  benchmarks.emplace_back("consumer/on_message_answer",
+                          ConsumeRecords([](size_t i) { return new schema::AnswerRecord(MakeAnswer(i)); }));
+  // The answer path of the consumer, through the box, the tallies and the Actions table, at 1k and 1M answers.
+  benchmarks.emplace_back("consumer/change_answer_of_1k", ConsumeAnswerChanges(1000));
+  benchmarks.emplace_back("consumer/change_answer_of_1m", ConsumeAnswerChanges(1000000));
+
+  benchmarks.emplace_back("snapshot/sliding_window", []() -> run_type {
+    return [](size_t n) {
+      Snapshot::SlidingWindowTracker tracker;
+      size_t total = 0;
+      for (size_t i = 0; i < n; ++i) {
+        const double t = 10.0 * i;  // 1500 actions in the 15 seconds window.
+        tracker.AddAction(t);
+        total += static_cast<size_t>(tracker.GetValueOverSlidingWindow(t));
+      }
+      if (n && !total) {
+        throw std::logic_error("The sliding window is empty.");
+      }
+    };
+  });
+
+  // The per-question tallies, the same cost per answer regardless of how many answers there are.
+  benchmarks.emplace_back("stats/change_answer_of_1k", ChangeAnswers(1000));
+  benchmarks.emplace_back("stats/change_answer_of_1m", ChangeAnswers(1000000));
+
+  // The model behind the image: 50 users, 100 questions.
+  typedef Cruncher::Consumer::StaticFunctionData optimizer_type;
+  benchmarks.emplace_back("optimizer/agreement_matrix", []() -> run_type {
+    std::shared_ptr<Snapshot::Box> box = std::make_shared<Snapshot::Box>(MakeBox(50, 100));
+    return [box](size_t n) {
+      for (size_t i = 0; i < n; ++i) {
+        optimizer_type::AgreementMatrix(*box);
+      }
+    };
+  });
+  benchmarks.emplace_back("optimizer/cost", []() -> run_type {
+    optimizer_type& data = bricks::ThreadLocalSingleton<optimizer_type>();
+    const Snapshot::Box box = MakeBox(50, 100);
+    data.N = box.users.size();
+    data.AD = optimizer_type::AgreementMatrix(box);
+    std::vector<double> x;
+    for (size_t i = 0; i < data.N; ++i) {
+      const double phi = M_PI * 2 * i / data.N;
+      x.push_back(cos(phi));
+      x.push_back(sin(phi));
+    }
+    return [x](size_t n) {
+      double sum = 0.0;
+      for (size_t i = 0; i < n; ++i) {
+        sum += optimizer_type::compute(x);
+      }
+      if (!std::isfinite(sum)) {
+        throw std::logic_error("The cost function is not finite.");
+      }
+    };
+  });
+  benchmarks.emplace_back("image/regenerate_20_users", []() -> run_type {
+    std::shared_ptr<Snapshot::Box> box = std::make_shared<Snapshot::Box>(MakeBox(20, 50));
+    try {
+      Cruncher::Consumer::RegenerateImage(*box);
+    } catch (...) {
+      // No `gnuplot` here.
+      return nullptr;
+    }
+    return [box](size_t n) {
+      for (size_t i = 0; i < n; ++i) {
+        Cruncher::Consumer::RegenerateImage(*box);
+      }
+    };
+  });
+
+  // The serialization of the records and of the analytics events.
+  benchmarks.emplace_back("json/encode_record", []() -> run_type {
+    return [](size_t n) {
+      const schema::AnswerRecord record = MakeAnswer(0);
+      for (size_t i = 0; i < n; ++i) {
+        fanout::Encoder<std::unique_ptr<schema::Base>>::Encode(record, "record");
+      }
+    };
+  });
+  benchmarks.emplace_back("json/parse_record", []() -> run_type {
+    const std::string json = fanout::Encoder<std::unique_ptr<schema::Base>>::Encode(MakeAnswer(0), "record");
+    return [json](size_t n) {
+      for (size_t i = 0; i < n; ++i) {
+        std::unique_ptr<schema::Base> record;
+        ParseJSON(json, record);
+      }
+    };
+  });
+  benchmarks.emplace_back("json/multikey_answer_event", []() -> run_type {
+    return [](size_t n) {
+      analytics::AnswerEvent event(MakeAnswer(0));
+      for (size_t i = 0; i < n; ++i) {
+        bricks::cerealize::MultiKeyJSON(event);
+      }
+    };
+  });
+
+  // The `/config` response of a dashboard, rendered once per demo.
+  benchmarks.emplace_back("dashboard/config_find_and_replace", RenderDashboardConfig(false));
+  benchmarks.emplace_back("dashboard/config_parsed_template", RenderDashboardConfig(true));
+  // The `/bootstrap` response, which bundles the first paint of a dashboard into one request.
+  benchmarks.emplace_back("dashboard/bootstrap_cached", RenderDashboardBootstrap(false));
+  benchmarks.emplace_back("dashboard/bootstrap_after_publish", RenderDashboardBootstrap(true));
+
+  // The table of the Actions page: 10 users and 20 questions, all on the first page, and 1000 users and 200
+  // questions, of which the first page shows the first 50 of each.
+  const actions::Window first_page;
+  benchmarks.emplace_back("actions/set_answer_and_render", SetActionsAnswerAndRender(10, 20, first_page));
+  benchmarks.emplace_back("actions/render_from_scratch", RenderActionsFromScratch(10, 20));
+  benchmarks.emplace_back("actions/answer_and_page_1_1000x200",
+                          SetActionsAnswerAndRender(1000, 200, first_page));
+  benchmarks.emplace_back("actions/page_1_from_scratch_1000x200", RenderActionsFromScratch(1000, 200));
+  // A page from the middle of the table, and a page of 50 questions by all of the 500 users, whose rows are
+  // served from the cached row HTML.
+  actions::Window mid_page;
+  mid_page.u_offset = 500;
+  mid_page.q_offset = 100;
+  benchmarks.emplace_back("actions/answer_and_mid_page_1000x200",
+                          SetActionsAnswerAndRender(1000, 200, mid_page));
+  actions::Window wide_page;
+  wide_page.u_limit = actions::Window::kMaxLimit;
+  benchmarks.emplace_back("actions/answer_and_wide_page_500x200",
+                          SetActionsAnswerAndRender(500, 200, wide_page));
+
+  // The HTTP client, against a local endpoint that responds right away.
+  benchmarks.emplace_back("http_client/post_new_connection", PostToLocalEndpoint(0, 1));
+  benchmarks.emplace_back("http_client/post_keep_alive", PostToLocalEndpoint(4, 1));
+  benchmarks.emplace_back("http_client/pipeline_50_posts", PostToLocalEndpoint(4, 50));
+
+  // The Mixpanel uploader, against a local endpoint that accepts every batch.
+  benchmarks.emplace_back("mixpanel/upload_to_local_endpoint", []() -> run_type {
+    struct State {
+      std::unique_ptr<MixpanelUploader> uploader;
+      State() {
+        HTTP(FLAGS_bench_port).Register("/bench_mixpanel", [](Request r) { r("1\n"); });
+        uploader.reset(new MixpanelUploader(
+            "bench_mixpanel", "token", Printf("http://localhost:%d/bench_mixpanel", FLAGS_bench_port)));
+      }
+      ~State() {
+        uploader.reset();
+        HTTP(FLAGS_bench_port).UnRegister("/bench_mixpanel");
+      }
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+    return [state](size_t n) {
+      for (size_t i = 0; i < n; ++i) {
+        state->uploader->Push(i, analytics::Event(analytics::AnswerEvent(MakeAnswer(i))));
+      }
+      while (state->uploader->EventsSent() < n) {
+        std::this_thread::yield();
+      }
+    };
+  });
+
+  // The churn of the nodes of a demo's index, allocated from its arena or from the heap.
+  benchmarks.emplace_back("arena/set_insert_erase", ChurnSetNodes(true));
+  benchmarks.emplace_back("arena/heap_set_insert_erase", ChurnSetNodes(false));
+
+  // The state a fork copies from its parent: the records of a 1k-user demo, and its Actions table.
+  benchmarks.emplace_back("fork/share_11k_records", []() -> run_type {
+    const size_t records = 1000 + 20 + 10000;
+    const auto encoded = [](size_t i) {
+      return std::make_shared<const std::string>(
+          fanout::Encoder<std::unique_ptr<schema::Base>>::Encode(MakeAnswer(i), "record"));
+    };
+    std::shared_ptr<segmented_log::Log> parent = std::make_shared<segmented_log::Log>();
+    for (size_t i = 0; i < records; ++i) {
+      parent->Append(i, encoded(i));
+    }
+    std::shared_ptr<const std::string> record = encoded(records);
+    return [parent, records, record](size_t n) {
+      for (size_t i = 0; i < n; ++i) {
+        segmented_log::Log fork;
+        fork.SetBase(parent->SharedPrefix(records));
+        fork.Append(records, record);
+      }
+    };
+  });
+  benchmarks.emplace_back("fork/share_actions_table_1000x20", []() -> run_type {
+    std::shared_ptr<actions::TableCache> parent = std::make_shared<actions::TableCache>();
+    FillActionsTable(*parent, 1000, 20);
+    parent->Page(actions::Window());
+    return [parent](size_t n) {
+      for (size_t i = 0; i < n; ++i) {
+        actions::TableCache fork;
+        fork.ShareFrom(*parent);
+      }
+    };
+  });
+
+  return benchmarks;
+}
+
+// Resident set size of the process, in bytes, or zero if unknown.
+inline size_t CurrentRSS() {
+  FILE* f = fopen("/proc/self/statm", "r");
+  long pages = 0;
+  long resident = 0;
+  if (f) {
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+      resident = 0;
+    }
+    fclose(f);
+  }
+  return static_cast<size_t>(resident) * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+// The answers of one demo, allocated from the arena of the demo if it has one, and from the heap otherwise.
+struct ArenaBenchDemo {
+  std::unique_ptr<arena::Arena> arena;
+  arena::Map<schema::QID, arena::Map<schema::UID, schema::ANSWER>> answers;
+  explicit ArenaBenchDemo(bool use_arena)
+      : arena(use_arena ? new arena::Arena() : nullptr), answers(arena::Allocator<char>(arena.get())) {}
+};
+
+// Creates and destroys 10k demos, a hundred of them alive at a time, with twenty questions and fifty users
+// each, while the rest of the process keeps making small long-lived allocations in between.
+// Returns the growth of RSS once all the demos are gone, in kilobytes.
+inline double RSSGrowthAfterTenThousandDemos(bool use_arenas) {
+  // Kept across the calls, as they would be across the demos of a process.
+  static std::vector<std::unique_ptr<std::string>> long_lived;
+  const size_t rss_before = CurrentRSS();
+  std::vector<std::unique_ptr<ArenaBenchDemo>> demos(100);
+  for (size_t i = 0; i < 10000; ++i) {
+    std::unique_ptr<ArenaBenchDemo>& demo = demos[i % demos.size()];
+    demo.reset(new ArenaBenchDemo(use_arenas));
+    for (size_t a = 0; a < 1000; ++a) {
+      const schema::QID qid = static_cast<schema::QID>(1 + (a * 7 + i) % 20);
+      const schema::UID uid = Printf("user%d", static_cast<int>((a * 13 + i) % 50));
+      if (a % 5 == 4) {
+        demo->answers[qid].erase(uid);
+      } else {
+        demo->answers[qid][uid] = (a % 2) ? schema::ANSWER::AGREE : schema::ANSWER::DISAGREE;
+      }
+      if (a % 250 == 0) {
+        long_lived.emplace_back(new std::string(Printf("demo%d", static_cast<int>(i))));
+      }
+    }
+  }
+  demos.clear();
+  const size_t rss_after = CurrentRSS();
+  return static_cast<double>(rss_after - std::min(rss_before, rss_after)) / 1024;
+}
+
+// Writes 1M records into a persistent log under `--data_dir`, and returns the growth of RSS, in kilobytes.
+inline double RSSGrowthWritingMillionRecords() {
+  const std::string directory = FLAGS_data_dir.empty() ? "." : FLAGS_data_dir;
+  const std::string name = "bench_segmented_log";
+  ::mkdir(directory.c_str(), 0755);
+  segmented_log::Log::RemoveFiles(directory, name);
+  size_t rss_growth;
+  {
+    segmented_log::Log log;
+    log.Open(directory, name);
+    const size_t rss_before = CurrentRSS();
+    for (size_t i = 0; i < 1000000; ++i) {
+      const std::string record =
+          fanout::Encoder<std::unique_ptr<schema::Base>>::Encode(MakeAnswer(i), "record");
+      log.Append(i, std::make_shared<const std::string>(record));
+    }
+    const size_t rss_after = CurrentRSS();
+    rss_growth = rss_after - std::min(rss_before, rss_after);
+  }
+  segmented_log::Log::RemoveFiles(directory, name);
+  return static_cast<double>(rss_growth) / 1024;
+}
+
+// The number of threads of the process, or zero if unknown.
+inline size_t CurrentThreads() {
+  FILE* f = fopen("/proc/self/status", "r");
+  size_t threads = 0;
+  if (f) {
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+      if (!strncmp(line, "Threads:", 8)) {
+        threads = static_cast<size_t>(atoi(line + 8));
+      }
+    }
+    fclose(f);
+  }
+  return threads;
+}
+
+// The server threads per viewer of `streams` streams, each viewer waiting for the next point on one connection
+// per stream or, with `feed`, on one connection to the `fanout::Feed` of all the streams.
+inline double ThreadsPerHTTPViewer(size_t viewers, size_t streams, bool feed) {
+  const std::string prefix = feed ? "/bench_viewer_threads_feed" : "/bench_viewer_threads";
+  std::vector<std::unique_ptr<fanout::Stream<VizPoint<int>>>> sources;
+  fanout::Feed all;
+  std::string since = "1";
+  for (size_t i = 0; i < streams; ++i) {
+    const std::string name = Printf("bench_viewer_threads_%d", static_cast<int>(i));
+    sources.emplace_back(new fanout::Stream<VizPoint<int>>(name, "point"));
+    sources.back()->Publish(VizPoint<int>{0, 0});
+    all.Add(Printf("/d/%d", static_cast<int>(i)), sources.back()->Source());
+    HTTP(FLAGS_bench_port).Register(Printf("%s/%d", prefix.c_str(), static_cast<int>(i)),
+                                    std::ref(*sources.back()));
+    if (i) {
+      since += ",1";
+    }
+  }
+  HTTP(FLAGS_bench_port).Register(prefix + "/feed", std::ref(all));
+  const size_t threads_before = CurrentThreads();
+  std::vector<int> fds;
+  for (size_t i = 0; i < viewers; ++i) {
+    if (feed) {
+      fds.push_back(OpenSubscriberConnection(prefix + "/feed?since=" + since));
+    } else {
+      for (size_t j = 0; j < streams; ++j) {
+        fds.push_back(OpenSubscriberConnection(Printf("%s/%d?since=1", prefix.c_str(), static_cast<int>(j))));
+      }
+    }
+  }
+  // Until each connection has its thread, or for at most a second, if the connections share them.
+  for (int i = 0; i < 1000 && CurrentThreads() < threads_before + fds.size(); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  const size_t threads_after = CurrentThreads();
+  for (const int fd : fds) {
+    ::close(fd);
+  }
+  HTTP(FLAGS_bench_port).UnRegister(prefix + "/feed");
+  for (size_t i = 0; i < streams; ++i) {
+    HTTP(FLAGS_bench_port).UnRegister(Printf("%s/%d", prefix.c_str(), static_cast<int>(i)));
+  }
+  return static_cast<double>(threads_after - std::min(threads_before, threads_after)) / viewers;
+}
+
+// The footprints are measured once each, after the benchmarks, in the order they are listed. They are printed,
+// and not compared to the baseline, as they depend on the allocator, the HTTP server, and what ran before them.
+struct Footprint {
+  std::string unit;
+  std::function<double()> measure;
+};
+
+inline std::vector<std::pair<std::string, Footprint>> Footprints() {
+  std::vector<std::pair<std::string, Footprint>> footprints;
+
+  // The arenas return the memory of the gone demos, while the heap keeps it between the long-lived allocations.
+  footprints.emplace_back("arena/rss_growth_after_10k_demos",
+                          Footprint{"kB", []() { return RSSGrowthAfterTenThousandDemos(true); }});
+  footprints.emplace_back("arena/heap_rss_growth_after_10k_demos",
+                          Footprint{"kB", []() { return RSSGrowthAfterTenThousandDemos(false); }});
+
+  // Only the unsealed segment of a persistent log stays in memory.
+  footprints.emplace_back("segmented_log/rss_growth_writing_1m_records",
+                          Footprint{"kB", []() { return RSSGrowthWritingMillionRecords(); }});
+
+  // One server thread per viewer with the feed, instead of one per stream.
+  footprints.emplace_back("fanout/threads_per_viewer_of_4_streams",
+                          Footprint{"threads", []() { return ThreadsPerHTTPViewer(50, 4, false); }});
+  footprints.emplace_back("fanout/threads_per_viewer_of_4_in_feed",
+                          Footprint{"threads", []() { return ThreadsPerHTTPViewer(50, 4, true); }});
+
+  return footprints;
+}
+
+// The CPU time of all the threads of the process.
+inline std::chrono::nanoseconds ProcessCPUTime() {
+  struct timespec ts;
+  ::clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+// Runs the benchmark with the number of operations doubled until a run is long enough.
+// The demo logs every record it gets to `std::cerr`, so it is silenced while the benchmark runs.
+inline bool RunBenchmark(const std::string& name, const benchmark_type& benchmark, BenchmarkResult& result) {
+  std::streambuf* const cerr = std::cerr.rdbuf(nullptr);
+  const auto min_duration = std::chrono::milliseconds(FLAGS_bench_min_ms);
+  bool ran = false;
+  try {
+    for (size_t n = 1;; n *= 2) {
+      const std::function<void(size_t)> run = benchmark();
+      if (!run) {
+        break;
+      }
+      const auto begin = std::chrono::steady_clock::now();
+      const auto cpu_begin = ProcessCPUTime();
+      run(n);
+      const auto cpu_duration = ProcessCPUTime() - cpu_begin;
+      const auto duration = std::chrono::steady_clock::now() - begin;
+      if (duration >= min_duration) {
+        result.name = name;
+        result.operations = n;
+        result.ns_per_operation =
+            static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count()) / n;
+        result.cpu_ns_per_operation = static_cast<double>(cpu_duration.count()) / n;
+        ran = true;
+        break;
+      }
+    }
+  } catch (...) {
+    std::cerr.rdbuf(cerr);
+    throw;
+  }
+  std::cerr.rdbuf(cerr);
+  return ran;
+}
+
+// Measures the footprint, with the demo silenced as in `RunBenchmark()`.
+inline double MeasureFootprint(const Footprint& footprint) {
+  std::streambuf* const cerr = std::cerr.rdbuf(nullptr);
+  double value = 0;
+  try {
+    value = footprint.measure();
+  } catch (...) {
+    std::cerr.rdbuf(cerr);
+    throw;
+  }
+  std::cerr.rdbuf(cerr);
+  return value;
+}
+
+// Prints the ratios of the `results` to the `baseline`. Returns false if any of them is over the allowed one.
+inline bool CompareToBaseline(const std::vector<BenchmarkResult>& results,
+                              const std::vector<BenchmarkResult>& baseline) {
+  std::map<std::string, double> baseline_ns;
+  for (const auto& b : baseline) {
+    baseline_ns[b.name] = b.ns_per_operation;
+  }
+  bool ok = true;
+  std::cout << Printf("\n%-36s %14s %14s %8s\n", "benchmark", "baseline, ns", "now, ns", "ratio");
+  for (const auto& r : results) {
+    const auto cit = baseline_ns.find(r.name);
+    if (cit == baseline_ns.end() || cit->second <= 0) {
+      std::cout << Printf("%-36s %14s %14.1lf %8s\n", r.name.c_str(), "-", r.ns_per_operation, "new");
+    } else {
+      const double ratio = r.ns_per_operation / cit->second;
+      const bool regressed = ratio > FLAGS_bench_max_regression;
+      std::cout << Printf("%-36s %14.1lf %14.1lf %7.2lfx%s\n",
+                          r.name.c_str(),
+                          cit->second,
+                          r.ns_per_operation,
+                          ratio,
+                          regressed ? "  REGRESSION" : "");
+      if (regressed) {
+        ok = false;
+      }
+    }
+  }
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  ParseDFlags(&argc, &argv);
+
+  // Each HTTP subscriber takes two descriptors, its end of the connection and the end of the server.
+  struct rlimit limit;
+  if (!::getrlimit(RLIMIT_NOFILE, &limit)) {
+    limit.rlim_cur = limit.rlim_max;
+    ::setrlimit(RLIMIT_NOFILE, &limit);
+  }
+
+  std::vector<BenchmarkResult> results;
+  std::cout << Printf("%-36s %12s %14s %14s\n", "benchmark", "operations", "ns/operation", "CPU ns/op");
+  for (const auto& benchmark : Benchmarks()) {
+    if (benchmark.first.find(FLAGS_bench_filter) == std::string::npos) {
+      continue;
+    }
+    BenchmarkResult result;
+    if (RunBenchmark(benchmark.first, benchmark.second, result)) {
+      std::cout << Printf("%-36s %12d %14.1lf %14.1lf\n",
+                          result.name.c_str(),
+                          static_cast<int>(result.operations),
+                          result.ns_per_operation,
+                          result.cpu_ns_per_operation);
+      results.push_back(result);
+    } else {
+      std::cout << Printf("%-36s %12s %14s %14s\n", benchmark.first.c_str(), "skipped", "-", "-");
+    }
+  }
+
+  bool footprints_header = false;
+  for (const auto& footprint : Footprints()) {
+    if (footprint.first.find(FLAGS_bench_filter) == std::string::npos) {
+      continue;
+    }
+    if (!footprints_header) {
+      std::cout << Printf("\n%-36s %14s\n", "footprint", "value");
+      footprints_header = true;
+    }
+    const double value = MeasureFootprint(footprint.second);
+    std::cout << Printf("%-36s %14.1lf %s\n", footprint.first.c_str(), value, footprint.second.unit.c_str());
+  }
+
+  if (!FLAGS_bench_output.empty()) {
+    FileSystem::WriteStringToFile(JSON(results, "results") + '\n', FLAGS_bench_output.c_str());
+  }
+
+  if (!FLAGS_bench_baseline.empty()) {
+    std::vector<BenchmarkResult> baseline;
+    ParseJSON(FileSystem::ReadFileAsString(FLAGS_bench_baseline), baseline);
+    if (!CompareToBaseline(results, baseline)) {
+      std::cout << Printf("\nSlower than %.2lfx the baseline.\n", FLAGS_bench_max_regression);
+      return 1;
+    }
+  }
+}
@@ -0,0 +1,186 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+#include <zlib.h>
+#include <brotli/encode.h>
+
+// Streaming `gzip` and `deflate` content encodings for long-lived chunked HTTP responses,
+// and one-shot `gzip` and `br` compression of the static assets.
+namespace compression {
+
+enum class Encoding : int { IDENTITY = 0, GZIP = 1, DEFLATE = 2, BROTLI = 3 };
+
+inline const char* EncodingName(Encoding encoding) {
+  switch (encoding) {
+    case Encoding::GZIP:
+      return "gzip";
+    case Encoding::DEFLATE:
+      return "deflate";
+    case Encoding::BROTLI:
+      return "br";
+    default:
+      return "identity";
+  }
+}
+
+// Picks the encoding from the value of the `Accept-Encoding` header. Prefers `gzip` over `deflate`,
+// and respects `;q=0` for either of them. With `brotli`, prefers `br` over both, for the content
+// that is compressed once upfront.
+inline Encoding NegotiateEncoding(const std::string& accept_encoding, bool brotli = false) {
+  bool br = false;
+  bool gzip = false;
+  bool deflate = false;
+  size_t begin = 0;
+  while (begin < accept_encoding.length()) {
+    size_t end = accept_encoding.find(',', begin);
+    if (end == std::string::npos) {
+      end = accept_encoding.length();
+    }
+    std::string token;
+    double q = 1.0;
+    for (size_t i = begin; i < end; ++i) {
+      const char c = accept_encoding[i];
+      if (c == ';') {
+        const size_t q_pos = accept_encoding.find("q=", i);
+        if (q_pos != std::string::npos && q_pos < end) {
+          q = std::atof(accept_encoding.c_str() + q_pos + 2);
+        }
+        break;
+      } else if (!std::isspace(c)) {
+        token += static_cast<char>(std::tolower(c));
+      }
+    }
+    if (q > 0) {
+      if (token == "gzip" || token == "x-gzip") {
+        gzip = true;
+      } else if (token == "deflate") {
+        deflate = true;
+      } else if (token == "br") {
+        br = true;
+      }
+    }
+    begin = end + 1;
+  }
+  if (brotli && br) {
+    return Encoding::BROTLI;
+  }
+  return gzip ? Encoding::GZIP : (deflate ? Encoding::DEFLATE : Encoding::IDENTITY);
+}
+
+// Keeps one compression context for the lifetime of the response, so that the dictionary built
+// from the previous chunks compresses the next ones. Each `Compress()` ends with `Z_SYNC_FLUSH`,
+// so that the client can decode every chunk as soon as it arrives.
+class StreamingDeflater final {
+ public:
+  explicit StreamingDeflater(Encoding encoding, int level = Z_DEFAULT_COMPRESSION) : encoding_(encoding) {
+    if (encoding_ != Encoding::GZIP && encoding_ != Encoding::DEFLATE) {
+      throw std::logic_error("StreamingDeflater requires `gzip` or `deflate`.");
+    }
+    stream_.zalloc = Z_NULL;
+    stream_.zfree = Z_NULL;
+    stream_.opaque = Z_NULL;
+    // Window bits of `15 + 16` produce the `gzip` wrapper, plain `15` produce the `zlib` one,
+    // which is what HTTP calls `deflate`.
+    const int window_bits = (encoding_ == Encoding::GZIP) ? (15 + 16) : 15;
+    if (deflateInit2(&stream_, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+      throw std::runtime_error("deflateInit2() failed.");
+    }
+  }
+
+  ~StreamingDeflater() { deflateEnd(&stream_); }
+
+  Encoding GetEncoding() const { return encoding_; }
+
+  std::string Compress(const std::string& chunk) { return Run(chunk, Z_SYNC_FLUSH); }
+
+  // The trailer of the stream. Only needed when the response ends gracefully.
+  std::string Finish() { return Run("", Z_FINISH); }
+
+  uint64_t BytesIn() const { return static_cast<uint64_t>(stream_.total_in); }
+  uint64_t BytesOut() const { return static_cast<uint64_t>(stream_.total_out); }
+
+ private:
+  std::string Run(const std::string& input, int flush) {
+    std::string output;
+    char buffer[16384];
+    stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+    stream_.avail_in = static_cast<uInt>(input.length());
+    do {
+      stream_.next_out = reinterpret_cast<Bytef*>(buffer);
+      stream_.avail_out = sizeof(buffer);
+      const int result = deflate(&stream_, flush);
+      if (result == Z_STREAM_ERROR) {
+        throw std::runtime_error("deflate() failed.");
+      }
+      output.append(buffer, sizeof(buffer) - stream_.avail_out);
+    } while (stream_.avail_out == 0);
+    return output;
+  }
+
+  const Encoding encoding_;
+  z_stream stream_;
+
+  StreamingDeflater() = delete;
+  StreamingDeflater(const StreamingDeflater&) = delete;
+  StreamingDeflater(StreamingDeflater&&) = delete;
+  void operator=(const StreamingDeflater&) = delete;
+  void operator=(StreamingDeflater&&) = delete;
+};
+
+// Compresses the whole content at once, with the best compression ratio: for the content served many times.
+inline std::string Compress(Encoding encoding, const std::string& content) {
+  if (encoding == Encoding::BROTLI) {
+    size_t size = BrotliEncoderMaxCompressedSize(content.length());
+    std::string output(size ? size : 1024, '\0');
+    size = output.length();
+    if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY,
+                               BROTLI_DEFAULT_WINDOW,
+                               BROTLI_MODE_TEXT,
+                               content.length(),
+                               reinterpret_cast<const uint8_t*>(content.data()),
+                               &size,
+                               reinterpret_cast<uint8_t*>(&output[0]))) {
+      throw std::runtime_error("BrotliEncoderCompress() failed.");
+    }
+    output.resize(size);
+    return output;
+  } else {
+    StreamingDeflater deflater(encoding, Z_BEST_COMPRESSION);
+    std::string output = deflater.Compress(content);
+    return output + deflater.Finish();
+  }
+}
+
+}  // namespace compression
+
+#endif  // COMPRESSION_H
@@ -27,7 +27,12 @@ SOFTWARE.
 
 #include "../Bricks/port.h"
 
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "../Bricks/cerealize/cerealize.h"
@@ -42,24 +47,155 @@ struct Config {
   // The list of domains that resolve to the backend which serves the layout and streams.
   std::vector<std::string> data_hostnames;
 
+  // The single connection with all the streams of the layout, tagged with their `data_url`-s.
+  // Relative to the `layout_url`, empty if not served.
+  std::string feed_url;
+
   // The static template.
   std::string dashboard_template;
 
   explicit Config(const std::string& layout_url, const std::string& dashboard_template)
-      : layout_url(layout_url), dashboard_template(dashboard_template) {
-    // Assume 'TLD=tailproduce.io' of some sort ...
-    const char* tld_env = std::getenv("TLD");
-    // ... or require a local '/etc/hosts' tweak.
-    const std::string tld = tld_env ? tld_env : "knowsheet.local";
-    for (int i = 0; i < 10; ++i) {
-      data_hostnames.push_back(bricks::strings::Printf("d%d.%s", i, tld.c_str()));
-    }
+      : layout_url(layout_url),
+        data_hostnames(DefaultDataHostnames()),
+        dashboard_template(dashboard_template) {}
+
+  // The environment is only looked at once per process.
+  static const std::vector<std::string>& DefaultDataHostnames() {
+    static const std::vector<std::string> data_hostnames = []() {
+      // Assume 'TLD=tailproduce.io' of some sort ...
+      const char* tld_env = std::getenv("TLD");
+      // ... or require a local '/etc/hosts' tweak.
+      const std::string tld = tld_env ? tld_env : "knowsheet.local";
+      std::vector<std::string> result;
+      for (int i = 0; i < 10; ++i) {
+        result.push_back(bricks::strings::Printf("d%d.%s", i, tld.c_str()));
+      }
+      return result;
+    }();
+    return data_hostnames;
   }
 
   template <typename A>
   void save(A& ar) const {
-    ar(CEREAL_NVP(layout_url), CEREAL_NVP(data_hostnames), CEREAL_NVP(dashboard_template));
+    ar(CEREAL_NVP(layout_url),
+       CEREAL_NVP(data_hostnames),
+       CEREAL_NVP(feed_url),
+       CEREAL_NVP(dashboard_template));
+  }
+};
+
+// The dashboard template, parsed once into the literal segments and the placeholders between them.
+// Rendering only concatenates the segments, instead of searching the whole template for each placeholder.
+class Template final {
+ public:
+  Template(const std::string& text, const std::vector<std::string>& placeholders) {
+    size_t begin = 0;
+    while (true) {
+      // The earliest of the placeholders from `begin` on.
+      size_t pos = std::string::npos;
+      size_t placeholder = 0;
+      for (size_t i = 0; i < placeholders.size(); ++i) {
+        const size_t p = text.find(placeholders[i], begin);
+        if (p < pos) {
+          pos = p;
+          placeholder = i;
+        }
+      }
+      if (pos == std::string::npos) {
+        literals_.push_back(text.substr(begin));
+        break;
+      }
+      literals_.push_back(text.substr(begin, pos - begin));
+      placeholders_.push_back(placeholders[placeholder]);
+      begin = pos + placeholders[placeholder].length();
+    }
+  }
+
+  // The placeholders which are not in `replacements` are kept as they are.
+  std::string Render(const std::map<std::string, std::string>& replacements) const {
+    std::string result = literals_[0];
+    for (size_t i = 0; i < placeholders_.size(); ++i) {
+      const auto cit = replacements.find(placeholders_[i]);
+      result += (cit != replacements.end()) ? cit->second : placeholders_[i];
+      result += literals_[i + 1];
+    }
+    return result;
+  }
+
+ private:
+  std::vector<std::string> literals_;      // One more than the placeholders.
+  std::vector<std::string> placeholders_;  // The placeholder between `literals_[i]` and `literals_[i + 1]`.
+};
+
+// The first paint of a dashboard in one response, instead of the waterfall of `/config`, `/layout`, the metas
+// and the streams: `{"config":...,"layout":...,"meta":{"<meta_url>":...},"latest":{"<data_url>":...}}`.
+// The values are the very same documents as the responses of those URLs, and the latest entry of each stream,
+// `null` if there is none yet. Everything but the latest entries only changes with the layout, so the rest
+// of the bundle is rendered once, and the whole of it is rendered again only once any of the streams moves on.
+class Bootstrap final {
+ public:
+  // Returns the number of entries in a stream, which identifies its latest entry.
+  typedef std::function<size_t()> size_type;
+  // Returns the latest entry of a stream, encoded, or `nullptr`.
+  typedef std::function<std::shared_ptr<const std::string>()> latest_type;
+
+  Bootstrap(const std::string& config,
+            const std::string& layout,
+            const std::vector<std::pair<std::string, std::string>>& metas)
+      : prefix_("{\"config\":" + WithoutNewline(config) + ",\"layout\":" + WithoutNewline(layout) +
+                ",\"meta\":{") {
+    for (size_t i = 0; i < metas.size(); ++i) {
+      prefix_ += (i ? ",\"" : "\"") + metas[i].first + "\":" + WithoutNewline(metas[i].second);
+    }
+    prefix_ += "},\"latest\":{";
   }
+
+  void AddStream(const std::string& data_url, size_type size, latest_type latest) {
+    streams_.push_back(Stream{(streams_.empty() ? "\"" : ",\"") + data_url + "\":", size, latest});
+  }
+
+  // Re-rendered only once some stream has grown. The sizes are the cache key: the entries read back
+  // from the sealed segments of a log are fresh copies each time, so their addresses do not identify them.
+  std::string Render() const {
+    std::vector<size_t> sizes;
+    for (const auto& stream : streams_) {
+      sizes.push_back(stream.size());
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (sizes != rendered_sizes_ || rendered_.empty()) {
+      rendered_ = prefix_;
+      for (const auto& stream : streams_) {
+        const std::shared_ptr<const std::string> latest = stream.latest();
+        rendered_ += stream.key;
+        rendered_ += latest ? WithoutNewline(*latest) : "null";
+      }
+      rendered_ += "}}\n";
+      rendered_sizes_.swap(sizes);
+    }
+    return rendered_;
+  }
+
+ private:
+  struct Stream {
+    std::string key;  // The rendered key.
+    size_type size;
+    latest_type latest;
+  };
+
+  static std::string WithoutNewline(const std::string& document) {
+    const bool newline = !document.empty() && document.back() == '\n';
+    return newline ? document.substr(0, document.length() - 1) : document;
+  }
+
+  std::string prefix_;
+  std::vector<Stream> streams_;
+
+  mutable std::mutex mutex_;
+  mutable std::vector<size_t> rendered_sizes_;
+  mutable std::string rendered_;
+
+  Bootstrap(const Bootstrap&) = delete;
+  void operator=(const Bootstrap&) = delete;
 };
 
 struct PlotMeta {
@@ -27,92 +27,98 @@ SOFTWARE.
 
 #include "../Bricks/port.h"
 
+#include <functional>
+#include <map>
+#include <mutex>
 #include <vector>
 #include <set>
 #include <string>
 
+#include "arena.h"
 #include "schema.h"
+#include "fanout.h"
+#include "routes.h"
 
 #include "../Bricks/cerealize/cerealize.h"
 #include "../Bricks/time/chrono.h"
 #include "../Bricks/net/api/api.h"
 #include "../Bricks/dflags/dflags.h"
 
-#include "../Sherlock/sherlock.h"
-
 namespace db {
 
 // The instance of the `Storage` class governs low-level API HTTP endpoints
-// and the Sherlock stream for the instance of the user-facing demo.
+// and the stream of records for the instance of the user-facing demo.
 //
 // One instance of `Storage` exists per one instance of the user-facing demo endpoint.
+//
+// With a non-empty `data_dir`, the stream of records keeps only its hot tail in memory,
+// and spills the rest into the segment files in that directory. A `Storage` created over the files
+// written earlier continues from the recovered records. With an empty `data_dir`, the default here and
+// the value of `--data_dir=` that turns the spilling off in the demo, where it is on by default, all
+// the records stay in memory for the lifetime of the `Storage`.
+//
+// A `Storage` forked from another one starts with the `SharedPrefix()` of its records as the `base`, shared and
+// not stored again, and only stores the records added to it after the fork.
+//
+// The indexes of users and questions allocate their nodes from the arena of the `Storage`.
 
 class Storage final {
  public:
   // Registers HTTP endpoints for the provided client name.
   // Ensures that questions indexing will start from 1 by adding a dummy question with index 0.
-  Storage(int port, const std::string& client_name)
-      : port_(port),
-        client_name_(client_name),
-        sherlock_stream_(sherlock::Stream<std::unique_ptr<schema::Base>>(client_name + "_db", "record")),
+  Storage(int port,
+          const std::string& client_name,
+          const std::string& data_dir = "",
+          segmented_log::SharedEntries base = nullptr)
+      : client_name_(client_name),
+        stream_(client_name + "_db", "record", data_dir, base),
         questions_({schema::QuestionRecord()}),
-        questions_reverse_index_({""}) {
-    HTTP(port_).Register("/" + client_name_, [](Request r) { r("OK\n"); });
-    HTTP(port_).Register("/" + client_name_ + "/q", std::bind(&Storage::HandleQ, this, std::placeholders::_1));
-    HTTP(port_).Register("/" + client_name_ + "/u", std::bind(&Storage::HandleU, this, std::placeholders::_1));
+        questions_reverse_index_({""}, std::less<std::string>(), arena::Allocator<std::string>(&arena_)),
+        users_(arena::Allocator<char>(&arena_)),
+        routes_(port) {
+    RecoverIndexes();
+    routes_.Register("/" + client_name_, [](Request r) { r("OK\n"); });
+    routes_.Register("/" + client_name_ + "/q", std::bind(&Storage::HandleQ, this, std::placeholders::_1));
+    routes_.Register("/" + client_name_ + "/u", std::bind(&Storage::HandleU, this, std::placeholders::_1));
     // TODO(dkorolev): POST "/a"?
-    HTTP(port_).Register("/" + client_name_ + "/a/add_question",
-                         std::bind(&Storage::HandleAddQ, this, std::placeholders::_1));
-    HTTP(port_).Register("/" + client_name_ + "/a/add_user",
-                         std::bind(&Storage::HandleAddU, this, std::placeholders::_1));
-    HTTP(port_).Register("/" + client_name_ + "/a/add_answer",
-                         std::bind(&Storage::HandleAddA, this, std::placeholders::_1));
+    routes_.Register("/" + client_name_ + "/a/add_question",
+                     std::bind(&Storage::HandleAddQ, this, std::placeholders::_1));
+    routes_.Register("/" + client_name_ + "/a/add_user",
+                     std::bind(&Storage::HandleAddU, this, std::placeholders::_1));
+    routes_.Register("/" + client_name_ + "/a/add_answer",
+                     std::bind(&Storage::HandleAddA, this, std::placeholders::_1));
+    routes_.Register("/" + client_name_ + "/a/answer",
+                     std::bind(&Storage::HandleA, this, std::placeholders::_1));
   }
 
   // Unregisters HTTP endpoints.
-  ~Storage() {
-    HTTP(port_).UnRegister("/" + client_name_);
-    HTTP(port_).UnRegister("/" + client_name_ + "/q");
-    HTTP(port_).UnRegister("/" + client_name_ + "/u");
-    HTTP(port_).UnRegister("/" + client_name_ + "/a/add_question");
-    HTTP(port_).UnRegister("/" + client_name_ + "/a/add_user");
-    HTTP(port_).UnRegister("/" + client_name_ + "/a/add_answer");
-  }
+  ~Storage() { routes_.UnRegisterAll(); }
 
-  // Sherlock stream access.
-  template <typename F>
-  typename sherlock::StreamInstanceImpl<std::unique_ptr<schema::Base>>::template ListenerScope<F> Subscribe(
-      F& listener) {
-    return sherlock_stream_.Subscribe(listener);
-  }
+  routes::DemoRoutes& Routes() { return routes_; }
+  const routes::DemoRoutes& Routes() const { return routes_; }
+
+  // The number of records, including the recovered ones.
+  size_t Size() const { return stream_.Size(); }
 
+  // The first `records` records, for a fork of this `Storage` to start from.
+  segmented_log::SharedEntries SharedPrefix(size_t records) { return stream_.SharedPrefix(records); }
+
+  // Stream access. Each listener gets its own copy of each record.
   template <typename F>
-  typename sherlock::StreamInstanceImpl<std::unique_ptr<schema::Base>>::template ListenerScope<F> Subscribe(
-      std::unique_ptr<F> listener) {
-    return sherlock_stream_.Subscribe(std::move(listener));
+  fanout::ListenerScope Subscribe(F& listener, size_t begin = 0) {
+    return stream_.Subscribe(listener, begin);
   }
 
   // API implementation.
   // Bloated a bit for easier demonstration. -- D.K.
-  const schema::QuestionRecord& DoAddQuestion(const std::string& text,
-                                              bricks::time::EPOCH_MILLISECONDS timestamp) {
-    const schema::QID qid = static_cast<schema::QID>(questions_.size());
-    questions_.push_back(schema::QuestionRecord());
-    schema::QuestionRecord& record = questions_.back();
-    record.ms = timestamp;
-    record.qid = qid;
-    record.text = text;
-    questions_reverse_index_.insert(text);
-    sherlock_stream_.Publish(record);
-    return record;
+  schema::QuestionRecord DoAddQuestion(const std::string& text, bricks::time::EPOCH_MILLISECONDS timestamp) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return AddQuestion(text, timestamp);
   }
 
-  const schema::UserRecord& DoAddUser(const schema::UID& uid, bricks::time::EPOCH_MILLISECONDS timestamp) {
-    schema::UserRecord& record = users_[uid];
-    record.ms = timestamp;
-    record.uid = uid;
-    sherlock_stream_.Publish(record);
-    return record;
+  schema::UserRecord DoAddUser(const schema::UID& uid, bricks::time::EPOCH_MILLISECONDS timestamp) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return AddUser(uid, timestamp);
   }
 
   schema::AnswerRecord DoAddAnswer(const schema::UID& uid,
@@ -124,11 +130,12 @@ class Storage final {
     record.uid = uid;
     record.qid = qid;
     record.answer = answer;
-    sherlock_stream_.Publish(record);
+    stream_.Publish(record);
     return record;
   }
 
-  void operator()(Request r) { sherlock_stream_(std::move(r)); }
+  // The `scope`, if any, is held until the response ends, see `fanout::Stream::operator()`.
+  void operator()(Request r, std::shared_ptr<void> scope = nullptr) { stream_(std::move(r), std::move(scope)); }
 
  private:
   // Retrieves or creates questions.
@@ -137,10 +144,16 @@ class Storage final {
       const schema::QID qid = static_cast<schema::QID>(atoi(r.url.query["qid"].c_str()));
       if (qid == schema::QID::NONE) {
         r("NEED QID\n", HTTPResponseCode.BadRequest);
-      } else if (static_cast<size_t>(qid) >= questions_.size()) {
-        r("QUESTION NOT FOUND\n", HTTPResponseCode.NotFound);
       } else {
-        r(questions_[static_cast<size_t>(qid)]);
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (static_cast<size_t>(qid) >= questions_.size()) {
+          lock.unlock();
+          r("QUESTION NOT FOUND\n", HTTPResponseCode.NotFound);
+        } else {
+          const schema::QuestionRecord record = questions_[static_cast<size_t>(qid)];
+          lock.unlock();
+          r(record);
+        }
       }
     } else if (r.method == "POST") {
       HandleAddQ(std::move(r));
@@ -153,10 +166,16 @@ class Storage final {
     const std::string text = r.url.query["text"];
     if (text.empty()) {
       r("NEED TEXT\n", HTTPResponseCode.BadRequest);
-    } else if (questions_reverse_index_.count(text)) {
-      r("DUPLICATE QUESTION\n", HTTPResponseCode.BadRequest);
     } else {
-      RespondWith(std::move(r), DoAddQuestion(text, r.timestamp), "question");
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (questions_reverse_index_.count(text)) {
+        lock.unlock();
+        r("DUPLICATE QUESTION\n", HTTPResponseCode.BadRequest);
+      } else {
+        const schema::QuestionRecord record = AddQuestion(text, r.timestamp);
+        lock.unlock();
+        RespondWith(std::move(r), record, "question");
+      }
     }
   }
 
@@ -167,10 +186,14 @@ class Storage final {
       r("NEED UID\n", HTTPResponseCode.BadRequest);
     } else {
       if (r.method == "GET") {
+        std::unique_lock<std::mutex> lock(mutex_);
         const auto cit = users_.find(uid);
         if (cit != users_.end()) {
-          r(cit->second, "user");
+          const schema::UserRecord record = cit->second;
+          lock.unlock();
+          r(record, "user");
         } else {
+          lock.unlock();
           r("USER NOT FOUND\n", HTTPResponseCode.NotFound);
         }
       } else if (r.method == "POST") {
@@ -186,34 +209,96 @@ class Storage final {
     if (uid.empty()) {
       r("NEED UID\n", HTTPResponseCode.BadRequest);
     } else {
+      std::unique_lock<std::mutex> lock(mutex_);
       if (users_.count(uid)) {
+        lock.unlock();
         r("USER ALREADY EXISTS\n", HTTPResponseCode.BadRequest);
       } else {
-        RespondWith(std::move(r), DoAddUser(uid, r.timestamp), "user");
+        const schema::UserRecord record = AddUser(uid, r.timestamp);
+        lock.unlock();
+        RespondWith(std::move(r), record, "user");
       }
     }
   }
 
-  // TODO(dkorolev): HandleA()?
-  void HandleAddA(Request r) {
+  // Adds answers via POST-s from the client-side Actions page, which needs no response body.
+  void HandleA(Request r) {
+    if (r.method == "POST") {
+      AddA(std::move(r), true);
+    } else {
+      r("METHOD NOT ALLOWED\n", HTTPResponseCode.MethodNotAllowed);
+    }
+  }
+
+  void HandleAddA(Request r) { AddA(std::move(r), false); }
+
+  void AddA(Request r, bool no_content) {
     const schema::UID uid = r.url.query["uid"];
     const schema::QID qid = static_cast<schema::QID>(atoi(r.url.query["qid"].c_str()));
     const int answer_as_int = static_cast<int>(atoi(r.url.query["answer"].c_str()));
     const schema::ANSWER answer =
         static_cast<schema::ANSWER>([](int x) { return x ? (x > 0 ? +1 : -1) : 0; }(answer_as_int));
+    bool user_exists;
+    size_t questions;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      user_exists = users_.count(uid) != 0;
+      questions = questions_.size();
+    }
     if (uid.empty()) {
       r("NEED UID\n", HTTPResponseCode.BadRequest);
-    } else if (!users_.count(uid)) {
+    } else if (!user_exists) {
       r("USER DOES NOT EXISTS\n", HTTPResponseCode.BadRequest);
     } else if (qid == schema::QID::NONE) {
       r("NEED QID\n", HTTPResponseCode.BadRequest);
-    } else if (static_cast<size_t>(qid) >= questions_.size()) {
+    } else if (static_cast<size_t>(qid) >= questions) {
       r("QUESTION DOES NOT EXISTS\n", HTTPResponseCode.BadRequest);
+    } else if (no_content) {
+      DoAddAnswer(uid, qid, answer, r.timestamp);
+      r("", HTTPResponseCode.NoContent);
     } else {
       RespondWith(std::move(r), DoAddAnswer(uid, qid, answer, r.timestamp), "answer");
     }
   }
 
+  // Adds the question to the indexes and publishes it. Requires `mutex_` to be held, for the question IDs
+  // to be published in order.
+  schema::QuestionRecord AddQuestion(const std::string& text, bricks::time::EPOCH_MILLISECONDS timestamp) {
+    schema::QuestionRecord record;
+    record.ms = timestamp;
+    record.qid = static_cast<schema::QID>(questions_.size());
+    record.text = text;
+    questions_.push_back(record);
+    questions_reverse_index_.insert(text);
+    stream_.Publish(record);
+    return record;
+  }
+
+  // Adds or updates the user and publishes it. Requires `mutex_` to be held.
+  schema::UserRecord AddUser(const schema::UID& uid, bricks::time::EPOCH_MILLISECONDS timestamp) {
+    schema::UserRecord& record = users_[uid];
+    record.ms = timestamp;
+    record.uid = uid;
+    stream_.Publish(record);
+    return record;
+  }
+
+  // Rebuilds the indexes of users and questions from the records of the `base` and those recovered from
+  // `data_dir`, if any. Parses every record, and the indexes are not persisted: waking a demo up reads its
+  // whole history once, and the indexes, like the `Snapshot::Box` of the demo, keep every user and question.
+  void RecoverIndexes() {
+    for (size_t i = 0; i < stream_.Size(); ++i) {
+      std::unique_ptr<schema::Base> record;
+      ParseJSON(*stream_.EncodedEntryAt(i), record);
+      if (const schema::QuestionRecord* q = dynamic_cast<const schema::QuestionRecord*>(record.get())) {
+        questions_.push_back(*q);
+        questions_reverse_index_.insert(q->text);
+      } else if (const schema::UserRecord* u = dynamic_cast<const schema::UserRecord*>(record.get())) {
+        users_[u->uid] = *u;
+      }
+    }
+  }
+
   template <typename T>
   static void RespondWith(Request r, T&& json, const char* json_title) {
     if (r.method == "POST") {
@@ -230,15 +315,20 @@ class Storage final {
     }
   }
 
-  const int port_;
   const std::string client_name_;
+  arena::Arena arena_;
 
-  sherlock::StreamInstance<std::unique_ptr<schema::Base>> sherlock_stream_;
+  fanout::Stream<std::unique_ptr<schema::Base>> stream_;
 
+  // Guards the indexes below, as the handlers of the routes run concurrently, with each other and with
+  // the seeding of a new demo.
+  std::mutex mutex_;
   std::vector<schema::QuestionRecord> questions_;
-  std::set<std::string> questions_reverse_index_;  // To disallow duplicate questions.
+  arena::Set<std::string> questions_reverse_index_;  // To disallow duplicate questions.
 
-  std::map<schema::UID, schema::UserRecord> users_;
+  arena::Map<schema::UID, schema::UserRecord> users_;
+
+  routes::DemoRoutes routes_;
 
   Storage() = delete;
   Storage(const Storage&) = delete;
@@ -247,6 +337,41 @@ class Storage final {
   void operator=(Storage&&) = delete;
 };
 
+// The functions to call once the consumer of the stream of records of a `Storage` has got to a given number
+// of them, such as to read the state that reflects all the records stored so far, replayed ones included.
+// Only used from the thread that consumes the records.
+template <typename T>
+class AtRecords final {
+ public:
+  AtRecords() = default;
+
+  // Calls `f` right away if `consumed` records have been consumed already.
+  void Add(size_t records, size_t consumed, T& t, std::function<void(T&)> f) {
+    if (consumed >= records) {
+      f(t);
+    } else {
+      pending_.emplace(records, f);
+    }
+  }
+
+  // Calls the functions waiting for `consumed` records or fewer, the ones waiting for fewer first.
+  void Consumed(size_t consumed, T& t) {
+    while (!pending_.empty() && pending_.begin()->first <= consumed) {
+      const std::function<void(T&)> f = pending_.begin()->second;
+      pending_.erase(pending_.begin());
+      f(t);
+    }
+  }
+
+  size_t PendingCount() const { return pending_.size(); }
+
+ private:
+  std::multimap<size_t, std::function<void(T&)>> pending_;
+
+  AtRecords(const AtRecords&) = delete;
+  void operator=(const AtRecords&) = delete;
+};
+
 }  // namespace db
 
 #endif  // DB_H
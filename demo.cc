@@ -24,11 +24,34 @@ SOFTWARE.
 
 #include "../Bricks/port.h"
 
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <mutex>
 #include <queue>
+#include <sstream>
 
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "arena.h"
 #include "schema.h"
 #include "db.h"
 #include "dashboard.h"
+#include "actions.h"
+#include "analytics.h"
+#include "assets.h"
+#include "fanout.h"
+#include "hosts.h"
+#include "http_client.h"
+#include "mixpanel.h"
+#include "router.h"
+#include "stats.h"
 
 CEREAL_REGISTER_TYPE_WITH_NAME(schema::Record, "0");
 CEREAL_REGISTER_TYPE_WITH_NAME(schema::UserRecord, "U");
@@ -51,6 +74,31 @@ CEREAL_REGISTER_TYPE_WITH_NAME(schema::AnswerRecord, "A");
 #include "bricks-cerealize-multikeyjson.h"
 
 DEFINE_int32(port, 3000, "Local port to use.");
+DEFINE_string(mixpanel_endpoint,
+              MixpanelUploader::kDefaultEndpoint,
+              "The URL to POST the batches of Mixpanel events to.");
+DEFINE_string(data_dir,
+              "data",
+              "The directory for the history of the streams and for the outboxes, empty to keep them in RAM.");
+DEFINE_string(analytics_sinks,
+              "mixpanel",
+              "The comma-separated analytics sinks for the demos which do not specify their own: "
+              "`mixpanel`, `ndjson`, `udp`.");
+DEFINE_string(ndjson_dir, ".", "The directory for the `ndjson` analytics sink to write `<demo_id>.ndjson`.");
+DEFINE_string(udp_collector, "127.0.0.1:8125", "The `host:port` for the `udp` analytics sink to send to.");
+DEFINE_int32(hibernate_after_seconds,
+             600,
+             "Tear down the demos not accessed for this long, to wake them up on the next request. "
+             "Zero to keep them all running. Needs `--data_dir`.");
+DEFINE_int32(workers,
+             0,
+             "Run as the router in front of this many worker processes, which listen on the ports following "
+             "`--port`. Zero to serve the demos in this process.");
+DEFINE_int32(demo_pool_size, 2, "Keep this many seeded demos ready for `/new` to hand out right away.");
+DEFINE_string(worker_of,
+              "",
+              "Set by the router for its workers, `i/N`: only make up the IDs of the demos that hash to the "
+              "worker `i` of `N`.");
 
 using bricks::FileSystem;
 using bricks::strings::Printf;
@@ -74,10 +122,13 @@ struct VizPoint {
 struct Snapshot {
   // The `Box` structure encapsulates the state of the demo.
   // All calls to it, updates and reads, go through the message queue, and thus are sequential.
+  // The answers are allocated from the `arena`, if one is given, and stay in it when assigned to.
+  // Every answer ever given stays here, rebuilt by replaying the whole history when the demo wakes up.
   struct Box {
     std::vector<std::string> users;
     std::vector<std::string> questions;
-    std::map<schema::QID, std::map<schema::UID, schema::ANSWER>> answers;
+    arena::Map<schema::QID, arena::Map<schema::UID, schema::ANSWER>> answers;
+    explicit Box(arena::Arena* arena = nullptr) : answers(arena::Allocator<char>(arena)) {}
   };
   // The `SlidingWindowTracker` structure keeps track of engagement-related events at real time.
   struct SlidingWindowTracker {
@@ -102,8 +153,19 @@ struct Snapshot {
   // Data fields.
   Box box;
   SlidingWindowTracker engagement;
+  // The rendered table of the Actions page, updated along with the `box`.
+  actions::TableCache actions_table;
+  // The agree, disagree and N/A counts of each question, updated along with the `box`.
+  stats::Tallies tallies;
+  // The number of records applied to the `box`, which is the index of the next record in the stream.
+  size_t records = 0;
+
+  explicit Snapshot(arena::Arena* arena = nullptr) : box(arena) {}
 };
 
+// How often the `Cruncher` publishes the points of the tick streams: the total users, questions and engagement.
+const std::chrono::milliseconds kTickPeriod(500);
+
 // The `Cruncher` defines a real (no shit!) TailProduce worker.
 // It maintains the consistency of the `Snapshot` and allows access to it.
 //
@@ -115,116 +177,250 @@ struct Snapshot {
 // Thus, they are processed sequentially, and no multithreading collisions can occur in the meantime.
 class Cruncher final {
  public:
-  Cruncher(int port, const std::string& demo_id)
+  struct State;
+
+  // With `fork_from`, starts from the state of another demo instead of from scratch.
+  Cruncher(int port, const std::string& demo_id, const State* fork_from = nullptr)
       : demo_id_(demo_id),
-        u_total_(sherlock::Stream<VizPoint<int>>(demo_id_ + "_u_total", "point")),
-        q_total_(sherlock::Stream<VizPoint<int>>(demo_id_ + "_q_total", "point")),
-        e_15sec_(sherlock::Stream<VizPoint<int>>(demo_id_ + "_e_15sec", "point")),
-        image_(sherlock::Stream<VizPoint<std::string>>(demo_id_ + "_image", "point")),
-        consumer_(demo_id_, image_),
+        config_response_(RenderConfig(demo_id_)),
+        u_total_(demo_id_ + "_u_total", "point"),
+        q_total_(demo_id_ + "_q_total", "point"),
+        e_15sec_(demo_id_ + "_e_15sec", "point"),
+        image_(demo_id_ + "_image", "point", FLAGS_data_dir),
+        bootstrap_(config_response_, LayoutDocuments().Get("layout.json").identity, LayoutMetas()),
+        consumer_(demo_id_, image_, subscriptions_, fork_from),
         mq_(consumer_),
+        routes_(port),
         metronome_thread_(&Cruncher::MetronomeThread, this) {
     try {
-      // Data streams.
-      HTTP(port).Register("/" + demo_id_ + "/layout/d/u", u_total_);
-      HTTP(port).Register("/" + demo_id_ + "/layout/d/q", q_total_);
-      HTTP(port).Register("/" + demo_id_ + "/layout/d/e", e_15sec_);
-      HTTP(port).Register("/" + demo_id_ + "/layout/d/i", image_);
-
-      // The black magic of serving the dashboard.
-      HTTP(port).ServeStaticFilesFrom(FileSystem::JoinPath("static", "js"), "/" + demo_id_ + "/static/");
-
-      HTTP(port).Register("/" + demo_id_ + "/config", [this](Request r) {
-        // Read the file once.
-        static const std::string dashboard_template =
-            bricks::FileSystem::ReadFileAsString(bricks::FileSystem::JoinPath("static", "template.html"));
-        // Build the placeholder replacements.
-        std::map<std::string, std::string> replacement_map = {
-            // Custom style tags in the `<head>`, if needed.
-            {"<style id=\"knsh-dashboard-style-placeholder\"></style>", ""},
-            // Header columns between the logo and the GitHub link.
-            {"<div class=\"knsh-columns__item\" id=\"knsh-header-columns-placeholder\"></div>",
-             "<div class=\"knsh-columns__item\" style=\"text-align: right;\">"
-             "<a href=\"/" +
-                 demo_id_ +
-                 "/a/\" class=\"knsh-header-link\"><span>Actions</span></a>"
-                 "</div>"},
-            // Footer columns between the copyright and the GitHub link.
-            {"<div class=\"knsh-columns__item\" id=\"knsh-footer-columns-placeholder\"></div>", ""},
-            // Anything to put above the generated dashboard.
-            {"<div id=\"knsh-dashboard-before-placeholder\"></div>", ""},
-            // Anything to put below the generated dashboard.
-            {"<div id=\"knsh-dashboard-after-placeholder\"></div>", ""}};
-        // Replace the placeholders with the replacements.
-        std::string dashboard_template_output = dashboard_template;
-        for (const auto& kv : replacement_map) {
-          std::size_t pos = 0;
-          while (std::string::npos != (pos = dashboard_template_output.find(kv.first, pos))) {
-            dashboard_template_output.replace(pos, kv.first.length(), kv.second);
-            pos += kv.second.length();
-          }
-        }
-        // The layout URL is an absolute URL, not relative to the config URL.
-        r(dashboard::Config("/" + demo_id_ + "/layout", dashboard_template_output), "config");
+      // The tick streams are derived from the records, so they are not persisted, and only keep twice
+      // the time window the dashboard plots them over.
+      const size_t tick_retention =
+          static_cast<size_t>(2 * dashboard::PlotMeta().options.time_interval / kTickPeriod.count());
+      u_total_.Retain(tick_retention);
+      q_total_.Retain(tick_retention);
+      e_15sec_.Retain(tick_retention);
+
+      // Data streams. Each point is serialized once and shared by all the viewers of the dashboard.
+      // The dashboard spreads them over the data hostnames, for the browser not to run out of connections.
+      hosts::Sharding& sharding = hosts::Data();
+      routes_.Register("/" + demo_id_ + "/layout/d/u", sharding.Handler(u_total_, subscriptions_));
+      routes_.Register("/" + demo_id_ + "/layout/d/q", sharding.Handler(q_total_, subscriptions_));
+      routes_.Register("/" + demo_id_ + "/layout/d/e", sharding.Handler(e_15sec_, subscriptions_));
+      routes_.Register("/" + demo_id_ + "/layout/d/i", sharding.Handler(image_, subscriptions_));
+
+      // All of the above over one connection, tagged with the `data_url`-s of the cells.
+      feed_.Add("/d/u", u_total_.Source());
+      feed_.Add("/d/q", q_total_.Source());
+      feed_.Add("/d/e", e_15sec_.Source());
+      feed_.Add("/d/i", image_.Source());
+      routes_.Register("/" + demo_id_ + "/layout/feed", sharding.Handler(feed_, subscriptions_));
+
+      // The config, the layout, the metas and the latest points, for the first paint in one request.
+      bootstrap_.AddStream("/d/u",
+                           [this]() { return u_total_.Size(); },
+                           [this]() { return u_total_.Latest(); });
+      bootstrap_.AddStream("/d/q",
+                           [this]() { return q_total_.Size(); },
+                           [this]() { return q_total_.Latest(); });
+      bootstrap_.AddStream("/d/e",
+                           [this]() { return e_15sec_.Size(); },
+                           [this]() { return e_15sec_.Latest(); });
+      bootstrap_.AddStream("/d/i",
+                           [this]() { return image_.Size(); },
+                           [this]() { return image_.Latest(); });
+      routes_.Register("/" + demo_id_ + "/bootstrap", [this](Request r) {
+        r(bootstrap_.Render(), HTTPResponseCode.OK, "application/json; charset=utf-8");
       });
 
-      HTTP(port).Register("/" + demo_id_ + "/layout", [](Request r) {
-        using namespace dashboard::layout;
-        r(Layout(Row({Col({Cell("/q_meta"), Cell("/u_meta"), Cell("/e_meta")}), Cell("/i_meta")})), "layout");
-      });
+      // The black magic of serving the dashboard. The scripts are shared by all the demos, compressed once.
+      for (const auto& script : assets::Static().List("js/")) {
+        routes_.Register("/" + demo_id_ + "/static/" + script.substr(3), assets::Static().Handler(script));
+      }
 
-      HTTP(port).Register("/" + demo_id_ + "/layout/u_meta", [](Request r) {
-        auto meta = dashboard::PlotMeta();
-        meta.options.caption = "Total users.";
-        meta.data_url = "/d/u";
-        r(meta, "meta");
+      // The config never changes, so it is rendered and serialized once per demo.
+      routes_.Register("/" + demo_id_ + "/config", [this](Request r) {
+        r(config_response_, HTTPResponseCode.OK, "application/json; charset=utf-8");
       });
 
-      HTTP(port).Register("/" + demo_id_ + "/layout/q_meta", [](Request r) {
-        auto meta = dashboard::PlotMeta();
-        meta.options.caption = "Total questions.";
-        meta.data_url = "/d/q";
-        r(meta, "meta");
-      });
+      // The layout and the metadata of its cells never change, so they are served as precomputed bytes.
+      const assets::Cache& layout = LayoutDocuments();
+      routes_.Register("/" + demo_id_ + "/layout", layout.Handler("layout.json", assets::kRevalidate));
+      for (const std::string meta : {"u_meta", "q_meta", "e_meta", "i_meta"}) {
+        routes_.Register("/" + demo_id_ + "/layout/" + meta,
+                         layout.Handler(meta + ".json", assets::kRevalidate));
+      }
 
-      HTTP(port).Register("/" + demo_id_ + "/layout/e_meta", [](Request r) {
-        auto meta = dashboard::PlotMeta();
-        meta.options.caption = "15-Seconds Engagement.";
-        meta.data_url = "/d/e";
-        r(meta, "meta");
-      });
+      // Need a dedicated handler for '$DEMO_ID/' to serve the nicely looking dashboard.
+      routes_.Register("/" + demo_id_ + "/", assets::Static().Handler("index.html", assets::kRevalidate));
 
-      HTTP(port).Register("/" + demo_id_ + "/layout/i_meta", [](Request r) {
-        auto meta = dashboard::ImageMeta();
-        meta.options.header_text = "Agreement between users.";
-        meta.data_url = "/d/i";
-        r(meta, "meta");
-      });
+      // The per-question counts of the answers, of all the questions or of `?qid=`,
+      // and the stream of the controversy of the question `?qid=`.
+      routes_.Register("/" + demo_id_ + "/stats",
+                       [this](Request r) { ServeRequestWithSnapshot(std::move(r), &Cruncher::Stats); });
+      routes_.Register("/" + demo_id_ + "/layout/d/question",
+                       [this](Request r) { mq_.EmplaceMessage(new QuestionStreamMQMessage(std::move(r))); });
 
-      // Need a dedicated handler for '$DEMO_ID/' to serve the nicely looking dashboard.
-      HTTP(port).Register(
-          "/" + demo_id_ + "/",
-          new bricks::net::api::StaticFileServer(
-              bricks::FileSystem::ReadFileAsString(bricks::FileSystem::JoinPath("static", "index.html")),
-              "text/html"));
-
-      HTTP(port).Register("/" + demo_id_ + "/layout/d/i/viz.png",
-                          [this](Request r) { mq_.EmplaceMessage(new VizMQMessage(std::move(r))); });
+      routes_.Register("/" + demo_id_ + "/layout/d/i/viz.png",
+                       [this](Request r) { mq_.EmplaceMessage(new VizMQMessage(std::move(r))); });
     } catch (const bricks::Exception& e) {
       std::cerr << "Crunched constructor exception: " << e.What() << std::endl;
       throw;
     }
   }
 
+  // The `/layout` and `/layout/*_meta` responses. The same for all the demos, so serialized once per process.
+  static const assets::Cache& LayoutDocuments() {
+    static const std::unique_ptr<assets::Cache> documents = []() {
+      using namespace dashboard::layout;
+      std::unique_ptr<assets::Cache> documents(new assets::Cache());
+      const auto cells = Row({Col({Cell("/q_meta"), Cell("/u_meta"), Cell("/e_meta")}), Cell("/i_meta")});
+      documents->Add("layout.json", JSON(Layout(cells), "layout") + '\n');
+      const auto add_plot_meta = [&documents](const std::string& name, const char* caption, const char* url) {
+        auto meta = dashboard::PlotMeta();
+        meta.options.caption = caption;
+        meta.data_url = url;
+        documents->Add(name + ".json", JSON(meta, "meta") + '\n');
+      };
+      add_plot_meta("u_meta", "Total users.", "/d/u");
+      add_plot_meta("q_meta", "Total questions.", "/d/q");
+      add_plot_meta("e_meta", "15-Seconds Engagement.", "/d/e");
+      auto meta = dashboard::ImageMeta();
+      meta.options.header_text = "Agreement between users.";
+      meta.data_url = "/d/i";
+      documents->Add("i_meta.json", JSON(meta, "meta") + '\n');
+      return documents;
+    }();
+    return *documents;
+  }
+
+  // The `*_meta` responses, by their `meta_url`-s.
+  static std::vector<std::pair<std::string, std::string>> LayoutMetas() {
+    std::vector<std::pair<std::string, std::string>> metas;
+    for (const std::string meta : {"q_meta", "u_meta", "e_meta", "i_meta"}) {
+      metas.emplace_back("/" + meta, LayoutDocuments().Get(meta + ".json").identity);
+    }
+    return metas;
+  }
+
+  // The `/config` response, with the dashboard template filled in for this demo.
+  static std::string RenderConfig(const std::string& demo_id) {
+    // Read and parse the file once.
+    static const dashboard::Template dashboard_template(
+        bricks::FileSystem::ReadFileAsString(bricks::FileSystem::JoinPath("static", "template.html")),
+        {"<style id=\"knsh-dashboard-style-placeholder\"></style>",
+         "<div class=\"knsh-columns__item\" id=\"knsh-header-columns-placeholder\"></div>",
+         "<div class=\"knsh-columns__item\" id=\"knsh-footer-columns-placeholder\"></div>",
+         "<div id=\"knsh-dashboard-before-placeholder\"></div>",
+         "<div id=\"knsh-dashboard-after-placeholder\"></div>"});
+    const std::map<std::string, std::string> replacement_map = {
+        // Custom style tags in the `<head>`, if needed.
+        {"<style id=\"knsh-dashboard-style-placeholder\"></style>", ""},
+        // Header columns between the logo and the GitHub link.
+        {"<div class=\"knsh-columns__item\" id=\"knsh-header-columns-placeholder\"></div>",
+         "<div class=\"knsh-columns__item\" style=\"text-align: right;\">"
+         "<a href=\"/" +
+             demo_id +
+             "/a/\" class=\"knsh-header-link\"><span>Actions</span></a>"
+             "</div>"},
+        // Footer columns between the copyright and the GitHub link.
+        {"<div class=\"knsh-columns__item\" id=\"knsh-footer-columns-placeholder\"></div>", ""},
+        // Anything to put above the generated dashboard.
+        {"<div id=\"knsh-dashboard-before-placeholder\"></div>", ""},
+        // Anything to put below the generated dashboard.
+        {"<div id=\"knsh-dashboard-after-placeholder\"></div>", ""}};
+    // The layout URL is an absolute URL, not relative to the config URL.
+    dashboard::Config config("/" + demo_id + "/layout", dashboard_template.Render(replacement_map));
+    config.feed_url = "/feed";
+    return JSON(config, "config") + '\n';
+  }
+
+  // Stops serving the requests first, then stops the threads. The streams end the responses of their viewers.
   ~Cruncher() {
+    routes_.Close();
+    routes_.UnRegisterAll();
+    {
+      std::lock_guard<std::mutex> lock(metronome_mutex_);
+      metronome_stop_ = true;
+    }
+    metronome_condition_.notify_one();
     // TODO(dkorolev): There should probably be a better, more Bricks-standard way to make use of a metronome.
     metronome_thread_.join();
   }
 
+  routes::DemoRoutes& Routes() { return routes_; }
+  const routes::DemoRoutes& Routes() const { return routes_; }
+
+  const fanout::Subscriptions& StreamSubscriptions() const { return subscriptions_; }
+
+  // Blocks until the image reflects the first `records` records. The last of them should be one that changes
+  // the image, a user or an answer, as the last of the seed records is.
+  void WaitForImage(size_t records) {
+    consumer_.visualization_.Wait(
+        [records](const Consumer::Visualization& v) { return v.stop || v.rendered_records >= records; });
+  }
+
+  // What a fork of the demo starts from, instead of replaying the records through the optimizer again.
+  // Reflects the first `records` records of the stream. The table and the image are shared, copy-on-write.
+  struct State {
+    Snapshot::Box box;
+    std::queue<double> engagement;
+    std::unique_ptr<actions::TableCache> actions_table;
+    stats::Tallies tallies;
+    size_t records = 0;
+    std::shared_ptr<const std::string> image;
+    size_t image_records = 0;
+  };
+
+  // Blocks until the message queue gets to it, and the snapshot reflects the first `records` records.
+  State ForkState(size_t records) {
+    std::promise<State> promise;
+    CallFunctionWithSnapshot([this, &promise](Snapshot& snapshot) {
+      State state;
+      state.box = snapshot.box;
+      state.engagement = snapshot.engagement.q_;
+      state.actions_table.reset(new actions::TableCache());
+      state.actions_table->ShareFrom(snapshot.actions_table);
+      state.tallies = snapshot.tallies;
+      state.records = snapshot.records;
+      const auto visualization = consumer_.visualization_.ImmutableScopedAccessor();
+      state.image = visualization->image;
+      state.image_records = visualization->rendered_records;
+      promise.set_value(std::move(state));
+    }, records);
+    return promise.get_future().get();
+  }
+
+  // The `/stats` response, from the tallies kept by the `Consumer`, for one question or for all of them.
+  static void Stats(Request r, Snapshot& snapshot) {
+    const std::string qid_text = r.url.query["qid"];
+    if (!qid_text.empty()) {
+      const size_t qid = static_cast<size_t>(std::max(0, atoi(qid_text.c_str())));
+      if (!qid || qid > snapshot.box.questions.size()) {
+        r("QUESTION DOES NOT EXISTS\n", HTTPResponseCode.BadRequest);
+      } else {
+        const stats::QuestionStats response =
+            snapshot.tallies.Describe(static_cast<schema::QID>(qid), snapshot.box.questions[qid - 1]);
+        r(response, "question");
+      }
+    } else {
+      stats::AllQuestionsStats response;
+      response.questions.reserve(snapshot.box.questions.size());
+      for (size_t i = 0; i < snapshot.box.questions.size(); ++i) {
+        response.questions.push_back(
+            snapshot.tallies.Describe(static_cast<schema::QID>(i + 1), snapshot.box.questions[i]));
+      }
+      r(response, "stats");
+    }
+  }
+
   struct FunctionMQMessage : schema::Base {
     std::function<void(Snapshot&)> function_with_snapshot;
+    // Called once the snapshot reflects this many records.
+    size_t records;
     FunctionMQMessage() = delete;
-    explicit FunctionMQMessage(std::function<void(Snapshot&)> f) : function_with_snapshot(f) {}
+    explicit FunctionMQMessage(std::function<void(Snapshot&)> f, size_t records = 0)
+        : function_with_snapshot(f), records(records) {}
   };
 
   struct HTTPRequestMQMessage : schema::Base {
@@ -241,8 +437,14 @@ class Cruncher final {
     explicit VizMQMessage(Request r) : request(std::move(r)) {}
   };
 
+  struct QuestionStreamMQMessage : schema::Base {
+    Request request;
+    QuestionStreamMQMessage() = delete;
+    explicit QuestionStreamMQMessage(Request r) : request(std::move(r)) {}
+  };
+
   struct TickMQMessage : schema::Base {
-    typedef sherlock::StreamInstance<VizPoint<int>> stream_type;
+    typedef fanout::Stream<VizPoint<int>> stream_type;
     stream_type& p_u_total;
     stream_type& p_q_total;
     stream_type& p_e_15sec;
@@ -262,8 +464,9 @@ class Cruncher final {
 
   inline void Terminate() { std::cerr << '@' << demo_id_ << " is done.\n"; }
 
-  void CallFunctionWithSnapshot(std::function<void(Snapshot&)> f) {
-    mq_.EmplaceMessage(new FunctionMQMessage(f));
+  // With `records`, not before the snapshot reflects the first `records` records.
+  void CallFunctionWithSnapshot(std::function<void(Snapshot&)> f, size_t records = 0) {
+    mq_.EmplaceMessage(new FunctionMQMessage(f, records));
   }
 
   void ServeRequestWithSnapshot(Request r, std::function<void(Request, Snapshot&)> f) {
@@ -272,6 +475,8 @@ class Cruncher final {
 
   struct Consumer {
     const std::string& demo_id_;
+    // The nodes of the answers of the demo, released all at once when the demo is destroyed or hibernated.
+    arena::Arena arena_;
     Snapshot snapshot_;
 
     // Syncronization between the consumer thread that the thread that updates models and images
@@ -283,20 +488,66 @@ class Cruncher final {
       size_t done = 0;
       // Copy of the data to generate the image for.
       Snapshot::Box box;
-      // The image that is currently on display.
-      std::string image = "";
+      // The number of records in the `box`, and in the box of the image that is currently on display.
+      size_t records = 0;
+      size_t rendered_records = 0;
+      // The image that is currently on display, shared with the forks of the demo.
+      std::shared_ptr<const std::string> image;
+      // Set when the `Cruncher` is being destroyed.
+      bool stop = false;
+      explicit Visualization(arena::Arena* arena = nullptr) : box(arena) {}
     };
     WaitableAtomic<Visualization> visualization_;
 
-    sherlock::StreamInstance<VizPoint<std::string>>& image_stream_;
+    fanout::Stream<VizPoint<std::string>>& image_stream_;
+    // Counts the subscribers of the streams of the questions along with the other streams of the demo.
+    const fanout::Subscriptions subscriptions_;
+
+    // The streams of the questions someone is looking at. Only used from the thread of the message queue.
+    std::map<schema::QID, std::unique_ptr<fanout::Stream<VizPoint<double>>>> question_streams_;
+
+    // The functions waiting for the records still on their way, such as the ones replayed after a wake-up.
+    db::AtRecords<Snapshot> at_records_;
 
     std::thread visualization_thread_;
 
     Consumer() = delete;
-    Consumer(const std::string& demo_id, sherlock::StreamInstance<VizPoint<std::string>>& image_stream)
+    Consumer(const std::string& demo_id,
+             fanout::Stream<VizPoint<std::string>>& image_stream,
+             const fanout::Subscriptions& subscriptions,
+             const State* fork_from)
         : demo_id_(demo_id),
+          snapshot_(&arena_),
+          visualization_(&arena_),
           image_stream_(image_stream),
-          visualization_thread_(&Consumer::UpdateVisualizationThread, this) {}
+          subscriptions_(subscriptions),
+          visualization_thread_(&Consumer::UpdateVisualizationThread, this) {
+      if (fork_from) {
+        snapshot_.box = fork_from->box;
+        snapshot_.engagement.q_ = fork_from->engagement;
+        snapshot_.actions_table.ShareFrom(*fork_from->actions_table);
+        snapshot_.tallies = fork_from->tallies;
+        snapshot_.records = fork_from->records;
+        visualization_.MutableUse([fork_from](Visualization& v) {
+          v.records = fork_from->image_records;
+          v.rendered_records = fork_from->image_records;
+          v.image = fork_from->image;
+        });
+        if (fork_from->image) {
+          const double timestamp = static_cast<double>(bricks::time::Now());
+          image_stream_.Publish(VizPoint<std::string>{timestamp, Printf("/viz.png?key=%lf", timestamp)});
+        }
+        // The image of the parent may be behind its records, if it was being updated when the demo was forked.
+        if (fork_from->image_records < fork_from->records) {
+          TriggerVisualizationUpdate();
+        }
+      }
+    }
+
+    ~Consumer() {
+      visualization_.MutableUse([](Visualization& v) { v.stop = true; });
+      visualization_thread_.join();
+    }
 
     inline void OnMessage(std::unique_ptr<schema::Base>& message, size_t) {
       struct types {
@@ -307,6 +558,7 @@ class Cruncher final {
                            FunctionMQMessage,
                            HTTPRequestMQMessage,
                            VizMQMessage,
+                           QuestionStreamMQMessage,
                            TickMQMessage> derived_list;
         typedef bricks::rtti::RuntimeTupleDispatcher<base, derived_list> dispatcher;
       };
@@ -319,25 +571,49 @@ class Cruncher final {
     inline void operator()(schema::UserRecord& u) {
       std::cerr << '@' << demo_id_ << " +U: " << u.uid << '\n';
       snapshot_.box.users.push_back(u.uid);
+      snapshot_.actions_table.AddUser(u.uid);
+      ++snapshot_.records;
       snapshot_.engagement.AddAction(static_cast<double>(u.ms));
       TriggerVisualizationUpdate();
+      at_records_.Consumed(snapshot_.records, snapshot_);
     }
 
     inline void operator()(schema::QuestionRecord& q) {
       std::cerr << '@' << demo_id_ << " +Q" << static_cast<size_t>(q.qid) << " : \"" << q.text << "\"\n";
       snapshot_.box.questions.push_back(q.text);
+      snapshot_.actions_table.AddQuestion(q.text);
+      ++snapshot_.records;
       snapshot_.engagement.AddAction(static_cast<double>(q.ms));
+      at_records_.Consumed(snapshot_.records, snapshot_);
     }
 
     inline void operator()(schema::AnswerRecord& a) {
       std::cerr << '@' << demo_id_ << " +A: " << a.uid << " `" << static_cast<int>(a.answer) << "` Q"
                 << static_cast<size_t>(a.qid) << '\n';
-      snapshot_.box.answers[a.qid][a.uid] = a.answer;
+      auto& answers = snapshot_.box.answers[a.qid];
+      const auto previous = answers.find(a.uid);
+      if (previous != answers.end()) {
+        snapshot_.tallies.Remove(a.qid, previous->second);
+        previous->second = a.answer;
+      } else {
+        answers[a.uid] = a.answer;
+      }
+      snapshot_.tallies.Add(a.qid, a.answer);
+      snapshot_.actions_table.SetAnswer(a.qid, a.uid, a.answer);
+      const auto stream = question_streams_.find(a.qid);
+      if (stream != question_streams_.end()) {
+        const double controversy = snapshot_.tallies.Get(a.qid).Controversy();
+        stream->second->Publish(VizPoint<double>{static_cast<double>(a.ms), controversy});
+      }
+      ++snapshot_.records;
       snapshot_.engagement.AddAction(static_cast<double>(a.ms));
       TriggerVisualizationUpdate();
+      at_records_.Consumed(snapshot_.records, snapshot_);
     }
 
-    inline void operator()(FunctionMQMessage& message) { message.function_with_snapshot(snapshot_); }
+    inline void operator()(FunctionMQMessage& message) {
+      at_records_.Add(message.records, snapshot_.records, snapshot_, message.function_with_snapshot);
+    }
 
     inline void operator()(HTTPRequestMQMessage& message) {
       message.http_function_with_snapshot(std::move(message.request), snapshot_);
@@ -345,14 +621,33 @@ class Cruncher final {
 
     inline void operator()(VizMQMessage& message) {
       // Retrieve the current images, read-lock-protected, no external notifications.
-      const std::string image = visualization_.ImmutableScopedAccessor()->image;
-      if (!image.empty()) {
-        message.request(image, HTTPResponseCode.OK, "image/png");
+      const std::shared_ptr<const std::string> image = visualization_.ImmutableScopedAccessor()->image;
+      if (image && !image->empty()) {
+        message.request(*image, HTTPResponseCode.OK, "image/png");
       } else {
         message.request("Not ready yet.", HTTPResponseCode.BadRequest, "text/plain");
       }
     }
 
+    // The controversy of the question `?qid=` over time. The stream is created on the first request for it.
+    inline void operator()(QuestionStreamMQMessage& message) {
+      const schema::QID qid = static_cast<schema::QID>(atoi(message.request.url.query["qid"].c_str()));
+      if (qid == schema::QID::NONE) {
+        message.request("NEED QID\n", HTTPResponseCode.BadRequest);
+      } else if (static_cast<size_t>(qid) > snapshot_.box.questions.size()) {
+        message.request("QUESTION DOES NOT EXISTS\n", HTTPResponseCode.BadRequest);
+      } else {
+        std::unique_ptr<fanout::Stream<VizPoint<double>>>& stream = question_streams_[qid];
+        if (!stream) {
+          stream.reset(new fanout::Stream<VizPoint<double>>(
+              Printf("%s_q%d_controversy", demo_id_.c_str(), static_cast<int>(qid)), "point"));
+          const double controversy = snapshot_.tallies.Get(qid).Controversy();
+          stream->Publish(VizPoint<double>{static_cast<double>(Now()), controversy});
+        }
+        (*stream)(std::move(message.request), subscriptions_.Scope());
+      }
+    }
+
     inline void operator()(TickMQMessage& message) {
       const double t = static_cast<double>(Now());
       message.p_u_total.Publish(VizPoint<int>{t, static_cast<int>(snapshot_.box.users.size())});
@@ -407,6 +702,46 @@ class Cruncher final {
         return penalty;
       }
 
+      // AD[i][j] for the users of the `box`.
+      static std::vector<std::vector<std::pair<size_t, size_t>>> AgreementMatrix(const Snapshot::Box& box) {
+        const size_t N = box.users.size();
+        std::map<std::string, size_t> uid_remap;
+        for (size_t i = 0; i < N; ++i) {
+          uid_remap[box.users[i]] = i;
+        }
+
+        std::vector<std::vector<std::pair<size_t, size_t>>> AD(
+            N, std::vector<std::pair<size_t, size_t>>(N, std::pair<size_t, size_t>(0u, 0u)));
+
+        for (const auto qit : box.answers) {
+          std::vector<std::string> clusters[2];  // Disagree, Agree.
+          for (const auto uit : qit.second) {
+            if (uit.second == schema::ANSWER::DISAGREE) {
+              clusters[0].push_back(uit.first);
+            } else if (uit.second == schema::ANSWER::AGREE) {
+              clusters[1].push_back(uit.first);
+            }
+          }
+          for (size_t c = 0; c < 2; ++c) {
+            for (size_t i = 0; i + 1 < clusters[c].size(); ++i) {
+              for (size_t j = i + 1; j < clusters[c].size(); ++j) {
+                ++AD[uid_remap[clusters[c][i]]][uid_remap[clusters[c][j]]].first;
+                ++AD[uid_remap[clusters[c][j]]][uid_remap[clusters[c][i]]].first;
+              }
+            }
+          }
+          if (!clusters[0].empty() && !clusters[1].empty()) {
+            for (const auto& cit1 : clusters[0]) {
+              for (const auto& cit2 : clusters[1]) {
+                ++AD[uid_remap[cit1]][uid_remap[cit2]].second;
+                ++AD[uid_remap[cit2]][uid_remap[cit1]].second;
+              }
+            }
+          }
+        }
+        return AD;
+      }
+
       void Update(const Snapshot::Box& box) {
         auto& static_data = bricks::ThreadLocalSingleton<StaticFunctionData>();
         size_t& N = static_data.N;
@@ -420,40 +755,7 @@ class Cruncher final {
         N = box.users.size();
 
         if (N) {
-          std::map<std::string, size_t> uid_remap;
-          for (size_t i = 0; i < N; ++i) {
-            uid_remap[box.users[i]] = i;
-          }
-
-          AD = std::vector<std::vector<std::pair<size_t, size_t>>>(
-              N, std::vector<std::pair<size_t, size_t>>(N, std::pair<size_t, size_t>(0u, 0u)));
-
-          for (const auto qit : box.answers) {
-            std::vector<std::string> clusters[2];  // Disagree, Agree.
-            for (const auto uit : qit.second) {
-              if (uit.second == schema::ANSWER::DISAGREE) {
-                clusters[0].push_back(uit.first);
-              } else if (uit.second == schema::ANSWER::AGREE) {
-                clusters[1].push_back(uit.first);
-              }
-            }
-            for (size_t c = 0; c < 2; ++c) {
-              for (size_t i = 0; i + 1 < clusters[c].size(); ++i) {
-                for (size_t j = i + 1; j < clusters[c].size(); ++j) {
-                  ++AD[uid_remap[clusters[c][i]]][uid_remap[clusters[c][j]]].first;
-                  ++AD[uid_remap[clusters[c][j]]][uid_remap[clusters[c][i]]].first;
-                }
-              }
-            }
-            if (!clusters[0].empty() && !clusters[1].empty()) {
-              for (const auto& cit1 : clusters[0]) {
-                for (const auto& cit2 : clusters[1]) {
-                  ++AD[uid_remap[cit1]][uid_remap[cit2]].second;
-                  ++AD[uid_remap[cit2]][uid_remap[cit1]].second;
-                }
-              }
-            }
-          }
+          AD = AgreementMatrix(box);
 
           std::vector<double> x;
           for (size_t i = 0; i < N; ++i) {
@@ -526,6 +828,7 @@ class Cruncher final {
         // Make a copy of `snapshot_.box` to work with.
         // And signal the image update thread that it now has a job.
         visualization.box = snapshot_.box;
+        visualization.records = snapshot_.records;
         ++visualization.requested;
       });
     }
@@ -536,14 +839,19 @@ class Cruncher final {
     void UpdateVisualizationThread() {
       while (true) {
         // Patiently wait for new user-generated data to update the model+visualization.
-        visualization_.Wait([](const Visualization& v) { return v.done < v.requested; });
+        visualization_.Wait([](const Visualization& v) { return v.stop || v.done < v.requested; });
+        if (visualization_.ImmutableScopedAccessor()->stop) {
+          return;
+        }
         // Work with the copy of the box.
         Visualization copy = *visualization_.ImmutableScopedAccessor();
         std::cerr << "Starting to process request " << copy.requested << std::endl;
         const double timestamp = static_cast<double>(bricks::time::Now());
-        const std::string image = RegenerateImage(copy.box);
+        const std::shared_ptr<const std::string> image =
+            std::make_shared<const std::string>(RegenerateImage(copy.box));
         visualization_.MutableUse([&copy, &image](Visualization& v) {
           v.image = image;
+          v.rendered_records = copy.records;
           // Update to the `requested` version which was actually processed.
           // This is the most concurrency-safe solution.
           v.done = copy.requested;
@@ -556,26 +864,34 @@ class Cruncher final {
 
   // TODO(dkorolev): There should probably be a better, more Bricks-standard way to make use of a metronome.
   void MetronomeThread() {
-    const MILLISECONDS_INTERVAL period = static_cast<MILLISECONDS_INTERVAL>(500);
-    EPOCH_MILLISECONDS now = Now();
-    while (true) {
+    std::unique_lock<std::mutex> lock(metronome_mutex_);
+    while (!metronome_stop_) {
       mq_.EmplaceMessage(new TickMQMessage(u_total_, q_total_, e_15sec_));
-      bricks::time::SleepUntil(now + period);
-      now = Now();
+      metronome_condition_.wait_for(lock, kTickPeriod);
     }
   }
 
  private:
   const std::string& demo_id_;
+  const std::string config_response_;
 
-  sherlock::StreamInstance<VizPoint<int>> u_total_;
-  sherlock::StreamInstance<VizPoint<int>> q_total_;
-  sherlock::StreamInstance<VizPoint<int>> e_15sec_;
-  sherlock::StreamInstance<VizPoint<std::string>> image_;
+  fanout::Stream<VizPoint<int>> u_total_;
+  fanout::Stream<VizPoint<int>> q_total_;
+  fanout::Stream<VizPoint<int>> e_15sec_;
+  fanout::Stream<VizPoint<std::string>> image_;
+  fanout::Feed feed_;
+  dashboard::Bootstrap bootstrap_;
+  // The open subscriptions to all of the above, and to the other streams of the demo.
+  fanout::Subscriptions subscriptions_;
 
   Consumer consumer_;
   MMQ<Consumer, std::unique_ptr<schema::Base>> mq_;
 
+  routes::DemoRoutes routes_;
+
+  std::mutex metronome_mutex_;
+  std::condition_variable metronome_condition_;
+  bool metronome_stop_ = false;
   std::thread metronome_thread_;
 
   Cruncher() = delete;
@@ -585,169 +901,46 @@ class Cruncher final {
   void operator=(Cruncher&&) = delete;
 };
 
-class MixpanelUploader final {
- public:
-  struct MixpanelEvent {
-    struct User {
-      struct Properties {
-        // (reserved) The Mixpanel project token.
-        std::string token;
-
-        // (reserved) The identifier of the user who caused the event to happen.
-        std::string distinct_id;
-
-        // (reserved) The time of the event, in seconds.
-        uint64_t time;
-
-        template <typename A>
-        void serialize(A& ar) {
-          ar(CEREAL_NVP(token), CEREAL_NVP(distinct_id), CEREAL_NVP(time));
-        }
-      };
-
-      std::string event;
-      Properties properties;
-
-      User(const std::string& token, const schema::UserRecord& u) {
-        event = "User";
-        properties.token = token;
-        properties.distinct_id = u.uid;
-        properties.time = static_cast<uint64_t>(u.ms) / 1000;
-      }
-
-      template <typename A>
-      void serialize(A& ar) {
-        ar(CEREAL_NVP(event), CEREAL_NVP(properties));
-      }
-    };
-
-    struct Answer {
-      struct Properties {
-        // (reserved) The Mixpanel project token.
-        std::string token;
-
-        // (reserved) The identifier of the user who caused the event to happen.
-        std::string distinct_id;
-
-        // (reserved) The time of the event, in seconds.
-        uint64_t time;
-
-        // Question identifier.
-        schema::QID qid;
-
-        // Answer identifier.
-        schema::ANSWER answer;
-
-        template <typename A>
-        void serialize(A& ar) {
-          ar(CEREAL_NVP(token),
-             CEREAL_NVP(distinct_id),
-             CEREAL_NVP(time),
-             cereal::make_nvp("Question", static_cast<size_t>(qid)),
-             cereal::make_nvp("Answer", static_cast<int>(answer)));
-        }
-      };
-
-      std::string event;
-      Properties properties;
-
-      Answer(const std::string& token, const schema::AnswerRecord& a) {
-        event = "Answer";
-        properties.token = token;
-        properties.distinct_id = a.uid;
-        properties.time = static_cast<uint64_t>(a.ms) / 1000;
-        properties.qid = a.qid;
-        properties.answer = a.answer;
-      }
-
-      template <typename A>
-      void serialize(A& ar) {
-        ar(CEREAL_NVP(event), CEREAL_NVP(properties));
-      }
-    };
-
-  };  // struct MixpanelEvent
-
-  MixpanelUploader(const std::string& demo_id, const std::string& mixpanel_token)
-      : demo_id_(demo_id), mixpanel_token_(mixpanel_token) {}
-
-  inline bool Entry(const std::unique_ptr<schema::Base>& entry, size_t index, size_t total) {
-    static_cast<void>(index);
-    static_cast<void>(total);
-
-    struct types {
-      typedef schema::Base base;
-      typedef std::tuple<schema::UserRecord, schema::AnswerRecord> derived_list;
-      typedef bricks::rtti::RuntimeTupleDispatcher<base, derived_list> dispatcher;
-    };
-    types::dispatcher::DispatchCall(*entry, *this);
-
-    return true;
-  }
-
-  inline void Terminate() { std::cerr << '@' << demo_id_ << " MixpanelUploader is done.\n"; }
-
-  inline void operator()(schema::Base&) {
-    // Sink for ignored events; currently `Question`-s.
-  }
-
-  template <typename T>
-  inline void PushMixpanelEvent(T&& event) {
-    const std::string json = bricks::cerealize::MultiKeyJSON(event);
-    std::cerr << '@' << demo_id_ << " MixpanelUploader Event: " << json << std::endl;
-    const std::string base64_json = bricks::cerealize::Base64Encode(json);
-    // WORKAROUND(sompylasar): Not using `https://`, could not send HTTPS request.
-    const std::string mixpanel_request = "http://api.mixpanel.com/track?data=" + base64_json;
-    std::cerr << '@' << demo_id_ << " MixpanelUploader Request: " << mixpanel_request << std::endl;
-    if (mixpanel_token_.empty()) {
-      std::cerr << '@' << demo_id_ << " MixpanelUploader Empty token, not sending." << std::endl;
-      return;
-    }
-    auto response = HTTP(GET(mixpanel_request));
-    std::cerr << '@' << demo_id_ << " MixpanelUploader Response: HTTP " << static_cast<int>(response.code)
-              << " \"" << response.body << "\"" << std::endl;
-  }
-
-  inline void operator()(schema::UserRecord& u) { PushMixpanelEvent(MixpanelEvent::User(mixpanel_token_, u)); }
-
-  inline void operator()(schema::AnswerRecord& a) {
-    PushMixpanelEvent(MixpanelEvent::Answer(mixpanel_token_, a));
-  }
-
- private:
-  const std::string& demo_id_;
-  const std::string& mixpanel_token_;
-
-  MixpanelUploader() = delete;
-  MixpanelUploader(const MixpanelUploader&) = delete;
-  void operator=(const MixpanelUploader&) = delete;
-  MixpanelUploader(MixpanelUploader&&) = delete;
-  void operator=(MixpanelUploader&&) = delete;
-};
-
 struct Controller {
  public:
-  explicit Controller(int port, const std::string& demo_id, const std::string& mixpanel_token, db::Storage* db)
+  // With `fork_from`, the `Storage` should have been started from the first `fork_from->records` records
+  // of the parent, see `Storage::SharedPrefix()`.
+  explicit Controller(int port,
+                      const std::string& demo_id,
+                      const std::string& mixpanel_token,
+                      const std::string& sinks,
+                      db::Storage* db,
+                      const Cruncher::State* fork_from = nullptr)
       : port_(port),
         demo_id_(demo_id),
-        mixpanel_token_(mixpanel_token),
-        html_header_(FileSystem::ReadFileAsString(FileSystem::JoinPath("static", "actions_header.html"))),
-        html_footer_(FileSystem::ReadFileAsString(FileSystem::JoinPath("static", "actions_footer.html"))),
+        html_header_(assets::Static().Get("actions_header.html").identity),
+        html_footer_(assets::Static().Get("actions_footer.html").identity),
         db_(db),
-        cruncher_(port_, demo_id_),
-        cruncher_scope_(db_->Subscribe(cruncher_)),
-        mixpanel_uploader_(demo_id_, mixpanel_token_),
-        mixpanel_uploader_scope_(db->Subscribe(mixpanel_uploader_)) {
-    // The main controller page.
-    HTTP(port_).Register("/" + demo_id_ + "/a/", std::bind(&Controller::Actions, this, std::placeholders::_1));
-    HTTP(port_).Register("/" + demo_id_ + "/a", [this](Request r) {
+        recovered_records_(db_->Size()),
+        cruncher_(port_, demo_id_, fork_from),
+        cruncher_scope_(db_->Subscribe(cruncher_, fork_from ? fork_from->records : 0u)),
+        exporter_(demo_id_),
+        routes_(port_) {
+    AttachSinks(mixpanel_token, sinks);
+
+    // The main controller page, rendered client-side from the answer matrix and the stream of records.
+    routes_.Register("/" + demo_id_ + "/a/", assets::Static().Handler("actions.html", assets::kRevalidate));
+    routes_.Register("/" + demo_id_ + "/a/matrix", std::bind(&Controller::Matrix, this, std::placeholders::_1));
+
+    // The server-rendered controller page, for the browsers without JavaScript.
+    routes_.Register("/" + demo_id_ + "/a/table", std::bind(&Controller::Actions, this, std::placeholders::_1));
+    routes_.Register("/" + demo_id_ + "/a", [this](Request r) {
       r("", HTTPResponseCode.Found, "text/html", HTTPHeaders().Set("Location", "/" + demo_id_ + "/a/"));
     });
 
     // Make the storage-level stream accessible to the outer world via PubSub.
-    HTTP(port_).Register("/" + demo_id_ + "/a/raw", std::ref(*db_));
+    routes_.Register("/" + demo_id_ + "/a/raw",
+                     [this](Request r) { (*db_)(std::move(r), cruncher_.StreamSubscriptions().Scope()); });
 
-    // Pre-populate a few users, questions and answers to start from.
+    // Pre-populate a few users, questions and answers to start from, unless the demo is being woken up.
+    if (recovered_records_) {
+      return;
+    }
     db->DoAddUser("alice", Now() - MILLISECONDS_INTERVAL(9000));
     db->DoAddUser("barbie", Now() - MILLISECONDS_INTERVAL(8000));
     db->DoAddUser("cindy", Now() - MILLISECONDS_INTERVAL(7000));
@@ -787,93 +980,854 @@ struct Controller {
     db->DoAddAnswer("irene", movies, schema::ANSWER::DISAGREE, Now());
   }
 
+  ~Controller() {
+    routes_.Close();
+    routes_.UnRegisterAll();
+  }
+
+  // One listener of the stream of records exports the events into all the analytics sinks of this demo.
+  // Called once, either from the constructor or, for the demo that has been waiting in the pool, when it is
+  // handed out. The export resumes from the first record not exported yet into the sinks that keep track
+  // of it, see `analytics::Sink::NextSourceIndex()`, and starts from the first record not recovered from
+  // the disk for the others.
+  void AttachSinks(const std::string& mixpanel_token, const std::string& sinks) {
+    std::istringstream sinks_list(sinks);
+    std::string sink;
+    while (std::getline(sinks_list, sink, ',')) {
+      sink = bricks::strings::Trim(sink);
+      if (sink == "mixpanel") {
+        exporter_.AddSink(std::unique_ptr<analytics::Sink>(
+            new MixpanelUploader(demo_id_, mixpanel_token, FLAGS_mixpanel_endpoint, FLAGS_data_dir)));
+      } else if (sink == "ndjson") {
+        exporter_.AddSink(std::unique_ptr<analytics::Sink>(
+            new analytics::NDJSONFileSink(FileSystem::JoinPath(FLAGS_ndjson_dir, demo_id_ + ".ndjson"))));
+      } else if (sink == "udp") {
+        exporter_.AddSink(std::unique_ptr<analytics::Sink>(new analytics::UDPSink(FLAGS_udp_collector)));
+      } else if (!sink.empty()) {
+        std::cerr << '@' << demo_id_ << " Unknown analytics sink: \"" << sink << "\"" << std::endl;
+      }
+    }
+    if (exporter_.SinksCount()) {
+      exporter_scope_ = db_->Subscribe(exporter_, exporter_.ResumeFrom(recovered_records_));
+    }
+  }
+
+  // Blocks until the image of the dashboard reflects all the records so far.
+  void WaitForImage() { cruncher_.WaitForImage(db_->Size()); }
+
+  // Reflects all the records so far, including the ones still being replayed after a wake-up.
+  Cruncher::State ForkState() { return cruncher_.ForkState(db_->Size()); }
+
+  // The open subscriptions to the streams of the demo, the ones of its `Storage` served by this included.
+  size_t OpenSubscriptions() const { return cruncher_.StreamSubscriptions().Count(); }
+
+  // All the routes of the demo, other than those of its `Storage`.
+  uint64_t LastRequestMs() const {
+    return std::max(routes_.LastRequestMs(), cruncher_.Routes().LastRequestMs());
+  }
+
+  void Close(routes::handler_type fallback) {
+    routes_.Close(fallback);
+    cruncher_.Routes().Close(fallback);
+  }
+
+  bool Dispatch(Request& r) const { return routes_.Dispatch(r) || cruncher_.Routes().Dispatch(r); }
+
   void Actions(Request r) {
+    // The page shows a window of the table, `?q_offset=&q_limit=` questions by `?u_offset=&u_limit=` users.
+    actions::Window window;
+    const auto parameter = [&r](const std::string& name, size_t& value) {
+      const std::string text = r.url.query[name];
+      if (!text.empty()) {
+        value = static_cast<size_t>(std::max(0ll, atoll(text.c_str())));
+      }
+    };
+    parameter("q_offset", window.q_offset);
+    parameter("q_limit", window.q_limit);
+    parameter("u_offset", window.u_offset);
+    parameter("u_limit", window.u_limit);
+    window.ClampLimits();
+
     // This request goes through the Cruncher's message queue to ensure no concurrent access to the snapshot.
-    cruncher_.ServeRequestWithSnapshot(std::move(r), [this](Request r, Snapshot& snapshot) {
-      std::ostringstream table;
-      table << "<tr><td></td>";
-      for (const auto& u : snapshot.box.users) {
-        table << "<td align=center><b>" << u << "</b></td>";
-      }
-      table << "<tr>\n";
-      for (size_t qi = 0; qi < snapshot.box.questions.size(); ++qi) {
-        const auto& q = snapshot.box.questions[qi];
-        table << "<tr><td align=right><b>" << q << "</b></td>";
-        std::map<schema::UID, schema::ANSWER>& current_answers =
-            snapshot.box.answers[static_cast<schema::QID>(qi + 1)];
-        for (const auto& u : snapshot.box.users) {
-          table << "<td align=center>";
-          struct VTC {  // VTC = { Value, Text, Color }.
-            int value;
-            const char* text;
-            const char* color;
-          };
-          static constexpr VTC options[3] = {{-1, "No", "red"}, {0, "N/A", "gray"}, {+1, "Yes", "green"}};
-          const int current_answer = static_cast<int>(current_answers[u]);
-          for (size_t i = 0; i < 3; ++i) {
-            if (i) {
-              table << " | ";
-            }
-            if (options[i].value != current_answer) {
-              table << Printf("<a href='add_answer?uid=%s&qid=%d&answer=%d'>%s</a>",
-                              u.c_str(),
-                              static_cast<int>(qi + 1),
-                              options[i].value,
-                              options[i].text);
-            } else {
-              table << Printf("<b><font color=%s>%s</font></b>", options[i].color, options[i].text);
-            }
+    // Only the cached cells of the window are copied there; the page is sent from a thread of its own,
+    // which may outlive this `Controller`, so it is only given what `assets::Static()` owns.
+    const std::string& header = html_header_;
+    const std::string& footer = html_footer_;
+    cruncher_.ServeRequestWithSnapshot(std::move(r), [&header, &footer, window](Request r, Snapshot& snapshot) {
+      std::vector<std::string> rows = snapshot.actions_table.Page(window);
+      std::thread(&Controller::SendActionsPage,
+                  std::move(r),
+                  std::cref(header),
+                  std::cref(footer),
+                  std::move(rows)).detach();
+    });
+  }
+
+  // The JSON with the whole answer matrix, and the index of the record to follow the stream from.
+  void Matrix(Request r) {
+    cruncher_.ServeRequestWithSnapshot(std::move(r), [](Request r, Snapshot& snapshot) {
+      std::unique_ptr<actions::Matrix> matrix(new actions::Matrix());
+      matrix->next_record = snapshot.records;
+      matrix->users = snapshot.box.users;
+      matrix->questions = snapshot.box.questions;
+      for (const auto& qit : snapshot.box.answers) {
+        for (const auto& uit : qit.second) {
+          if (uit.second != schema::ANSWER::NA) {
+            const size_t qid = static_cast<size_t>(qit.first);
+            matrix->answers.push_back(actions::Matrix::Answer{qid, uit.first, static_cast<int>(uit.second)});
           }
-          table << "</td>";
         }
-        table << "</tr>\n";
       }
-      r(html_header_ + table.str() + html_footer_, HTTPResponseCode.OK, "text/html");
+      // Serializing a large matrix should not hold the message queue.
+      std::thread([](Request r, std::unique_ptr<actions::Matrix> matrix) { r(*matrix, "matrix"); },
+                  std::move(r),
+                  std::move(matrix)).detach();
     });
   }
 
+  // Sends the page as a chunked response, one chunk per row, without assembling it in memory.
+  static void SendActionsPage(Request r,
+                              const std::string& header,
+                              const std::string& footer,
+                              const std::vector<std::string>& rows) {
+    try {
+      auto response = r.connection.SendChunkedHTTPResponse(HTTPResponseCode.OK, "text/html");
+      response.Send(header);
+      for (const auto& row : rows) {
+        response.Send(row);
+      }
+      response.Send(footer);
+    } catch (const bricks::Exception&) {
+      // The browser has disconnected.
+    }
+  }
+
  private:
   const int port_;
   const std::string demo_id_;
-  const std::string mixpanel_token_;
 
-  const std::string html_header_;
-  const std::string html_footer_;
+  // Owned by `assets::Static()`.
+  const std::string& html_header_;
+  const std::string& html_footer_;
 
   db::Storage* db_;  // `db_` is owned by the creator of the instance of `Controller`.
+  const size_t recovered_records_;
   Cruncher cruncher_;
-  typename sherlock::StreamInstance<std::unique_ptr<schema::Base>>::template ListenerScope<Cruncher>
-      cruncher_scope_;
-  MixpanelUploader mixpanel_uploader_;
-  typename sherlock::StreamInstance<std::unique_ptr<schema::Base>>::template ListenerScope<MixpanelUploader>
-      mixpanel_uploader_scope_;
+  fanout::ListenerScope cruncher_scope_;
+  analytics::Exporter exporter_;
+  fanout::ListenerScope exporter_scope_;
+  routes::DemoRoutes routes_;
 
   Controller() = delete;
 };
 
-int main() {
+// Five letters, "MSB" first.
+inline std::string DemoIdFromSalt(uint64_t salt) {
+  std::string demo_id;
+  for (size_t i = 0; i < 5; ++i) {
+    demo_id = std::string(1, ('a' + (salt % 26))) + demo_id;
+    salt /= 26;
+  }
+  return demo_id;
+}
+
+// Whether `demo_id` is of the form `DemoIdFromSalt()` makes up: five lowercase letters.
+inline bool IsValidDemoId(const std::string& demo_id) {
+  if (demo_id.length() != 5) {
+    return false;
+  }
+  for (const char c : demo_id) {
+    if (c < 'a' || c > 'z') {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Owns the demos. Hibernates the ones that have not been accessed for a while, and have no streams open, as
+// hibernating would cut their viewers off: their records are on the disk
+// already, in `--data_dir`, so hibernating a demo is tearing down its threads, streams and snapshots.
+// Its routes stay with the dispatcher, which hands the requests to them to the handler that wakes the demo up.
+// Waking up replays the stored records, as does picking up the demos of the previous run of the server.
+//
+// Keeps `pool_size` demos seeded, with their first image rendered, for `Claim()` to hand out right away.
+// The pool is refilled in the background. The demos in the pool are not persisted until they are claimed,
+// and their files are removed if they never are.
+//
+// A fork of a demo shares the records of its parent up to the point of the fork, and starts from the state
+// of its parent's `Cruncher`. Waking up a fork wakes up its parent, if needed, to share its records again.
+//
+// The lock of the registry is only held to look the demos up and to change their state. The demos are started,
+// hibernated and served with it released; the requests to a demo being started or hibernated wait for that one.
+class DemoRegistry final {
+ public:
+  typedef std::function<bool(const std::string& demo_id)> id_filter_type;
+
+  DemoRegistry(int port,
+               const std::string& data_dir,
+               std::chrono::seconds hibernate_after,
+               size_t pool_size = 0,
+               id_filter_type id_filter = [](const std::string&) { return true; })
+      : port_(port),
+        dispatcher_(routes::Dispatcher::ForPort(port)),
+        data_dir_(data_dir),
+        hibernate_after_(data_dir.empty() ? std::chrono::seconds(0) : hibernate_after),
+        pool_size_(pool_size),
+        id_filter_(id_filter) {
+    if (!data_dir_.empty()) {
+      FileSystem::ScanDir(data_dir_, [this](const std::string& file_name) {
+        const std::string suffix = ".demo";
+        if (file_name.length() > suffix.length() &&
+            file_name.compare(file_name.length() - suffix.length(), suffix.length(), suffix) == 0) {
+          const std::string demo_id = file_name.substr(0, file_name.length() - suffix.length());
+          std::istringstream info(FileSystem::ReadFileAsString(FileSystem::JoinPath(data_dir_, file_name)));
+          Demo& demo = demos_[demo_id];
+          std::getline(info, demo.mixpanel_token);
+          std::getline(info, demo.sinks);
+          std::string fork_records;
+          std::getline(info, demo.parent_id);
+          std::getline(info, fork_records);
+          demo.fork_records = static_cast<size_t>(atoll(fork_records.c_str()));
+          dispatcher_.Retain(demo_id, Wake(demo_id));
+        }
+      });
+      // The routes of a demo are known once one is started. Starting one registers them for all the demos.
+      if (!demos_.empty() && !dispatcher_.SubRoutesCount()) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        Start(lock, demos_.begin()->first, demos_.begin()->second);
+        Hibernate(lock, demos_.begin()->first, demos_.begin()->second);
+      }
+      std::cerr << "Picked up " << demos_.size() << " demos from `" << data_dir_ << "`.\n";
+    }
+    if (hibernate_after_.count()) {
+      hibernator_thread_ = std::thread(&DemoRegistry::HibernatorThread, this);
+    }
+    if (pool_size_) {
+      pool_thread_ = std::thread(&DemoRegistry::PoolThread, this);
+    }
+  }
+
+  ~DemoRegistry() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    condition_.notify_all();
+    if (hibernator_thread_.joinable()) {
+      hibernator_thread_.join();
+    }
+    if (pool_thread_.joinable()) {
+      pool_thread_.join();
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& demo_id : pool_) {
+      Demo& demo = demos_[demo_id];
+      demo.controller.reset();
+      demo.storage.reset();
+      RemoveFiles(demo_id);
+    }
+  }
+
+  // Returns `false` if the demo with this ID exists already, or if it is not an ID this server could make up.
+  // The ID names the files of the demo, so an arbitrary one is never taken as is.
+  bool Create(const std::string& demo_id, const std::string& mixpanel_token, const std::string& sinks) {
+    if (!IsValidDemoId(demo_id) || !id_filter_(demo_id)) {
+      return false;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (demos_.count(demo_id)) {
+      return false;
+    }
+    Demo& demo = demos_[demo_id];
+    Persist(demo_id, demo, mixpanel_token, sinks);
+    Start(lock, demo_id, demo);
+    return true;
+  }
+
+  // Hands out a demo from the pool, or creates one if the pool is empty. Returns its ID.
+  std::string Claim(const std::string& mixpanel_token, const std::string& sinks) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (pool_.empty()) {
+      const std::string demo_id = MakeUpDemoId();
+      std::cerr << '@' << demo_id << " The pool is empty, building inline." << std::endl;
+      Demo& demo = demos_[demo_id];
+      Persist(demo_id, demo, mixpanel_token, sinks);
+      Start(lock, demo_id, demo);
+      return demo_id;
+    }
+    const std::string demo_id = pool_.front();
+    std::cerr << '@' << demo_id << " Claimed from the pool." << std::endl;
+    pool_.pop_front();
+    condition_.notify_all();
+    Demo& demo = demos_[demo_id];
+    demo.pooled = false;
+    Persist(demo_id, demo, mixpanel_token, sinks);
+    demo.controller->AttachSinks(mixpanel_token, sinks);
+    // Idle since now, not since it has been put into the pool.
+    demo.started_ms = static_cast<uint64_t>(Now());
+    return demo_id;
+  }
+
+  // Forks the demo into a new one, which starts from all the records of its parent so far. Returns the ID of
+  // the new demo, or an empty string if there is no such parent.
+  std::string Fork(const std::string& parent_id, const std::string& mixpanel_token, const std::string& sinks) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    const auto found = demos_.find(parent_id);
+    if (found == demos_.end() || found->second.pooled) {
+      return "";
+    }
+    Demo& parent = Running(lock, parent_id);
+    const auto begin = std::chrono::steady_clock::now();
+    // The parent is not hibernated while its state is being read, which waits for its records to be replayed.
+    ++parent.serving;
+    lock.unlock();
+    const Cruncher::State state = parent.controller->ForkState();
+    lock.lock();
+    const std::string demo_id = MakeUpDemoId();
+    Demo& demo = demos_[demo_id];
+    demo.parent_id = parent_id;
+    demo.fork_records = state.records;
+    Persist(demo_id, demo, mixpanel_token, sinks);
+    const segmented_log::SharedEntries base = parent.storage->SharedPrefix(demo.fork_records);
+    --parent.serving;
+    condition_.notify_all();
+    Start(lock, demo_id, demo, base, &state);
+    std::cerr << '@' << demo_id << " Forked from @" << parent_id << ", " << demo.fork_records << " records, in "
+              << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count()
+              << "ms." << std::endl;
+    return demo_id;
+  }
+
+  struct Stats {
+    size_t active = 0;
+    size_t hibernated = 0;
+    size_t pooled = 0;
+  };
+
+  Stats GetStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats;
+    for (const auto& kv : demos_) {
+      ++(kv.second.pooled ? stats.pooled : (kv.second.controller ? stats.active : stats.hibernated));
+    }
+    return stats;
+  }
+
+ private:
+  struct Demo {
+    std::string mixpanel_token;
+    std::string sinks;
+    std::unique_ptr<db::Storage> storage;
+    std::unique_ptr<Controller> controller;
+    // While running, when the demo has been started, in epoch milliseconds.
+    uint64_t started_ms = 0;
+    // While running, when the demo has last been seen with its streams open, in epoch milliseconds.
+    uint64_t watched_ms = 0;
+    // While in the pool, or being prepared for it.
+    bool pooled = false;
+    // For a fork, the demo it has been forked from, and the number of the records of the parent it shares.
+    std::string parent_id;
+    size_t fork_records = 0;
+    // Set while the demo is being started or hibernated with `mutex_` released. The others wait for it.
+    bool transition = false;
+    // The requests being dispatched to the running demo with `mutex_` released. Hibernating waits for them.
+    size_t serving = 0;
+  };
+
+  routes::handler_type Wake(const std::string& demo_id) {
+    return [this, demo_id](Request r) { Serve(demo_id, std::move(r)); };
+  }
+
+  // All the below should be called with `mutex_` locked. The ones given the `lock` release it meanwhile.
+  std::string MakeUpDemoId() {
+    std::string demo_id;
+    for (uint64_t salt = std::max(static_cast<uint64_t>(Now()), last_salt_ + 1); demo_id.empty(); ++salt) {
+      demo_id = DemoIdFromSalt(salt);
+      if (demos_.count(demo_id) || !id_filter_(demo_id)) {
+        demo_id.clear();
+      }
+      last_salt_ = salt;
+    }
+    return demo_id;
+  }
+
+  void Persist(const std::string& demo_id,
+               Demo& demo,
+               const std::string& mixpanel_token,
+               const std::string& sinks) {
+    demo.mixpanel_token = mixpanel_token;
+    demo.sinks = sinks;
+    if (!data_dir_.empty()) {
+      std::string info = mixpanel_token + '\n' + sinks + '\n';
+      if (!demo.parent_id.empty()) {
+        info += demo.parent_id + '\n' + std::to_string(demo.fork_records) + '\n';
+      }
+      FileSystem::WriteStringToFile(info, FileSystem::JoinPath(data_dir_, demo_id + ".demo").c_str());
+    }
+    dispatcher_.Retain(demo_id, Wake(demo_id));
+  }
+
+  // Waits for the start or the hibernation of the demo in progress, if any.
+  Demo& Settled(std::unique_lock<std::mutex>& lock, const std::string& demo_id) {
+    Demo& demo = demos_[demo_id];
+    condition_.wait(lock, [&demo]() { return !demo.transition; });
+    return demo;
+  }
+
+  // Wakes up the demo if it is hibernated, and its parent first, if it is a fork.
+  Demo& Running(std::unique_lock<std::mutex>& lock, const std::string& demo_id) {
+    while (true) {
+      Demo& demo = Settled(lock, demo_id);
+      if (demo.controller) {
+        return demo;
+      }
+      if (!demo.parent_id.empty() && !demos_[demo.parent_id].controller) {
+        Running(lock, demo.parent_id);
+        continue;
+      }
+      std::cerr << '@' << demo_id << " Waking up.\n";
+      segmented_log::SharedEntries base;
+      if (!demo.parent_id.empty()) {
+        base = demos_[demo.parent_id].storage->SharedPrefix(demo.fork_records);
+      }
+      Start(lock, demo_id, demo, base);
+    }
+  }
+
+  // Builds the `Storage` and the `Controller` of the demo with `lock` released, which replays the records.
+  void Start(std::unique_lock<std::mutex>& lock,
+             const std::string& demo_id,
+             Demo& demo,
+             segmented_log::SharedEntries base = segmented_log::SharedEntries(),
+             const Cruncher::State* fork_from = nullptr) {
+    demo.transition = true;
+    const std::string mixpanel_token = demo.mixpanel_token;
+    const std::string sinks = demo.sinks;
+    lock.unlock();
+    std::unique_ptr<db::Storage> storage;
+    std::unique_ptr<Controller> controller;
+    try {
+      storage.reset(new db::Storage(port_, demo_id, data_dir_, base));
+      controller.reset(new Controller(port_, demo_id, mixpanel_token, sinks, storage.get(), fork_from));
+    } catch (...) {
+      lock.lock();
+      demo.transition = false;
+      condition_.notify_all();
+      throw;
+    }
+    lock.lock();
+    demo.storage = std::move(storage);
+    demo.controller = std::move(controller);
+    demo.started_ms = static_cast<uint64_t>(Now());
+    demo.transition = false;
+    condition_.notify_all();
+  }
+
+  // Tears the demo down with `lock` released, once the requests being dispatched to it are done.
+  void Hibernate(std::unique_lock<std::mutex>& lock, const std::string& demo_id, Demo& demo) {
+    demo.transition = true;
+    condition_.wait(lock, [&demo]() { return !demo.serving; });
+    std::unique_ptr<db::Storage> storage = std::move(demo.storage);
+    std::unique_ptr<Controller> controller = std::move(demo.controller);
+    lock.unlock();
+    // The requests that the dispatcher has handed to the demo while it is being torn down wait for it
+    // to be woken up, as do all the further ones.
+    const routes::handler_type wake = Wake(demo_id);
+    storage->Routes().Close(wake);
+    controller->Close(wake);
+    controller.reset();
+    storage.reset();
+    lock.lock();
+    demo.transition = false;
+    condition_.notify_all();
+  }
+
+  // The files of the `Storage` and of the streams of the `Cruncher` of the demo.
+  // The tick streams are no longer persisted, their files are only left by the earlier versions.
+  void RemoveFiles(const std::string& demo_id) {
+    if (!data_dir_.empty()) {
+      for (const std::string suffix : {"_db", "_u_total", "_q_total", "_e_15sec", "_image"}) {
+        segmented_log::Log::RemoveFiles(data_dir_, demo_id + suffix);
+      }
+    }
+  }
+
+  // Wakes up the demo if it is hibernated, and serves the request with `mutex_` released.
+  void Serve(const std::string& demo_id, Request r) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    Demo& demo = Running(lock, demo_id);
+    ++demo.serving;
+    lock.unlock();
+    bool dispatched = false;
+    try {
+      dispatched = demo.storage->Routes().Dispatch(r) || demo.controller->Dispatch(r);
+    } catch (...) {
+      lock.lock();
+      --demo.serving;
+      condition_.notify_all();
+      throw;
+    }
+    lock.lock();
+    --demo.serving;
+    condition_.notify_all();
+    lock.unlock();
+    if (!dispatched) {
+      r("", HTTPResponseCode.NotFound);
+    }
+  }
+
+  // A demo with its streams open is being watched, and counts as accessed for as long as they stay open,
+  // however long ago they have been requested.
+  uint64_t LastAccessMs(const Demo& demo) const {
+    return std::max(std::max(demo.started_ms, demo.watched_ms),
+                    std::max(demo.storage->Routes().LastRequestMs(), demo.controller->LastRequestMs()));
+  }
+
+  void HibernatorThread() {
+    const uint64_t idle_ms = static_cast<uint64_t>(hibernate_after_.count()) * 1000u;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_) {
+      const std::chrono::seconds period = hibernate_after_ / 4 + std::chrono::seconds(1);
+      condition_.wait_for(lock, period < std::chrono::seconds(60) ? period : std::chrono::seconds(60));
+      const uint64_t now = static_cast<uint64_t>(Now());
+      for (auto& kv : demos_) {
+        if (kv.second.controller && kv.second.controller->OpenSubscriptions()) {
+          kv.second.watched_ms = now;
+        } else if (!stop_ && !kv.second.pooled && !kv.second.transition && kv.second.controller &&
+                   LastAccessMs(kv.second) + idle_ms < now) {
+          std::cerr << '@' << kv.first << " Hibernating.\n";
+          Hibernate(lock, kv.first, kv.second);
+        }
+      }
+    }
+  }
+
+  // Builds the demos for the pool one by one, seeding them and waiting for their first images unlocked.
+  void PoolThread() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_) {
+      if (pool_.size() >= pool_size_) {
+        condition_.wait(lock);
+        continue;
+      }
+      const std::string demo_id = MakeUpDemoId();
+      Demo& demo = demos_[demo_id];
+      demo.pooled = true;
+      lock.unlock();
+      const auto begin = std::chrono::steady_clock::now();
+      RemoveFiles(demo_id);
+      std::unique_ptr<db::Storage> storage(new db::Storage(port_, demo_id, data_dir_));
+      std::unique_ptr<Controller> controller(new Controller(port_, demo_id, "", "", storage.get()));
+      controller->WaitForImage();
+      std::cerr << '@' << demo_id << " Pooled in "
+                << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count()
+                << "ms." << std::endl;
+      lock.lock();
+      demo.storage = std::move(storage);
+      demo.controller = std::move(controller);
+      demo.started_ms = static_cast<uint64_t>(Now());
+      pool_.push_back(demo_id);
+    }
+  }
+
+  const int port_;
+  routes::Dispatcher& dispatcher_;
+  const std::string data_dir_;
+  const std::chrono::seconds hibernate_after_;
+  const size_t pool_size_;
+  const id_filter_type id_filter_;
+
+  std::mutex mutex_;
+  std::map<std::string, Demo> demos_;
+  std::deque<std::string> pool_;
+  uint64_t last_salt_ = 0;
+
+  std::condition_variable condition_;
+  bool stop_ = false;
+  std::thread hibernator_thread_;
+  std::thread pool_thread_;
+
+  DemoRegistry(const DemoRegistry&) = delete;
+  void operator=(const DemoRegistry&) = delete;
+};
+
+// Resident set size and the number of threads of this process, from `/proc/self/status`.
+inline std::string ProcessStatus() {
+  std::ifstream status("/proc/self/status");
+  std::string result;
+  std::string line;
+  while (std::getline(status, line)) {
+    if (!line.compare(0, 6, "VmRSS:") || !line.compare(0, 8, "Threads:")) {
+      result += line + '\n';
+    }
+  }
+  return result;
+}
+
+// Starts a copy of this binary with the given command line, to be stopped along with this process.
+inline pid_t StartWorker(const std::vector<std::string>& args) {
+  const pid_t pid = ::fork();
+  if (!pid) {
+    ::prctl(PR_SET_PDEATHSIG, SIGTERM);
+    std::vector<char*> argv;
+    for (const auto& arg : args) {
+      argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    ::execv(argv[0], &argv[0]);
+    std::cerr << "Can not start `" << args[0] << "`.\n";
+    ::_exit(1);
+  }
+  return pid;
+}
+
+// The body of `path` of the worker listening on `port`, or an empty string if it does not respond.
+inline std::string WorkerStatus(int port, const std::string& path) {
+  try {
+    http_client::Client client(Printf("http://127.0.0.1:%d", port));
+    const http_client::Response response = client.Get(path);
+    return response.code == 200 ? response.body : "";
+  } catch (const http_client::Error&) {
+    return "";
+  }
+}
+
+// The numbers of the active demos of the workers, polled in the background for `/new` not to wait for them.
+// A demo sent to a worker counts towards its load until the next poll.
+class WorkerLoads final {
+ public:
+  explicit WorkerLoads(const std::vector<int>& ports)
+      : ports_(ports), active_(ports.size(), 0), poller_(&WorkerLoads::PollerThread, this) {}
+
+  ~WorkerLoads() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    condition_.notify_all();
+    poller_.join();
+  }
+
+  // The index of the least loaded of the workers that respond, counting one more demo towards its load,
+  // or 0 if none of them respond.
+  size_t TakeLeastLoaded() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t least_loaded = 0;
+    int least_load = -1;
+    for (size_t i = 0; i < active_.size(); ++i) {
+      const int load = active_[i];
+      if (load >= 0 && (least_load < 0 || load < least_load)) {
+        least_loaded = i;
+        least_load = load;
+      }
+    }
+    if (least_load >= 0) {
+      ++active_[least_loaded];
+    }
+    return least_loaded;
+  }
+
+ private:
+  void PollerThread() {
+    const std::string prefix = "Active: ";
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_) {
+      for (size_t i = 0; i < ports_.size() && !stop_; ++i) {
+        lock.unlock();
+        const std::string status = WorkerStatus(ports_[i], "/demos");
+        const int load =
+            !status.compare(0, prefix.length(), prefix) ? atoi(status.c_str() + prefix.length()) : -1;
+        lock.lock();
+        active_[i] = load;
+      }
+      condition_.wait_for(lock, std::chrono::seconds(1), [this]() { return stop_; });
+    }
+  }
+
+  const std::vector<int> ports_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  bool stop_ = false;
+  std::vector<int> active_;  // -1 for the workers that do not respond.
+  std::thread poller_;
+
+  WorkerLoads(const WorkerLoads&) = delete;
+  void operator=(const WorkerLoads&) = delete;
+};
+
+// Runs `--workers` copies of this binary on the ports following `--port`, each with a subdirectory of
+// `--data_dir` of its own, and forwards the requests to them. The requests of each demo go to the worker
+// its `demo_id` hashes to. So does `/new` with a `demo_id` of choice; without one, it goes to the least loaded
+// worker, which only makes up the IDs that hash to itself, for its demos to be ready in its pool.
+// `/demos`, `/hosts` and `/static_stats` are the sums over all the workers, served on the port after theirs.
+int RunRouter(const std::vector<std::string>& args) {
+  const size_t workers = static_cast<size_t>(FLAGS_workers);
+  const router::HashRing ring(workers);
+  const auto worker_port = [](size_t worker) { return FLAGS_port + 1 + static_cast<int>(worker); };
+
+  std::vector<std::vector<std::string>> worker_args(workers);
+  for (size_t i = 0; i < workers; ++i) {
+    worker_args[i].push_back(args[0]);
+    for (size_t j = 1; j < args.size(); ++j) {
+      bool overridden = false;
+      for (const std::string flag : {"--port", "--workers", "--data_dir", "--worker_of"}) {
+        if (args[j] == flag) {
+          overridden = true;
+          ++j;  // Skip the value too.
+        } else if (!args[j].compare(0, flag.length() + 1, flag + '=')) {
+          overridden = true;
+        }
+      }
+      if (!overridden) {
+        worker_args[i].push_back(args[j]);
+      }
+    }
+    worker_args[i].push_back("--port=" + std::to_string(worker_port(i)));
+    worker_args[i].push_back("--data_dir=" +
+                             (FLAGS_data_dir.empty() ? "" : FLAGS_data_dir + '/' + std::to_string(i)));
+    worker_args[i].push_back("--worker_of=" + std::to_string(i) + '/' + std::to_string(workers));
+  }
+  std::map<pid_t, size_t> pids;
+  for (size_t i = 0; i < workers; ++i) {
+    pids[StartWorker(worker_args[i])] = i;
+  }
+
+  std::vector<int> ports;
+  for (size_t i = 0; i < workers; ++i) {
+    ports.push_back(worker_port(i));
+  }
+  WorkerLoads loads(ports);
+
+  // The status pages sum up the ones of all the workers, served by the router on the port after theirs.
+  const int status_port = worker_port(workers);
+  for (const std::string path : {"/demos", "/hosts", "/static_stats"}) {
+    HTTP(status_port).Register(path, [ports, path](Request r) {
+      std::vector<std::string> bodies;
+      for (const int port : ports) {
+        const std::string body = WorkerStatus(port, path);
+        if (!body.empty()) {
+          bodies.push_back(body);
+        }
+      }
+      r(router::SumCounters(bodies) + Printf("Workers responding: %d of %d\n",
+                                             static_cast<int>(bodies.size()),
+                                             static_cast<int>(ports.size())),
+        HTTPResponseCode.OK,
+        "text/plain");
+    });
+  }
+
+  router::Proxy proxy(FLAGS_port, [&](const std::string& method, std::string& path) {
+    const std::string demo_id = router::DemoIdOf(path);
+    if (!demo_id.empty()) {
+      path = routes::Routed(path);
+      return worker_port(ring.WorkerOf(demo_id));
+    }
+    if (method == "POST" && (path == "/new" || !path.compare(0, 5, "/new?"))) {
+      // A `demo_id` of choice lives on the worker it hashes to, any other one on the least loaded worker.
+      const std::string demo_id = bricks::net::url::URL(path).query["demo_id"];
+      if (!demo_id.empty()) {
+        return worker_port(ring.WorkerOf(demo_id));
+      }
+      return worker_port(loads.TakeLeastLoaded());
+    }
+    // The fork lives along with its parent, as the IDs the worker makes up hash to the worker itself.
+    if (method == "POST" && !path.compare(0, 6, "/fork?")) {
+      return worker_port(ring.WorkerOf(bricks::net::url::URL(path).query["demo_id"]));
+    }
+    if (path == "/demos" || path == "/hosts" || path == "/static_stats") {
+      return status_port;
+    }
+    // The landing page and the static files, the same in all the workers.
+    return worker_port(0);
+  });
+  std::cerr << "Routing port " << FLAGS_port << " to " << workers << " workers.\n";
+
+  // Restart the workers that exit.
+  while (true) {
+    int status;
+    const pid_t pid = ::wait(&status);
+    if (pid < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return 1;
+    }
+    const auto cit = pids.find(pid);
+    if (cit != pids.end()) {
+      const size_t worker = cit->second;
+      pids.erase(cit);
+      std::cerr << "Worker " << worker << " has exited, restarting.\n";
+      ::sleep(1);
+      pids[StartWorker(worker_args[worker])] = worker;
+    }
+  }
+}
+
+// The benchmarks include this file for the internals of the demo, and run their own `main()`.
+#ifndef AGREE_DISAGREE_DEMO_NO_MAIN
+
+int main(int argc, char** argv) {
+  const std::vector<std::string> args(argv, argv + argc);
+  ParseDFlags(&argc, &argv);
+
   const int port = FLAGS_port;
 
+  if (!FLAGS_data_dir.empty()) {
+    ::mkdir(FLAGS_data_dir.c_str(), 0755);
+  }
+
+  if (FLAGS_workers > 0) {
+    return RunRouter(args);
+  }
+
+  // The worker of the router only hands out the demos that the router would send the requests of to it.
+  DemoRegistry::id_filter_type id_filter = [](const std::string&) { return true; };
+  const size_t slash = FLAGS_worker_of.find('/');
+  const int ring_size = (slash != std::string::npos) ? atoi(FLAGS_worker_of.c_str() + slash + 1) : 0;
+  if (ring_size > 0) {
+    const size_t worker = static_cast<size_t>(atoi(FLAGS_worker_of.c_str()));
+    const std::shared_ptr<router::HashRing> ring = std::make_shared<router::HashRing>(ring_size);
+    id_filter = [ring, worker](const std::string& demo_id) { return ring->WorkerOf(demo_id) == worker; };
+    // The router rewrites the paths of the demos into the one path served by the dispatcher.
+    routes::Dispatcher::ForPort(port).ServeRouted();
+  }
+  DemoRegistry registry(port,
+                        FLAGS_data_dir,
+                        std::chrono::seconds(FLAGS_hibernate_after_seconds),
+                        static_cast<size_t>(std::max(0, FLAGS_demo_pool_size)),
+                        id_filter);
+
   // Create and redirect to a new demo when POST-ed onto `/new`.
-  HTTP(port).Register("/new", [&port](Request r) {
+  HTTP(port).Register("/new", [&registry](Request r) {
     if (r.method == "POST") {
       try {
+        const auto begin = std::chrono::steady_clock::now();
         using bricks::net::url::URL;
         std::cerr << "New demo requested: \"" << r.body << "\"" << std::endl;
         // HACK(sompylasar): Parse the URL-encoded body as a query-string.
         URL body_parsed = URL("/?" + r.body);
         std::string mixpanel_token = bricks::strings::Trim(body_parsed.query.get("mixpanel_token", ""));
         std::cerr << "Mixpanel token: \"" << mixpanel_token << "\"" << std::endl;
-        uint64_t salt = static_cast<uint64_t>(Now());
-        // Randomly generated `demo_id` w/o safety checking. -- D.K.
-        std::string demo_id = "";
-        for (size_t i = 0; i < 5; ++i) {
-          demo_id = std::string(1, ('a' + (salt % 26))) + demo_id;  // "MSB" first ordering.
-          salt /= 26;
+        std::string sinks = bricks::strings::Trim(body_parsed.query.get("sinks", FLAGS_analytics_sinks));
+        std::cerr << "Analytics sinks: \"" << sinks << "\"" << std::endl;
+        // A `demo_id` of choice, or a randomly generated one of a demo from the pool.
+        std::string demo_id = r.url.query["demo_id"];
+        if (!demo_id.empty()) {
+          if (!IsValidDemoId(demo_id)) {
+            r("INVALID DEMO ID\n", HTTPResponseCode.BadRequest);
+            return;
+          }
+          if (!registry.Create(demo_id, mixpanel_token, sinks)) {
+            r("DEMO ID NOT AVAILABLE\n", HTTPResponseCode.BadRequest);
+            return;
+          }
+        } else {
+          demo_id = registry.Claim(mixpanel_token, sinks);
         }
-        auto demo = new db::Storage(port, demo_id);                             // Lives forever. -- D.K.
-        auto controller = new Controller(port, demo_id, mixpanel_token, demo);  // Lives forever. -- D.K.
-        static_cast<void>(controller);
+        std::cerr << '@' << demo_id << " Created in "
+                  << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count()
+                  << "ms." << std::endl;
         r("", HTTPResponseCode.Found, "text/html", HTTPHeaders().Set("Location", "/" + demo_id + "/a/"));
       } catch (const bricks::Exception& e) {
         std::cerr << "Demo creation exception: " << e.What() << std::endl;
@@ -884,16 +1838,75 @@ int main() {
     }
   });
 
-  // Landing page.
-  const std::string dir = "static/";
-  HTTP(port).ServeStaticFilesFrom(dir, "/static/");
-  HTTP(port).Register(
-      "/",
-      new bricks::net::api::StaticFileServer(
-          bricks::FileSystem::ReadFileAsString(FileSystem::JoinPath(dir, "landing.html")), "text/html"));
+  // Fork the demo `?demo_id=` into a new one and redirect to it, when POST-ed onto `/fork`.
+  // Takes the same `mixpanel_token` and `sinks` in the body as `/new` does.
+  HTTP(port).Register("/fork", [&registry](Request r) {
+    if (r.method == "POST") {
+      const std::string parent_id = r.url.query["demo_id"];
+      bricks::net::url::URL body_parsed("/?" + r.body);
+      const std::string demo_id =
+          registry.Fork(parent_id,
+                        bricks::strings::Trim(body_parsed.query.get("mixpanel_token", "")),
+                        bricks::strings::Trim(body_parsed.query.get("sinks", FLAGS_analytics_sinks)));
+      if (demo_id.empty()) {
+        r("DEMO NOT FOUND\n", HTTPResponseCode.NotFound);
+      } else {
+        r("", HTTPResponseCode.Found, "text/html", HTTPHeaders().Set("Location", "/" + demo_id + "/a/"));
+      }
+    } else {
+      r(bricks::net::DefaultMethodNotAllowedMessage(), HTTPResponseCode.MethodNotAllowed, "text/html");
+    }
+  });
+
+  // Landing page and static files, loaded and compressed once for all the demos.
+  const assets::Cache& static_assets = assets::Static();
+  for (const auto& asset : static_assets.List()) {
+    HTTP(port).Register("/static/" + asset, static_assets.Handler(asset));
+  }
+  HTTP(port).Register("/", static_assets.Handler("landing.html", assets::kRevalidate));
+
+  // How much the compression of the static files, and of the streams, saves, and what it costs.
+  HTTP(port).Register("/static_stats", [&static_assets](Request r) {
+    const fanout::CompressionStats& streams = fanout::TotalCompressionStats();
+    r(bricks::strings::Printf(
+          "Identity bytes: %llu\nSent bytes: %llu\nNot modified: %llu\n"
+          "Stream bytes in: %llu\nStream bytes out: %llu\nStream compression us: %llu\n",
+          static_cast<unsigned long long>(static_assets.BytesIdentity()),
+          static_cast<unsigned long long>(static_assets.BytesSent()),
+          static_cast<unsigned long long>(static_assets.RequestsNotModified()),
+          static_cast<unsigned long long>(streams.bytes_in),
+          static_cast<unsigned long long>(streams.bytes_out),
+          static_cast<unsigned long long>(streams.compression_us)),
+      HTTPResponseCode.OK,
+      "text/plain");
+  });
+
+  // How many demos are running, and what it costs.
+  HTTP(port).Register("/demos", [&registry](Request r) {
+    const DemoRegistry::Stats stats = registry.GetStats();
+    r(Printf("Active: %d\nHibernated: %d\nPooled: %d\nArena bytes: %llu\n",
+             static_cast<int>(stats.active),
+             static_cast<int>(stats.hibernated),
+             static_cast<int>(stats.pooled),
+             static_cast<unsigned long long>(arena::Arena::TotalBytesReserved())) +
+          ProcessStatus(),
+      HTTPResponseCode.OK,
+      "text/plain");
+  });
+
+  // How many streams are open via each of the data hostnames.
+  HTTP(port).Register("/hosts", [](Request r) {
+    std::string result;
+    for (const auto& host : hosts::Data().ConnectionCounts()) {
+      result += Printf("%s: %d\n", host.first.c_str(), static_cast<int>(host.second));
+    }
+    r(result, HTTPResponseCode.OK, "text/plain");
+  });
 
   std::cerr << "Serving at port " << port << ".\n";
 
   // Run forever.
   HTTP(port).Join();
 }
+
+#endif  // AGREE_DISAGREE_DEMO_NO_MAIN
@@ -0,0 +1,706 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include "../Bricks/port.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <strings.h>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../Bricks/cerealize/cerealize.h"
+#include "../Bricks/time/chrono.h"
+#include "../Bricks/net/api/api.h"
+#include "../Bricks/waitable_atomic/waitable_atomic.h"
+
+#include "compression.h"
+#include "segmented_log.h"
+
+// Serialize-once streams for HTTP subscribers.
+//
+// Sherlock serializes each entry separately for each HTTP subscriber, which does not scale
+// when hundreds of browsers watch the same dashboard. The `fanout::Stream` encodes each entry
+// into JSON exactly once, at publish time, and all subscribers' chunked responses send
+// the very same immutable buffer.
+//
+// The encoded entries are kept in a `segmented_log::Log`: given a directory, only the hot tail stays in memory,
+// and the history is spilled to disk. In-process listeners get their own copies of the entries: of the recent
+// ones as published, and of the older ones decoded back from JSON.
+//
+// Subscribers that send `Accept-Encoding: gzip` or `deflate` get the stream compressed,
+// with a per-subscriber compression context and a flush per chunk. The bytes in and out, and the time spent
+// compressing, are counted per stream, per feed, and in total.
+//
+// A `Feed` serves several streams to a subscriber over one connection, from one thread.
+namespace fanout {
+
+// The bytes compressed for the subscribers, the bytes that went out, and the time it took.
+struct CompressionStats {
+  std::atomic<uint64_t> bytes_in{0u};
+  std::atomic<uint64_t> bytes_out{0u};
+  std::atomic<uint64_t> compression_us{0u};
+};
+
+// The totals over all the streams and feeds of the process, for `/static_stats`.
+inline CompressionStats& TotalCompressionStats() {
+  static CompressionStats stats;
+  return stats;
+}
+
+// Compresses one chunk, or finishes the compressed response,
+// and counts it in the totals and in the `stream` ones, if given, which are a feed's for a `Feed`.
+inline std::string CompressChunk(compression::StreamingDeflater& deflater,
+                                 const std::string& chunk,
+                                 CompressionStats* stream,
+                                 bool finish = false) {
+  const uint64_t in = deflater.BytesIn();
+  const uint64_t out = deflater.BytesOut();
+  const auto begin = std::chrono::steady_clock::now();
+  std::string compressed = finish ? deflater.Finish() : deflater.Compress(chunk);
+  const uint64_t us = static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count());
+  for (CompressionStats* stats : {&TotalCompressionStats(), stream}) {
+    if (stats) {
+      stats->bytes_in += deflater.BytesIn() - in;
+      stats->bytes_out += deflater.BytesOut() - out;
+      stats->compression_us += us;
+    }
+  }
+  return compressed;
+}
+
+// Case-insensitive lookup of a request header. Returns an empty string if the header is not present.
+inline std::string RequestHeader(Request& r, const std::string& name) {
+  for (const auto& header : r.http_data.headers()) {
+    if (header.first.length() == name.length() && !strcasecmp(header.first.c_str(), name.c_str())) {
+      return header.second;
+    }
+  }
+  return "";
+}
+
+// At most this many entries are picked up from the log while holding its lock.
+const size_t kMaxBatchSize = 1024;
+
+// At most this many of the last entries published are kept decoded as well, for the in-process listeners.
+const size_t kMaxDecodedEntries = 4096;
+
+// Plain types are serialized as is. `Copier()` makes a copy of the entry for each in-process listener.
+template <typename T>
+struct Encoder {
+  template <typename E>
+  static std::string Encode(const E& entry, const std::string& value_name) {
+    return JSON(entry, value_name) + '\n';
+  }
+  template <typename E>
+  static std::function<T()> Copier(const E& entry) {
+    return [entry]() { return T(entry); };
+  }
+};
+
+// Polymorphic types are wrapped into `std::unique_ptr<B>`, to produce the same output as Sherlock does.
+template <typename B>
+struct Encoder<std::unique_ptr<B>> {
+  template <typename E>
+  static std::string Encode(const E& entry, const std::string& value_name) {
+    const std::unique_ptr<B> wrapper(new E(entry));
+    return JSON(wrapper, value_name) + '\n';
+  }
+  template <typename E>
+  static std::function<std::unique_ptr<B>()> Copier(const E& entry) {
+    return [entry]() { return std::unique_ptr<B>(new E(entry)); };
+  }
+};
+
+// Keeps an in-process listener subscribed to a `Stream`. The listener runs in its own thread.
+// Unsubscribes the listener and joins its thread when destroyed.
+class ListenerScope final {
+ public:
+  struct Impl {
+    std::atomic_bool stop;
+    std::function<void()> wake;
+    std::thread thread;
+    Impl() : stop(false) {}
+  };
+
+  ListenerScope() = default;
+  explicit ListenerScope(std::unique_ptr<Impl> impl) : impl_(std::move(impl)) {}
+  ListenerScope(ListenerScope&&) = default;
+
+  // Unsubscribes the listener this scope has been keeping, if any, before taking over the other one.
+  ListenerScope& operator=(ListenerScope&& rhs) {
+    if (this != &rhs) {
+      Stop();
+      impl_ = std::move(rhs.impl_);
+    }
+    return *this;
+  }
+
+  ~ListenerScope() { Stop(); }
+
+ private:
+  void Stop() {
+    if (impl_) {
+      impl_->stop = true;
+      impl_->wake();
+      impl_->thread.join();
+      impl_.reset();
+    }
+  }
+
+  std::unique_ptr<Impl> impl_;
+
+  ListenerScope(const ListenerScope&) = delete;
+  void operator=(const ListenerScope&) = delete;
+};
+
+// Counts the open subscriptions to the streams it is passed along with, such as all the streams of one demo.
+// Copies share the count.
+class Subscriptions final {
+ public:
+  Subscriptions() : count_(std::make_shared<std::atomic_size_t>(0u)) {}
+
+  size_t Count() const { return *count_; }
+
+  // The `scope` to serve a subscriber of a `Stream` or a `Feed` with. Counts one subscription for as long as
+  // the response lasts, and keeps the `inner` scope, if any, for as long too.
+  std::shared_ptr<void> Scope(std::shared_ptr<void> inner = nullptr) const {
+    return std::make_shared<Subscription>(count_, std::move(inner));
+  }
+
+ private:
+  struct Subscription {
+    const std::shared_ptr<std::atomic_size_t> count;
+    const std::shared_ptr<void> inner;
+    Subscription(std::shared_ptr<std::atomic_size_t> count, std::shared_ptr<void> inner)
+        : count(std::move(count)), inner(std::move(inner)) {
+      ++*this->count;
+    }
+    ~Subscription() { --*count; }
+  };
+
+  std::shared_ptr<std::atomic_size_t> count_;
+};
+
+// Rung by the streams on each new entry, for a thread that serves several of them to wait on.
+typedef bricks::WaitableAtomic<uint64_t> Doorbell;
+
+inline void Ring(Doorbell& doorbell) {
+  doorbell.MutableUse([](uint64_t& rings) { ++rings; });
+}
+
+// A stream as seen by a `Feed`, regardless of the type of its entries.
+class FeedSource {
+ public:
+  virtual ~FeedSource() = default;
+  // The first entry to serve for the `recent` and `n_min` URL parameters.
+  virtual size_t FirstEntry(uint64_t recent, size_t n_min, bricks::time::EPOCH_MILLISECONDS now) const = 0;
+  // Appends the encoded entries from `index` on to `batch`, advancing `index`.
+  // Returns false once the stream is terminated and all of its entries have been picked up.
+  virtual bool PickUp(size_t& index, std::vector<std::shared_ptr<const std::string>>& batch) const = 0;
+  // Has the `doorbell` rung on each new entry, and when the stream is terminated.
+  virtual void Watch(const std::shared_ptr<Doorbell>& doorbell) const = 0;
+};
+
+template <typename T>
+class Stream final {
+ public:
+  // With a non-empty `directory`, the stream is persisted into and spilled onto the files in it,
+  // and the entries written there earlier under the same `name` are recovered.
+  // With `base`, a `SharedPrefix()` of another stream, the stream starts with its entries, shared.
+  Stream(const std::string& name,
+         const std::string& value_name,
+         const std::string& directory = "",
+         segmented_log::SharedEntries base = nullptr)
+      : name_(name),
+        value_name_(value_name),
+        log_(std::make_shared<bricks::WaitableAtomic<Log>>()),
+        compression_(std::make_shared<CompressionStats>()) {
+    log_->MutableUse([&directory, &name, &base](Log& log) {
+      if (base) {
+        log.entries.SetBase(base);
+      }
+      if (!directory.empty()) {
+        log.entries.Open(directory, name);
+      }
+    });
+  }
+
+  // Wakes up all the subscribers, so that their threads end their responses and exit.
+  ~Stream() {
+    std::vector<std::shared_ptr<Doorbell>> doorbells;
+    log_->MutableUse([&doorbells](Log& log) {
+      log.terminated = true;
+      doorbells = log.Doorbells();
+    });
+    for (const auto& doorbell : doorbells) {
+      Ring(*doorbell);
+    }
+  }
+
+  // Encodes the entry once. The subscribers pick it up from their own threads.
+  // The in-process listeners get the entry as is, as long as it is among the recent ones kept in memory.
+  template <typename E>
+  void Publish(const E& entry) {
+    const uint64_t ms = static_cast<uint64_t>(entry.ExtractTimestamp());
+    std::shared_ptr<const std::string> json =
+        std::make_shared<const std::string>(Encoder<T>::Encode(entry, value_name_));
+    std::shared_ptr<const copier_type> copier = std::make_shared<const copier_type>(Encoder<T>::Copier(entry));
+    std::vector<std::shared_ptr<Doorbell>> doorbells;
+    log_->MutableUse([ms, &json, &copier, &doorbells](Log& log) {
+      log.entries.Append(ms, std::move(json));
+      log.AddDecoded(std::move(copier));
+      doorbells = log.Doorbells();
+    });
+    for (const auto& doorbell : doorbells) {
+      Ring(*doorbell);
+    }
+  }
+
+  size_t Size() const { return log_->ImmutableScopedAccessor()->entries.Size(); }
+
+  std::shared_ptr<const std::string> EncodedEntryAt(size_t index) const {
+    return log_->ImmutableScopedAccessor()->entries.Get(index);
+  }
+
+  // The last entry, encoded, or `nullptr` if there are none yet.
+  std::shared_ptr<const std::string> Latest() const {
+    std::shared_ptr<const std::string> latest;
+    log_->ImmutableUse([&latest](const Log& log) {
+      if (log.entries.Size()) {
+        latest = log.entries.Get(log.entries.Size() - 1);
+      }
+    });
+    return latest;
+  }
+
+  // Keeps only the last `entries` entries in memory, see `segmented_log::Log::Retain()`.
+  void Retain(size_t entries) {
+    log_->MutableUse([entries](Log& log) { log.entries.Retain(entries); });
+  }
+
+  // The first `n` entries, for a fork of this stream to start from.
+  segmented_log::SharedEntries SharedPrefix(size_t n) {
+    segmented_log::SharedEntries prefix;
+    log_->MutableUse([n, &prefix](Log& log) { prefix = log.entries.SharedPrefix(n); });
+    return prefix;
+  }
+
+  // Subscribes an in-process listener, starting from the entry with the index `begin`.
+  // The listener implements `bool Entry(T& entry, size_t index, size_t total)` and `void Terminate()`,
+  // and should outlive the returned scope.
+  template <typename F>
+  ListenerScope Subscribe(F& listener, size_t begin = 0) {
+    std::unique_ptr<ListenerScope::Impl> impl(new ListenerScope::Impl());
+    std::shared_ptr<log_type> log = log_;
+    impl->wake = [log]() { log->MutableUse([](Log&) {}); };
+    impl->thread = std::thread(&Stream::RunListener<F>, log, std::ref(listener), std::ref(impl->stop), begin);
+    return ListenerScope(std::move(impl));
+  }
+
+  const std::string& Name() const { return name_; }
+
+  // What the compression of the responses of this stream has saved, and cost, so far.
+  const CompressionStats& Compression() const { return *compression_; }
+
+  // This stream for a `Feed` to serve.
+  std::shared_ptr<FeedSource> Source() const { return std::make_shared<StreamSource>(log_); }
+
+  // Serves the stream over HTTP. Supports the same URL parameters the dashboard passes to Sherlock:
+  // `recent` (in milliseconds) and `n_min` to pick the starting entry, and `cap` to end the response.
+  // `since` starts from the entry with the given index instead, to continue from a known state.
+  // `compress=0` turns off the compression even if the client accepts it.
+  // The `scope`, if any, is held until the response ends, to keep track of the open connections.
+  void operator()(Request r, std::shared_ptr<void> scope = nullptr) {
+    std::thread(&Stream::ServeSubscriber, log_, compression_, std::move(r), std::move(scope)).detach();
+  }
+
+  // The URL parameters of the above, to pass on when redirecting the request.
+  static const std::vector<std::string>& URLParameters() {
+    static const std::vector<std::string> parameters = {"recent", "n_min", "cap", "since", "compress"};
+    return parameters;
+  }
+
+ private:
+  typedef std::function<T()> copier_type;
+
+  struct Log {
+    segmented_log::Log entries;
+    bool terminated = false;
+    std::vector<std::weak_ptr<Doorbell>> doorbells;
+    // The entries published by this process that are still in the memory of `entries`, up to the last
+    // `kMaxDecodedEntries`, from the index `decoded_begin` on. The older ones are parsed back from JSON.
+    std::deque<std::shared_ptr<const copier_type>> decoded;
+    size_t decoded_begin = 0;
+
+    // After the entry has been appended to `entries`.
+    void AddDecoded(std::shared_ptr<const copier_type> copier) {
+      const size_t index = entries.Size() - 1;
+      if (decoded_begin + decoded.size() != index) {
+        decoded.clear();
+        decoded_begin = index;
+      }
+      decoded.push_back(std::move(copier));
+      while (!decoded.empty() &&
+             (decoded_begin < entries.FirstInMemory() || decoded.size() > kMaxDecodedEntries)) {
+        decoded.pop_front();
+        ++decoded_begin;
+      }
+    }
+
+    // The decoded entry, or `nullptr` if it is not kept.
+    std::shared_ptr<const copier_type> Decoded(size_t index) const {
+      return (index >= decoded_begin && index - decoded_begin < decoded.size()) ? decoded[index - decoded_begin]
+                                                                                 : nullptr;
+    }
+
+    // The doorbells still in use. Forgets the rest.
+    std::vector<std::shared_ptr<Doorbell>> Doorbells() {
+      std::vector<std::shared_ptr<Doorbell>> result;
+      std::vector<std::weak_ptr<Doorbell>> alive;
+      for (const auto& weak : doorbells) {
+        if (std::shared_ptr<Doorbell> doorbell = weak.lock()) {
+          result.push_back(doorbell);
+          alive.push_back(weak);
+        }
+      }
+      doorbells.swap(alive);
+      return result;
+    }
+  };
+  typedef bricks::WaitableAtomic<Log> log_type;
+
+  class StreamSource final : public FeedSource {
+   public:
+    explicit StreamSource(std::shared_ptr<log_type> log) : log_(log) {}
+
+    size_t FirstEntry(uint64_t recent, size_t n_min, bricks::time::EPOCH_MILLISECONDS now) const override {
+      return FirstEntryToServe(*log_->ImmutableScopedAccessor(), recent, n_min, now);
+    }
+
+    bool PickUp(size_t& index, std::vector<std::shared_ptr<const std::string>>& batch) const override {
+      bool terminated = false;
+      log_->ImmutableUse([&index, &batch, &terminated](const Log& log) {
+        terminated = log.terminated;
+        index = std::max(index, log.entries.FirstAvailable());
+        for (; index < log.entries.Size() && batch.size() < kMaxBatchSize; ++index) {
+          batch.push_back(log.entries.Get(index));
+        }
+      });
+      return !terminated || !batch.empty();
+    }
+
+    void Watch(const std::shared_ptr<Doorbell>& doorbell) const override {
+      log_->MutableUse([&doorbell](Log& log) { log.doorbells.push_back(doorbell); });
+    }
+
+   private:
+    const std::shared_ptr<log_type> log_;
+  };
+
+  static size_t FirstEntryToServe(const Log& log,
+                                  uint64_t recent,
+                                  size_t n_min,
+                                  bricks::time::EPOCH_MILLISECONDS now) {
+    const size_t total = log.entries.Size();
+    const size_t first = log.entries.FirstAvailable();
+    size_t begin = first;
+    if (recent) {
+      begin = total;
+      while (begin > first && static_cast<uint64_t>(now) - log.entries.TimestampAt(begin - 1) <= recent) {
+        --begin;
+      }
+    }
+    if (total - begin < n_min) {
+      begin = std::max(first, (total > n_min) ? (total - n_min) : 0u);
+    }
+    return begin;
+  }
+
+  // Runs in a dedicated thread per subscriber. Only copies `shared_ptr`-s while holding the lock.
+  static void ServeSubscriber(std::shared_ptr<log_type> log,
+                              std::shared_ptr<CompressionStats> stats,
+                              Request r,
+                              std::shared_ptr<void> scope) {
+    static_cast<void>(scope);
+    const uint64_t recent = static_cast<uint64_t>(atoll(r.url.query["recent"].c_str()));
+    const size_t n_min = static_cast<size_t>(atoll(r.url.query["n_min"].c_str()));
+    const size_t cap = static_cast<size_t>(atoll(r.url.query["cap"].c_str()));
+    const compression::Encoding encoding =
+        (r.url.query["compress"] == "0") ? compression::Encoding::IDENTITY
+                                         : compression::NegotiateEncoding(RequestHeader(r, "Accept-Encoding"));
+    const std::string since = r.url.query["since"];
+    const bricks::time::EPOCH_MILLISECONDS now = bricks::time::Now();
+    size_t index = since.empty() ? FirstEntryToServe(*log->ImmutableScopedAccessor(), recent, n_min, now)
+                                 : static_cast<size_t>(atoll(since.c_str()));
+    size_t sent = 0;
+    std::unique_ptr<compression::StreamingDeflater> deflater;
+    try {
+      if (encoding != compression::Encoding::IDENTITY) {
+        deflater.reset(new compression::StreamingDeflater(encoding));
+      }
+      auto response = deflater ? r.connection.SendChunkedHTTPResponse(
+                                     HTTPResponseCode.OK,
+                                     "application/json; charset=utf-8",
+                                     HTTPHeaders()
+                                         .Set("Content-Encoding", compression::EncodingName(encoding))
+                                         .Set("Vary", "Accept-Encoding"))
+                               : r.connection.SendChunkedHTTPResponse();
+      std::vector<std::shared_ptr<const std::string>> batch;
+      std::string pending;
+      while (!cap || sent < cap) {
+        bool terminated = false;
+        log->Wait([index](const Log& log) { return log.terminated || index < log.entries.Size(); });
+        log->ImmutableUse([&index, &batch, &terminated](const Log& log) {
+          terminated = log.terminated;
+          index = std::max(index, log.entries.FirstAvailable());
+          for (; index < log.entries.Size() && batch.size() < kMaxBatchSize; ++index) {
+            batch.push_back(log.entries.Get(index));
+          }
+        });
+        // The entries published before the stream was terminated still go out.
+        if (terminated && batch.empty()) {
+          break;
+        }
+        for (const auto& json : batch) {
+          if (cap && sent >= cap) {
+            break;
+          }
+          if (deflater) {
+            pending += *json;
+          } else {
+            response.Send(*json);
+          }
+          ++sent;
+        }
+        batch.clear();
+        if (!pending.empty()) {
+          // Everything picked up during one wakeup goes out as one compressed chunk.
+          response.Send(CompressChunk(*deflater, pending, stats.get()));
+          pending.clear();
+        }
+      }
+      if (deflater) {
+        response.Send(CompressChunk(*deflater, "", stats.get(), true));
+      }
+    } catch (const bricks::Exception&) {
+      // The subscriber has disconnected.
+    }
+  }
+
+  // Hands the listener the entries kept decoded as copies, and parses the rest back from JSON.
+  // The entries that do not parse, such as a torn last one of a log recovered after a crash, are skipped.
+  template <typename F>
+  static void RunListener(std::shared_ptr<log_type> log,
+                          F& listener,
+                          const std::atomic_bool& stop,
+                          size_t index) {
+    std::vector<std::pair<std::shared_ptr<const std::string>, std::shared_ptr<const copier_type>>> batch;
+    bool done = false;
+    while (!done) {
+      size_t first = index;
+      size_t total = 0;
+      bool terminated = false;
+      log->Wait([&stop, index](const Log& log) {
+        return stop || log.terminated || index < log.entries.Size();
+      });
+      log->ImmutableUse([&index, &first, &batch, &total, &terminated](const Log& log) {
+        terminated = log.terminated;
+        total = log.entries.Size();
+        index = std::max(index, log.entries.FirstAvailable());
+        first = index;
+        for (; index < total && batch.size() < kMaxBatchSize; ++index) {
+          std::shared_ptr<const copier_type> copier = log.Decoded(index);
+          batch.emplace_back(copier ? nullptr : log.entries.Get(index), std::move(copier));
+        }
+      });
+      if (stop || (terminated && batch.empty())) {
+        break;
+      }
+      for (const auto& encoded_or_decoded : batch) {
+        const size_t entry_index = first++;
+        T entry;
+        if (encoded_or_decoded.second) {
+          entry = (*encoded_or_decoded.second)();
+        } else {
+          try {
+            ParseJSON(*encoded_or_decoded.first, entry);
+          } catch (const std::exception&) {
+            std::cerr << "Skipping the entry " << entry_index << " that does not parse.\n";
+            continue;
+          }
+        }
+        if (stop || !listener.Entry(entry, entry_index, total)) {
+          done = true;
+          break;
+        }
+      }
+      batch.clear();
+    }
+    listener.Terminate();
+  }
+
+  const std::string name_;
+  const std::string value_name_;
+  std::shared_ptr<log_type> log_;
+  std::shared_ptr<CompressionStats> compression_;
+
+  Stream() = delete;
+  Stream(const Stream&) = delete;
+  Stream(Stream&&) = delete;
+  void operator=(const Stream&) = delete;
+  void operator=(Stream&&) = delete;
+};
+
+// Multiplexes several streams into one chunked response, served from one thread per subscriber instead of one
+// per stream. Each line is `{"stream":"<tag>","entry":<the entry of the stream>}`.
+// Takes the same URL parameters as `Stream`, except that `since` is the comma-separated list of the indexes
+// to start from, one per stream in the order they were added, and that `cap` counts the entries of all of them.
+class Feed final {
+ public:
+  Feed() : compression_(std::make_shared<CompressionStats>()) {}
+
+  void Add(const std::string& tag, std::shared_ptr<FeedSource> source) {
+    sources_.push_back(std::make_pair("{\"stream\":\"" + tag + "\",\"entry\":", std::move(source)));
+  }
+
+  void operator()(Request r, std::shared_ptr<void> scope = nullptr) {
+    std::thread(&Feed::ServeSubscriber, sources_, compression_, std::move(r), std::move(scope)).detach();
+  }
+
+  const CompressionStats& Compression() const { return *compression_; }
+
+  static const std::vector<std::string>& URLParameters() {
+    static const std::vector<std::string> parameters = {"recent", "n_min", "cap", "since", "compress"};
+    return parameters;
+  }
+
+ private:
+  // The prefix of the tagged lines, and the stream.
+  typedef std::vector<std::pair<std::string, std::shared_ptr<FeedSource>>> sources_type;
+
+  static void ServeSubscriber(sources_type sources,
+                              std::shared_ptr<CompressionStats> stats,
+                              Request r,
+                              std::shared_ptr<void> scope) {
+    static_cast<void>(scope);
+    const uint64_t recent = static_cast<uint64_t>(atoll(r.url.query["recent"].c_str()));
+    const size_t n_min = static_cast<size_t>(atoll(r.url.query["n_min"].c_str()));
+    const size_t cap = static_cast<size_t>(atoll(r.url.query["cap"].c_str()));
+    const compression::Encoding encoding =
+        (r.url.query["compress"] == "0") ? compression::Encoding::IDENTITY
+                                         : compression::NegotiateEncoding(RequestHeader(r, "Accept-Encoding"));
+    const std::string since = r.url.query["since"];
+    const bricks::time::EPOCH_MILLISECONDS now = bricks::time::Now();
+
+    // Watch before picking the first entries, for none of the new ones to be missed.
+    const std::shared_ptr<Doorbell> doorbell = std::make_shared<Doorbell>(0u);
+    std::vector<size_t> indexes;
+    size_t since_begin = 0;
+    for (const auto& source : sources) {
+      source.second->Watch(doorbell);
+      if (since.empty()) {
+        indexes.push_back(source.second->FirstEntry(recent, n_min, now));
+      } else {
+        indexes.push_back(static_cast<size_t>(atoll(since.c_str() + since_begin)));
+        const size_t comma = since.find(',', since_begin);
+        since_begin = (comma == std::string::npos) ? since.length() : comma + 1;
+      }
+    }
+
+    size_t sent = 0;
+    std::unique_ptr<compression::StreamingDeflater> deflater;
+    try {
+      if (encoding != compression::Encoding::IDENTITY) {
+        deflater.reset(new compression::StreamingDeflater(encoding));
+      }
+      auto response = deflater ? r.connection.SendChunkedHTTPResponse(
+                                     HTTPResponseCode.OK,
+                                     "application/json; charset=utf-8",
+                                     HTTPHeaders()
+                                         .Set("Content-Encoding", compression::EncodingName(encoding))
+                                         .Set("Vary", "Accept-Encoding"))
+                               : r.connection.SendChunkedHTTPResponse();
+      std::vector<std::shared_ptr<const std::string>> batch;
+      std::string pending;
+      bool terminated = false;
+      while (!cap || sent < cap) {
+        const uint64_t rings = *doorbell->ImmutableScopedAccessor();
+        for (size_t i = 0; i < sources.size(); ++i) {
+          if (!sources[i].second->PickUp(indexes[i], batch)) {
+            terminated = true;
+          }
+          for (const auto& json : batch) {
+            if (cap && sent >= cap) {
+              break;
+            }
+            // The encoded entries end with a newline.
+            pending += sources[i].first;
+            pending.append(*json, 0, json->length() - 1);
+            pending += "}\n";
+            ++sent;
+          }
+          batch.clear();
+        }
+        if (!pending.empty()) {
+          // Everything picked up during one wakeup goes out as one chunk.
+          response.Send(deflater ? CompressChunk(*deflater, pending, stats.get()) : pending);
+          pending.clear();
+        } else if (terminated) {
+          // The entries published before the streams were terminated have all gone out.
+          break;
+        } else {
+          doorbell->Wait([rings](uint64_t current) { return current != rings; });
+        }
+      }
+      if (deflater) {
+        response.Send(CompressChunk(*deflater, "", stats.get(), true));
+      }
+    } catch (const bricks::Exception&) {
+      // The subscriber has disconnected.
+    }
+  }
+
+  sources_type sources_;
+  std::shared_ptr<CompressionStats> compression_;
+
+  Feed(const Feed&) = delete;
+  void operator=(const Feed&) = delete;
+};
+
+}  // namespace fanout
+
+#endif  // FANOUT_H
@@ -0,0 +1,139 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+#ifndef HOSTS_H
+#define HOSTS_H
+
+#include "../Bricks/port.h"
+
+#include <cctype>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../Bricks/net/api/api.h"
+
+#include "dashboard.h"
+#include "fanout.h"
+
+// The data hostnames of the dashboards, `d0..d9.<TLD>`, all resolving to this server.
+//
+// Browsers cap the number of connections per host, so the dashboard spreads its streams over the data
+// hostnames, picking them on its own. The streams are served via whichever host they arrive, and the open
+// ones are counted per data hostname, and for all the other hosts, such as the main one, together.
+namespace hosts {
+
+// The `Host` header of the request, lowercase, split into the hostname and the `:port` suffix, if any.
+inline std::pair<std::string, std::string> HostOf(Request& r) {
+  std::string host = fanout::RequestHeader(r, "Host");
+  for (char& c : host) {
+    c = static_cast<char>(std::tolower(c));
+  }
+  const size_t colon = host.find(':');
+  if (colon == std::string::npos) {
+    return std::make_pair(host, std::string());
+  }
+  return std::make_pair(host.substr(0, colon), host.substr(colon));
+}
+
+class Sharding final {
+ public:
+  explicit Sharding(const std::vector<std::string>& hostnames)
+      : hostnames_(hostnames), connections_(hostnames.size()) {}
+
+  const std::vector<std::string>& Hostnames() const { return hostnames_; }
+
+  // Serves the request with `stream`, counting it towards the host it has come via for as long as it is open.
+  // The streams served are counted in `subscriptions` as well.
+  template <typename S>
+  std::function<void(Request)> Handler(S& stream,
+                                       fanout::Subscriptions subscriptions = fanout::Subscriptions()) {
+    return [this, &stream, subscriptions](Request r) {
+      const size_t index = IndexOf(HostOf(r).first);
+      stream(std::move(r), subscriptions.Scope(std::make_shared<Connection>(*this, index)));
+    };
+  }
+
+  // The open streams per data hostname, followed by the ones via any other host.
+  std::vector<std::pair<std::string, size_t>> ConnectionCounts() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::pair<std::string, size_t>> result;
+    for (size_t i = 0; i < hostnames_.size(); ++i) {
+      result.emplace_back(hostnames_[i], connections_[i]);
+    }
+    result.emplace_back("other", other_connections_);
+    return result;
+  }
+
+ private:
+  // Counts an open stream, as long as it exists.
+  struct Connection {
+    Sharding& sharding;
+    const size_t index;
+    Connection(Sharding& sharding, size_t index) : sharding(sharding), index(index) {
+      sharding.Count(index, true);
+    }
+    ~Connection() { sharding.Count(index, false); }
+  };
+
+  // The index of `hostname` among the data hostnames, or their count if it is not one of them.
+  size_t IndexOf(const std::string& hostname) const {
+    size_t index = 0;
+    while (index < hostnames_.size() && hostnames_[index] != hostname) {
+      ++index;
+    }
+    return index;
+  }
+
+  void Count(size_t index, bool opened) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t& count = (index < hostnames_.size()) ? connections_[index] : other_connections_;
+    if (opened) {
+      ++count;
+    } else {
+      --count;
+    }
+  }
+
+  const std::vector<std::string> hostnames_;
+  mutable std::mutex mutex_;
+  std::vector<size_t> connections_;
+  size_t other_connections_ = 0;
+
+  Sharding(const Sharding&) = delete;
+  void operator=(const Sharding&) = delete;
+};
+
+// The one for the `dashboard::Config` of this process.
+inline Sharding& Data() {
+  static Sharding sharding(dashboard::Config::DefaultDataHostnames());
+  return sharding;
+}
+
+}  // namespace hosts
+
+#endif  // HOSTS_H
@@ -0,0 +1,508 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+#ifndef HTTP_CLIENT_H
+#define HTTP_CLIENT_H
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// An outbound HTTP/1.1 client with persistent connections, for the uploaders to external services.
+//
+// Each `Client` takes its connections from a `Pool`, which keeps the idle keep-alive connections
+// per `host:port`. By default all the clients of the process share one pool, so that all the demos reuse
+// the same few connections to the same analytics endpoint.
+//
+// `Pipeline()` writes several requests into one connection back to back, before reading any of the responses.
+// If the connection fails half way, the requests not yet responded to are only resent on a fresh one if they
+// can not have reached the server, or are `GET`-s or `HEAD`-s; otherwise `Pipeline()` returns fewer responses
+// than requests, and the caller decides whether to repeat the rest.
+//
+// Connecting, and each read or write, are bounded by the timeouts from `Options`. All errors throw `Error`.
+namespace http_client {
+
+struct Error : std::runtime_error {
+  explicit Error(const std::string& what) : std::runtime_error(what) {}
+};
+
+struct Options {
+  std::chrono::milliseconds connect_timeout = std::chrono::milliseconds(5000);
+  std::chrono::milliseconds io_timeout = std::chrono::milliseconds(10000);
+  // Idle connections kept open per `host:port`.
+  size_t max_idle_connections_per_host = 4;
+};
+
+struct Response {
+  int code = 0;
+  std::string body;
+  std::map<std::string, std::string> headers;  // The names are lowercase.
+};
+
+struct Request {
+  std::string method;
+  std::string path;
+  std::string body;
+  std::string content_type;
+  std::map<std::string, std::string> headers;
+};
+
+// `http://host[:port][/path]`. HTTPS is not supported.
+struct Endpoint {
+  std::string host;
+  int port = 80;
+  std::string path = "/";
+
+  explicit Endpoint(const std::string& url) {
+    const std::string scheme = "http://";
+    if (url.compare(0, scheme.length(), scheme)) {
+      throw Error("Only `http://` URLs are supported, not `" + url + "`.");
+    }
+    const size_t host_begin = scheme.length();
+    const size_t path_begin = std::min(url.find('/', host_begin), url.length());
+    host = url.substr(host_begin, path_begin - host_begin);
+    const size_t colon = host.rfind(':');
+    if (colon != std::string::npos) {
+      port = std::atoi(host.c_str() + colon + 1);
+      host.resize(colon);
+    }
+    if (path_begin < url.length()) {
+      path = url.substr(path_begin);
+    }
+    if (host.empty() || port <= 0) {
+      throw Error("Malformed URL `" + url + "`.");
+    }
+  }
+
+  std::string Key() const { return host + ':' + std::to_string(port); }
+};
+
+// One TCP connection, with the bytes received past the end of the last parsed response kept for the next one.
+class Connection final {
+ public:
+  Connection(const Endpoint& endpoint, const Options& options) : io_timeout_(options.io_timeout) {
+    struct addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addresses = nullptr;
+    if (::getaddrinfo(endpoint.host.c_str(), std::to_string(endpoint.port).c_str(), &hints, &addresses) ||
+        !addresses) {
+      throw Error("Can not resolve `" + endpoint.host + "`.");
+    }
+    fd_ = ::socket(addresses->ai_family, addresses->ai_socktype, addresses->ai_protocol);
+    if (fd_ < 0) {
+      ::freeaddrinfo(addresses);
+      throw Error("Can not create a socket.");
+    }
+    // Connect in the non-blocking mode, to bound the time it takes.
+    ::fcntl(fd_, F_SETFL, ::fcntl(fd_, F_GETFL, 0) | O_NONBLOCK);
+    const int result = ::connect(fd_, addresses->ai_addr, addresses->ai_addrlen);
+    ::freeaddrinfo(addresses);
+    if (result && errno != EINPROGRESS) {
+      Close();
+      throw Error("Can not connect to `" + endpoint.Key() + "`.");
+    }
+    if (result) {
+      int error = 0;
+      socklen_t error_length = sizeof(error);
+      if (!Poll(POLLOUT, options.connect_timeout) ||
+          ::getsockopt(fd_, SOL_SOCKET, SO_ERROR, &error, &error_length) || error) {
+        Close();
+        throw Error("Can not connect to `" + endpoint.Key() + "` in time.");
+      }
+    }
+    const int one = 1;
+    ::setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+
+  ~Connection() { Close(); }
+
+  // Adds the number of bytes handed to the socket to `offset`, as it goes, for the caller to tell whether
+  // any of them may have reached the server if this throws.
+  void Write(const std::string& data, size_t& offset) {
+    while (offset < data.length()) {
+      const ssize_t written = ::send(fd_, data.data() + offset, data.length() - offset, MSG_NOSIGNAL);
+      if (written > 0) {
+        offset += static_cast<size_t>(written);
+      } else if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        if (!Poll(POLLOUT, io_timeout_)) {
+          throw Error("Write timed out.");
+        }
+      } else if (written < 0 && errno == EINTR) {
+        continue;
+      } else {
+        throw Error("Write failed.");
+      }
+    }
+  }
+
+  // Reads one response, to a `HEAD` request if `head`. Sets `keep_alive` to whether the connection can be used
+  // for the next one. Skips the interim `1xx` responses, such as `100 Continue`.
+  Response ReadResponse(bool& keep_alive, bool head = false) {
+    Response response;
+    do {
+      response = ReadResponseOrInterim(keep_alive, head);
+    } while (response.code >= 100 && response.code < 200 && response.code != 101);
+    return response;
+  }
+
+  // The connections from the pool are shared by the clients with different options.
+  void SetIOTimeout(std::chrono::milliseconds io_timeout) { io_timeout_ = io_timeout; }
+
+  // Whether the idle connection has been closed by the server, or has unexpected bytes to read.
+  bool IsStale() {
+    struct pollfd p;
+    p.fd = fd_;
+    p.events = POLLIN;
+    p.revents = 0;
+    return !buffer_.empty() || ::poll(&p, 1, 0) != 0;
+  }
+
+ private:
+  Response ReadResponseOrInterim(bool& keep_alive, bool head) {
+    size_t headers_end;
+    while ((headers_end = buffer_.find("\r\n\r\n")) == std::string::npos) {
+      Fill();
+    }
+    Response response;
+    const size_t status_end = buffer_.find("\r\n");
+    const std::string status_line = buffer_.substr(0, status_end);
+    const size_t space = status_line.find(' ');
+    if (status_line.compare(0, 5, "HTTP/") || space == std::string::npos) {
+      throw Error("Malformed response: `" + status_line + "`.");
+    }
+    response.code = std::atoi(status_line.c_str() + space + 1);
+    keep_alive = !status_line.compare(0, 8, "HTTP/1.1");
+
+    bool chunked = false;
+    bool has_content_length = false;
+    size_t content_length = 0;
+    size_t line_begin = status_end + 2;
+    while (line_begin < headers_end) {
+      const size_t line_end = buffer_.find("\r\n", line_begin);
+      const size_t colon = buffer_.find(':', line_begin);
+      if (colon != std::string::npos && colon < line_end) {
+        std::string name = buffer_.substr(line_begin, colon - line_begin);
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        size_t value_begin = colon + 1;
+        while (value_begin < line_end && buffer_[value_begin] == ' ') {
+          ++value_begin;
+        }
+        std::string value = buffer_.substr(value_begin, line_end - value_begin);
+        response.headers[name] = value;
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+        if (name == "content-length") {
+          has_content_length = true;
+          content_length = static_cast<size_t>(std::strtoull(value.c_str(), nullptr, 10));
+        } else if (name == "transfer-encoding") {
+          chunked = (value.find("chunked") != std::string::npos);
+        } else if (name == "connection") {
+          if (value.find("close") != std::string::npos) {
+            keep_alive = false;
+          } else if (value.find("keep-alive") != std::string::npos) {
+            keep_alive = true;
+          }
+        }
+      }
+      line_begin = line_end + 2;
+    }
+    buffer_.erase(0, headers_end + 4);
+
+    // The responses that never have a body, whatever their headers say, per RFC 7230, section 3.3.3.
+    if (head || (response.code >= 100 && response.code < 200) || response.code == 204 || response.code == 304) {
+      if (response.code == 101) {
+        // The connection now speaks another protocol.
+        keep_alive = false;
+      }
+      return response;
+    }
+
+    if (chunked) {
+      while (true) {
+        size_t size_end;
+        while ((size_end = buffer_.find("\r\n")) == std::string::npos) {
+          Fill();
+        }
+        const size_t chunk_size = static_cast<size_t>(std::strtoull(buffer_.c_str(), nullptr, 16));
+        while (buffer_.length() < size_end + 2 + chunk_size + 2) {
+          Fill();
+        }
+        response.body.append(buffer_, size_end + 2, chunk_size);
+        buffer_.erase(0, size_end + 2 + chunk_size + 2);
+        if (!chunk_size) {
+          break;
+        }
+      }
+    } else if (has_content_length) {
+      while (buffer_.length() < content_length) {
+        Fill();
+      }
+      response.body = buffer_.substr(0, content_length);
+      buffer_.erase(0, content_length);
+    } else {
+      // The body lasts until the server closes the connection.
+      while (Fill(true)) {
+      }
+      response.body.swap(buffer_);
+      keep_alive = false;
+    }
+    return response;
+  }
+
+  bool Poll(short events, std::chrono::milliseconds timeout) {
+    struct pollfd p;
+    p.fd = fd_;
+    p.events = events;
+    p.revents = 0;
+    int result;
+    do {
+      result = ::poll(&p, 1, static_cast<int>(timeout.count()));
+    } while (result < 0 && errno == EINTR);
+    return result > 0;
+  }
+
+  // Appends more bytes from the socket to the buffer. Returns `false` on EOF if `eof_is_ok`, throws otherwise.
+  bool Fill(bool eof_is_ok = false) {
+    char chunk[16384];
+    while (true) {
+      const ssize_t received = ::recv(fd_, chunk, sizeof(chunk), 0);
+      if (received > 0) {
+        buffer_.append(chunk, static_cast<size_t>(received));
+        return true;
+      } else if (!received) {
+        if (eof_is_ok) {
+          return false;
+        }
+        throw Error("Connection closed by the server.");
+      } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        if (!Poll(POLLIN, io_timeout_)) {
+          throw Error("Read timed out.");
+        }
+      } else if (errno != EINTR) {
+        throw Error("Read failed.");
+      }
+    }
+  }
+
+  void Close() {
+    if (fd_ >= 0) {
+      ::close(fd_);
+      fd_ = -1;
+    }
+  }
+
+  int fd_ = -1;
+  std::chrono::milliseconds io_timeout_;
+  std::string buffer_;
+
+  Connection() = delete;
+  Connection(const Connection&) = delete;
+  void operator=(const Connection&) = delete;
+};
+
+// The idle keep-alive connections, per `host:port`. Thread-safe.
+class Pool final {
+ public:
+  Pool() = default;
+
+  std::unique_ptr<Connection> Acquire(const Endpoint& endpoint, const Options& options, bool& reused) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::vector<std::unique_ptr<Connection>>& idle = idle_[endpoint.Key()];
+      while (!idle.empty()) {
+        std::unique_ptr<Connection> connection(std::move(idle.back()));
+        idle.pop_back();
+        if (!connection->IsStale()) {
+          connection->SetIOTimeout(options.io_timeout);
+          reused = true;
+          return connection;
+        }
+      }
+    }
+    reused = false;
+    ++connections_opened_;
+    return std::unique_ptr<Connection>(new Connection(endpoint, options));
+  }
+
+  void Release(const Endpoint& endpoint, const Options& options, std::unique_ptr<Connection> connection) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::unique_ptr<Connection>>& idle = idle_[endpoint.Key()];
+    if (idle.size() < options.max_idle_connections_per_host) {
+      idle.push_back(std::move(connection));
+    }
+  }
+
+  size_t ConnectionsOpened() const { return connections_opened_; }
+
+  // The pool shared by all the clients of the process, unless they are given their own.
+  static Pool& Shared() {
+    static Pool pool;
+    return pool;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::map<std::string, std::vector<std::unique_ptr<Connection>>> idle_;
+  std::atomic_size_t connections_opened_{0u};
+
+  Pool(const Pool&) = delete;
+  void operator=(const Pool&) = delete;
+};
+
+class Client final {
+ public:
+  explicit Client(const std::string& url, const Options& options = Options(), Pool& pool = Pool::Shared())
+      : endpoint_(url), options_(options), pool_(pool) {}
+
+  Response Post(const std::string& body, const std::string& content_type) {
+    std::vector<Request> requests(1);
+    requests[0].method = "POST";
+    requests[0].path = endpoint_.path;
+    requests[0].body = body;
+    requests[0].content_type = content_type;
+    return std::move(Pipeline(requests)[0]);
+  }
+
+  Response Get(const std::string& path_and_query) {
+    std::vector<Request> requests(1);
+    requests[0].method = "GET";
+    requests[0].path = path_and_query;
+    return std::move(Pipeline(requests)[0]);
+  }
+
+  // Sends all the requests over one connection without waiting for the responses in between.
+  // Returns the responses in the order of the requests. If the connection fails, or is closed by the server,
+  // after some of the requests that are not safe to repeat have been written, returns the responses to the
+  // ones before them only, or throws if there are none.
+  std::vector<Response> Pipeline(const std::vector<Request>& requests) {
+    std::vector<Response> responses;
+    responses.reserve(requests.size());
+    while (responses.size() < requests.size()) {
+      bool reused = false;
+      std::unique_ptr<Connection> connection = pool_.Acquire(endpoint_, options_, reused);
+      const size_t first = responses.size();
+      size_t written = 0;
+      bool keep_alive = true;
+      try {
+        std::string data;
+        for (size_t i = first; i < requests.size(); ++i) {
+          data += Serialize(requests[i]);
+        }
+        connection->Write(data, written);
+        while (keep_alive && responses.size() < requests.size()) {
+          const bool head = (requests[responses.size()].method == "HEAD");
+          responses.push_back(connection->ReadResponse(keep_alive, head));
+        }
+      } catch (const Error&) {
+        // A reused connection may have been closed by the server while idle, and a busy one may be closed
+        // half way; retry the rest on a fresh one, unless the server may have got the requests that are not
+        // safe to repeat. A fresh connection that has not returned a single response means the server is
+        // not there.
+        if ((reused || responses.size() > first) && (!written || SafeToRepeat(requests, responses.size()))) {
+          continue;
+        }
+        if (responses.empty()) {
+          throw;
+        }
+        return responses;
+      }
+      if (keep_alive) {
+        pool_.Release(endpoint_, options_, std::move(connection));
+      } else if (responses.size() < requests.size() && !SafeToRepeat(requests, responses.size())) {
+        // The server has closed the connection with the requests past this response written into it.
+        return responses;
+      }
+    }
+    return responses;
+  }
+
+  const Endpoint& GetEndpoint() const { return endpoint_; }
+
+ private:
+  // Whether the requests from `first` on can be sent again if the server has got them already.
+  static bool SafeToRepeat(const std::vector<Request>& requests, size_t first) {
+    for (size_t i = first; i < requests.size(); ++i) {
+      if (requests[i].method != "GET" && requests[i].method != "HEAD") {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  std::string Serialize(const Request& request) const {
+    // An explicit `Host` header, for the virtual hosts, replaces the one of the endpoint.
+    std::string data = request.method + ' ' + request.path + " HTTP/1.1\r\n";
+    if (!request.headers.count("Host")) {
+      data += "Host: " + endpoint_.host;
+      if (endpoint_.port != 80) {
+        data += ':' + std::to_string(endpoint_.port);
+      }
+      data += "\r\n";
+    }
+    data += "Connection: keep-alive\r\n";
+    if (!request.content_type.empty()) {
+      data += "Content-Type: " + request.content_type + "\r\n";
+    }
+    for (const auto& header : request.headers) {
+      data += header.first + ": " + header.second + "\r\n";
+    }
+    if ((request.method != "GET" && request.method != "HEAD") || !request.body.empty()) {
+      data += "Content-Length: " + std::to_string(request.body.length()) + "\r\n";
+    }
+    data += "\r\n" + request.body;
+    return data;
+  }
+
+  const Endpoint endpoint_;
+  const Options options_;
+  Pool& pool_;
+
+  Client() = delete;
+  Client(const Client&) = delete;
+  void operator=(const Client&) = delete;
+};
+
+}  // namespace http_client
+
+#endif  // HTTP_CLIENT_H
@@ -0,0 +1,354 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// Drives load against a `demo` server running on this machine, and reports the throughput and the latencies.
+//
+// Creates the demos via `/new`, registers the users, adds the questions, then submits the answers at the
+// given rate from several threads, while the dashboard viewers load the dashboard and follow its streams.
+// The questions are picked from a Zipf distribution, and the users belong to clusters that mostly agree
+// with each other, so that the agreement image is not noise.
+//
+// With `--active_demos`, the rest of the demos stay idle, for the server to hibernate them. What the server
+// reports on `/demos` is printed after the setup and after the load.
+
+#include "../Bricks/port.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "http_client.h"
+
+#include "../Bricks/dflags/dflags.h"
+#include "../Bricks/strings/printf.h"
+
+DEFINE_int32(port, 3000, "The local port the `demo` server listens on.");
+DEFINE_int32(demos, 1, "The number of demos to create.");
+DEFINE_int32(users, 100, "The number of users per demo.");
+DEFINE_int32(questions, 50, "The number of questions per demo.");
+DEFINE_int32(threads, 8, "The number of threads submitting the answers.");
+DEFINE_double(answers_per_second, 1000.0, "The total rate of the answers, across all the demos.");
+DEFINE_double(seconds, 10.0, "For how long to submit the answers.");
+DEFINE_double(zipf_exponent, 1.1, "The exponent of the Zipf distribution of the answers over the questions.");
+DEFINE_int32(clusters, 3, "The number of clusters of like-minded users.");
+DEFINE_double(agreement, 0.8, "The probability that a user answers a question the way their cluster does.");
+DEFINE_int32(subscribers, 10, "The number of dashboard viewers per demo, each following all the streams.");
+DEFINE_int32(active_demos, 0, "Only load and view this many of the demos, or all of them if 0.");
+DEFINE_int32(seed, 42, "The random seed.");
+
+using bricks::strings::Printf;
+
+typedef std::chrono::steady_clock Clock;
+
+// The latencies of the requests, in microseconds, per endpoint.
+class Stats final {
+ public:
+  void Add(const std::string& endpoint, Clock::duration latency, bool ok) {
+    const auto us = static_cast<double>(std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+    std::lock_guard<std::mutex> lock(mutex_);
+    Endpoint& e = endpoints_[endpoint];
+    e.latencies_us.push_back(us);
+    if (!ok) {
+      ++e.errors;
+    }
+  }
+
+  void Report(double seconds) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::cout << Printf("%-16s %9s %6s %10s %10s %10s %10s\n",
+                        "endpoint",
+                        "requests",
+                        "errors",
+                        "req/sec",
+                        "p50, ms",
+                        "p99, ms",
+                        "p999, ms");
+    for (auto& kv : endpoints_) {
+      std::vector<double>& latencies = kv.second.latencies_us;
+      std::sort(latencies.begin(), latencies.end());
+      std::cout << Printf("%-16s %9d %6d %10.1lf %10.3lf %10.3lf %10.3lf\n",
+                          kv.first.c_str(),
+                          static_cast<int>(latencies.size()),
+                          static_cast<int>(kv.second.errors),
+                          static_cast<double>(latencies.size()) / seconds,
+                          1e-3 * Percentile(latencies, 0.5),
+                          1e-3 * Percentile(latencies, 0.99),
+                          1e-3 * Percentile(latencies, 0.999));
+    }
+  }
+
+ private:
+  struct Endpoint {
+    std::vector<double> latencies_us;
+    size_t errors = 0;
+  };
+
+  static double Percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+      return 0.0;
+    }
+    const size_t i = static_cast<size_t>(p * static_cast<double>(sorted.size()));
+    return sorted[i < sorted.size() ? i : sorted.size() - 1];
+  }
+
+  std::mutex mutex_;
+  std::map<std::string, Endpoint> endpoints_;
+};
+
+// The state of one demo, as the load generator sees it.
+struct Demo {
+  std::string id;
+  // For each cluster, its answer to each question, `-1`, `0` or `+1`. Index zero of the questions is unused.
+  std::vector<std::vector<int>> cluster_answers;
+};
+
+std::string URLPrefix() { return Printf("http://127.0.0.1:%d", FLAGS_port); }
+
+// Makes one request and records its latency. Returns the response, with `code` zero if it has failed.
+http_client::Response Timed(http_client::Client& client,
+                            Stats& stats,
+                            const std::string& endpoint,
+                            const http_client::Request& request) {
+  const auto begin = Clock::now();
+  http_client::Response response;
+  try {
+    response = std::move(client.Pipeline(std::vector<http_client::Request>(1, request))[0]);
+  } catch (const http_client::Error&) {
+    response.code = 0;
+  }
+  stats.Add(endpoint, Clock::now() - begin, response.code >= 200 && response.code < 400);
+  return response;
+}
+
+http_client::Request MakeRequest(const std::string& method, const std::string& path) {
+  http_client::Request request;
+  request.method = method;
+  request.path = path;
+  return request;
+}
+
+Demo CreateDemo(http_client::Client& client, Stats& stats, std::mt19937& random) {
+  http_client::Request request = MakeRequest("POST", "/new");
+  request.body = "mixpanel_token=&sinks=";
+  request.content_type = "application/x-www-form-urlencoded";
+  const http_client::Response response = Timed(client, stats, "/new", request);
+  // Redirects to `/$DEMO_ID/a/`.
+  const auto location = response.headers.find("location");
+  if (response.code != 302 || location == response.headers.end() || location->second.length() < 2) {
+    throw http_client::Error(Printf("Can not create a demo, got HTTP %d.", response.code));
+  }
+  Demo demo;
+  demo.id = location->second.substr(1, location->second.find('/', 1) - 1);
+
+  for (int i = 0; i < FLAGS_users; ++i) {
+    Timed(client, stats, "/u", MakeRequest("POST", Printf("/%s/u?uid=u%d", demo.id.c_str(), i)));
+  }
+  std::uniform_int_distribution<int> answer(-1, 1);
+  demo.cluster_answers.assign(static_cast<size_t>(std::max(FLAGS_clusters, 1)),
+                              std::vector<int>(static_cast<size_t>(FLAGS_questions) + 1, 0));
+  for (int q = 1; q <= FLAGS_questions; ++q) {
+    Timed(client, stats, "/q", MakeRequest("POST", Printf("/%s/q?text=Question%%20%d", demo.id.c_str(), q)));
+    for (auto& answers : demo.cluster_answers) {
+      answers[q] = answer(random);
+    }
+  }
+  return demo;
+}
+
+// Prints what the server reports about its demos and what they cost: active and hibernated, RSS and threads.
+void ReportServerStatus() {
+  try {
+    http_client::Client client(URLPrefix());
+    std::cout << client.Get("/demos").body;
+  } catch (const http_client::Error&) {
+    std::cout << "Can not get `/demos`.\n";
+  }
+}
+
+// Submits the answers at `rate` per second until `deadline`, spread evenly over time.
+void SubmitAnswers(
+    const std::vector<Demo>& demos, double rate, Clock::time_point deadline, int seed, Stats& stats) {
+  std::mt19937 random(seed);
+  // The cumulative Zipf distribution over the questions, the most popular first.
+  std::vector<double> cdf(static_cast<size_t>(FLAGS_questions));
+  double total = 0.0;
+  for (size_t i = 0; i < cdf.size(); ++i) {
+    total += 1.0 / std::pow(static_cast<double>(i + 1), FLAGS_zipf_exponent);
+    cdf[i] = total;
+  }
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  std::uniform_int_distribution<int> user(0, FLAGS_users - 1);
+  std::uniform_int_distribution<size_t> demo_index(0, demos.size() - 1);
+  std::uniform_int_distribution<int> any_answer(-1, 1);
+
+  http_client::Client client(URLPrefix());
+  const auto interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / rate));
+  for (auto next = Clock::now(); next < deadline; next += interval) {
+    std::this_thread::sleep_until(next);
+    const Demo& demo = demos[demo_index(random)];
+    const int u = user(random);
+    const int q = 1 + static_cast<int>(std::lower_bound(cdf.begin(), cdf.end(), uniform(random) * total) -
+                                       cdf.begin());
+    const int a = (uniform(random) < FLAGS_agreement)
+                      ? demo.cluster_answers[static_cast<size_t>(u) % demo.cluster_answers.size()][q]
+                      : any_answer(random);
+    Timed(client,
+          stats,
+          "/a/answer",
+          MakeRequest("POST", Printf("/%s/a/answer?uid=u%d&qid=%d&answer=%d", demo.id.c_str(), u, q, a)));
+  }
+}
+
+// Follows one stream until `deadline`. Records the time to the first byte, and adds up the bytes received.
+void FollowStream(
+    const std::string& path, Clock::time_point deadline, Stats& stats, std::atomic_size_t& bytes) {
+  const auto begin = Clock::now();
+  const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address;
+  std::memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(static_cast<uint16_t>(FLAGS_port));
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  const std::string request = "GET " + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+  bool first_byte = false;
+  if (fd >= 0 && !::connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) &&
+      ::send(fd, request.data(), request.length(), MSG_NOSIGNAL) == static_cast<ssize_t>(request.length())) {
+    char buffer[16384];
+    for (auto now = Clock::now(); now < deadline; now = Clock::now()) {
+      struct pollfd p{fd, POLLIN, 0};
+      const int timeout_ms =
+          static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count()) + 1;
+      if (::poll(&p, 1, timeout_ms) <= 0) {
+        continue;
+      }
+      const ssize_t received = ::recv(fd, buffer, sizeof(buffer), 0);
+      if (received <= 0) {
+        break;
+      }
+      if (!first_byte) {
+        first_byte = true;
+        stats.Add("stream", Clock::now() - begin, true);
+      }
+      bytes += static_cast<size_t>(received);
+    }
+  }
+  if (!first_byte) {
+    stats.Add("stream", Clock::now() - begin, false);
+  }
+  if (fd >= 0) {
+    ::close(fd);
+  }
+}
+
+// Loads the dashboard the way the browser does, then follows all of its streams.
+void ViewDashboard(const Demo& demo, Clock::time_point deadline, Stats& stats, std::atomic_size_t& bytes) {
+  http_client::Client client(URLPrefix());
+  for (const char* path : {"/", "/config", "/layout", "/layout/u_meta", "/layout/q_meta", "/layout/e_meta",
+                           "/layout/i_meta"}) {
+    Timed(client, stats, path, MakeRequest("GET", '/' + demo.id + path));
+  }
+  std::vector<std::thread> streams;
+  for (const char* stream : {"/layout/d/u", "/layout/d/q", "/layout/d/e", "/layout/d/i"}) {
+    streams.emplace_back(FollowStream, '/' + demo.id + stream, deadline, std::ref(stats), std::ref(bytes));
+  }
+  for (auto& thread : streams) {
+    thread.join();
+  }
+}
+
+int main(int argc, char** argv) {
+  ParseDFlags(&argc, &argv);
+
+  if (FLAGS_demos < 1 || FLAGS_users < 1 || FLAGS_questions < 1 || FLAGS_threads < 1 ||
+      FLAGS_answers_per_second <= 0) {
+    std::cerr << "Need at least one demo, user, question and thread, and a positive rate.\n";
+    return 1;
+  }
+
+  Stats setup_stats;
+  std::vector<Demo> demos;
+  {
+    std::mt19937 random(FLAGS_seed);
+    http_client::Client client(URLPrefix());
+    for (int i = 0; i < FLAGS_demos; ++i) {
+      demos.push_back(CreateDemo(client, setup_stats, random));
+      std::cerr << "Created demo `" << demos.back().id << "`.\n";
+    }
+  }
+  std::cout << "Setup:\n";
+  setup_stats.Report(1.0);
+  std::cout << "\nServer:\n";
+  ReportServerStatus();
+  if (FLAGS_active_demos > 0 && static_cast<size_t>(FLAGS_active_demos) < demos.size()) {
+    demos.resize(static_cast<size_t>(FLAGS_active_demos));
+  }
+
+  Stats stats;
+  std::atomic_size_t stream_bytes(0u);
+  const auto begin = Clock::now();
+  const auto deadline =
+      begin + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(FLAGS_seconds));
+  std::vector<std::thread> threads;
+  for (const Demo& demo : demos) {
+    for (int i = 0; i < FLAGS_subscribers; ++i) {
+      threads.emplace_back(ViewDashboard, std::cref(demo), deadline, std::ref(stats), std::ref(stream_bytes));
+    }
+  }
+  for (int i = 0; i < FLAGS_threads; ++i) {
+    threads.emplace_back(SubmitAnswers,
+                         std::cref(demos),
+                         FLAGS_answers_per_second / FLAGS_threads,
+                         deadline,
+                         FLAGS_seed + 1 + i,
+                         std::ref(stats));
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  const double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+
+  std::cout << Printf("\nLoad, %.1lf seconds:\n", seconds);
+  stats.Report(seconds);
+  std::cout << Printf("\nStreams: %.1lf KB/sec received by %d viewers.\n",
+                      1e-3 * static_cast<double>(stream_bytes) / seconds,
+                      static_cast<int>(demos.size()) * FLAGS_subscribers);
+  std::cout << "\nServer:\n";
+  ReportServerStatus();
+}
@@ -0,0 +1,200 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+#ifndef MIXPANEL_H
+#define MIXPANEL_H
+
+#include "../Bricks/port.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "analytics.h"
+#include "http_client.h"
+#include "outbox.h"
+
+#include "../Bricks/cerealize/cerealize.h"
+
+// TODO(dkorolev): Move this into Bricks.
+#include "bricks-cerealize-base64.h"
+
+// The `MixpanelUploader` is the `analytics::Sink` that reports `User` and `Answer` events to Mixpanel.
+//
+// It only adds the token to the already encoded events and puts them into an `outbox::Outbox`, so that
+// the network never throttles the stream. A background thread sends the events in batches, pipelined over
+// a keep-alive connection from the `http_client::Pool`, retrying with backoff.
+//
+// With a non-empty `outbox_dir` the outbox is on disk: the events survive restarts and outages of Mixpanel,
+// and the uploader resumes from the last acknowledged one. Otherwise it is a bounded in-memory queue.
+class MixpanelUploader final : public analytics::Sink {
+ public:
+  // WORKAROUND(sompylasar): Not using `https://`, could not send HTTPS request.
+  static constexpr const char* kDefaultEndpoint = "http://api.mixpanel.com/track";
+  // Mixpanel accepts up to 50 events per batch request.
+  static constexpr size_t kMaxBatchSize = 50;
+  // Up to this many batch requests are sent back to back over one connection.
+  static constexpr size_t kMaxPipelinedBatches = 8;
+  static constexpr size_t kDefaultMaxQueueSize = 100000;
+
+  MixpanelUploader(const std::string& demo_id,
+                   const std::string& mixpanel_token,
+                   const std::string& endpoint = kDefaultEndpoint,
+                   const std::string& outbox_dir = "",
+                   size_t max_queue_size = kDefaultMaxQueueSize)
+      : demo_id_(demo_id),
+        mixpanel_token_(mixpanel_token),
+        client_(endpoint),
+        outbox_(outbox_dir, demo_id + "_mixpanel_outbox", max_queue_size),
+        events_sent_(0u),
+        sender_thread_(&MixpanelUploader::SenderThread, this) {}
+
+  ~MixpanelUploader() override {
+    outbox_.Stop();
+    sender_thread_.join();
+  }
+
+  // Mixpanel expects the token of the project among the properties of each event. The `$insert_id`, unique
+  // per record of the demo, lets Mixpanel drop the copies of the event sent again after a lost response.
+  void Push(size_t source_index, const analytics::Event& event) override {
+    if (!mixpanel_token_.empty()) {
+      const std::string insert_id = demo_id_ + '-' + std::to_string(source_index);
+      outbox_.Push(source_index,
+                   analytics::Event::WithProperty(
+                       event.WithProperty("$insert_id", insert_id), "token", mixpanel_token_));
+    }
+  }
+
+  // The events are durable with a persistent outbox, so the export resumes from the first entry not in it yet.
+  // The entries before that one which are replayed are dropped by `Outbox::Push()`.
+  size_t NextSourceIndex(size_t live) const override {
+    return (outbox_.IsPersistent() && !mixpanel_token_.empty()) ? outbox_.NextSourceIndex() : live;
+  }
+
+  // The number of events Mixpanel has acknowledged since the start, and the number of events dropped
+  // due to the full in-memory queue.
+  size_t EventsSent() const { return events_sent_; }
+
+  size_t EventsDropped() const { return outbox_.Dropped(); }
+
+ private:
+  // The body of the batch request: the Base64-encoded JSON array of events, as a form field.
+  static std::string BatchRequestBody(const std::vector<std::string>& events) {
+    std::string json = "[";
+    for (size_t i = 0; i < events.size(); ++i) {
+      if (i) {
+        json += ',';
+      }
+      json += events[i];
+    }
+    json += ']';
+    std::string body = "data=";
+    for (const char c : bricks::cerealize::Base64Encode(json)) {
+      if (c == '+') {
+        body += "%2B";
+      } else if (c == '/') {
+        body += "%2F";
+      } else if (c == '=') {
+        body += "%3D";
+      } else {
+        body += c;
+      }
+    }
+    return body;
+  }
+
+  // Sends the events as batches of up to `kMaxBatchSize`, pipelined over one keep-alive connection.
+  // Mixpanel responds with `1` to each batch it has accepted. Returns the number of events in the batches
+  // accepted before the first failed one.
+  size_t SendBatches(const std::vector<std::string>& events) {
+    std::vector<http_client::Request> requests;
+    for (size_t i = 0; i < events.size(); i += kMaxBatchSize) {
+      const std::vector<std::string> batch(events.begin() + i,
+                                           events.begin() + std::min(i + kMaxBatchSize, events.size()));
+      requests.push_back(http_client::Request{"POST",
+                                              client_.GetEndpoint().path,
+                                              BatchRequestBody(batch),
+                                              "application/x-www-form-urlencoded",
+                                              {}});
+    }
+    size_t accepted = 0;
+    try {
+      const std::vector<http_client::Response> responses = client_.Pipeline(requests);
+      for (const auto& response : responses) {
+        if (response.code != 200 || response.body.empty() || response.body[0] != '1') {
+          std::cerr << '@' << demo_id_ << " MixpanelUploader Response: HTTP " << response.code << " \""
+                    << response.body << "\"" << std::endl;
+          break;
+        }
+        accepted = std::min(accepted + kMaxBatchSize, events.size());
+      }
+    } catch (const http_client::Error& e) {
+      std::cerr << '@' << demo_id_ << " MixpanelUploader Exception: " << e.what() << std::endl;
+    }
+    return accepted;
+  }
+
+  void SenderThread() {
+    const std::chrono::milliseconds initial_backoff(100);
+    const std::chrono::milliseconds max_backoff(10000);
+    std::chrono::milliseconds backoff = initial_backoff;
+    std::vector<std::string> events;
+    while (outbox_.WaitAndPeek(kMaxBatchSize * kMaxPipelinedBatches, events)) {
+      const size_t accepted = SendBatches(events);
+      if (accepted) {
+        outbox_.Ack(accepted);
+        events_sent_ += accepted;
+      }
+      if (accepted == events.size()) {
+        backoff = initial_backoff;
+      } else {
+        // Retry the same events after a pause. Wake up early only to stop.
+        if (outbox_.WaitForStop(backoff)) {
+          break;
+        }
+        backoff = std::min(backoff * 2, max_backoff);
+      }
+    }
+  }
+
+  const std::string demo_id_;
+  const std::string mixpanel_token_;
+  http_client::Client client_;
+
+  outbox::Outbox outbox_;
+  std::atomic_size_t events_sent_;
+
+  std::thread sender_thread_;
+
+  MixpanelUploader() = delete;
+  MixpanelUploader(const MixpanelUploader&) = delete;
+  void operator=(const MixpanelUploader&) = delete;
+  MixpanelUploader(MixpanelUploader&&) = delete;
+  void operator=(MixpanelUploader&&) = delete;
+};
+
+#endif  // MIXPANEL_H
@@ -0,0 +1,220 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+#ifndef OUTBOX_H
+#define OUTBOX_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "segmented_log.h"
+
+// A durable queue between a stream listener and a sender, for at-least-once delivery to external services.
+//
+// The events are appended to a `segmented_log::Log`, and the sender acknowledges the events it has delivered
+// by moving the cursor, persisted in the `<name>.acked` file. After a restart the sender resumes from the last
+// acknowledged event, and nothing that has been acknowledged is sent again. The segments of the log that hold
+// only the acknowledged events are removed.
+//
+// The events are not flushed one by one. Each `Ack()` syncs the log to the disk, then the cursor, so that even
+// a crash of the machine does not lose the acknowledged events from under the cursor; the events appended
+// since are re-enqueued from the stream after a restart, as the next paragraph describes. The syncs are done
+// outside the lock that `Push()` takes.
+//
+// Each event is stored along with the index of the stream entry it originates from. After a restart
+// `NextSourceIndex()` tells the listener which stream entry to resume from, and the entries before it that
+// are replayed anyway are not enqueued twice.
+//
+// With an empty `directory` the outbox is in-memory, bounded by `max_pending_in_memory` events.
+namespace outbox {
+
+class Outbox final {
+ public:
+  Outbox(const std::string& directory, const std::string& name, size_t max_pending_in_memory = 100000)
+      : max_pending_in_memory_(max_pending_in_memory) {
+    if (!directory.empty()) {
+      cursor_path_ = directory + '/' + name + ".acked";
+      log_.Open(directory, name);
+      FILE* f = std::fopen(cursor_path_.c_str(), "r");
+      if (f) {
+        unsigned long long acked = 0;
+        if (std::fscanf(f, "%llu", &acked) == 1) {
+          acked_ = std::min(static_cast<size_t>(acked), log_.Size());
+        }
+        std::fclose(f);
+      }
+      acked_ = std::max(acked_, log_.FirstAvailable());
+      if (log_.Size()) {
+        next_source_index_ = SourceIndexOf(*log_.Get(log_.Size() - 1)) + 1;
+      }
+    }
+  }
+
+  bool IsPersistent() const { return log_.IsPersistent(); }
+
+  // Appends the event, unless it originates from a stream entry which is already in the outbox.
+  // Returns `false` if the event has not been appended.
+  bool Push(size_t source_index, const std::string& event) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (source_index < next_source_index_) {
+        return false;
+      }
+      next_source_index_ = source_index + 1;
+      if (IsPersistent()) {
+        log_.Append(static_cast<uint64_t>(source_index),
+                    std::make_shared<const std::string>(std::to_string(source_index) + '\t' + event));
+      } else if (memory_.size() >= max_pending_in_memory_) {
+        ++dropped_;
+        return false;
+      } else {
+        memory_.push_back(event);
+      }
+    }
+    condition_.notify_all();
+    return true;
+  }
+
+  // Blocks until there are unacknowledged events, and copies up to `max` of them into `events`.
+  // Returns `false` if the outbox is being stopped.
+  bool WaitAndPeek(size_t max, std::vector<std::string>& events) {
+    events.clear();
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_.wait(lock, [this]() { return stop_ || Pending(); });
+    if (stop_) {
+      return false;
+    }
+    if (IsPersistent()) {
+      for (size_t i = acked_; i < log_.Size() && events.size() < max; ++i) {
+        const std::shared_ptr<const std::string> entry = log_.Get(i);
+        events.push_back(entry->substr(entry->find('\t') + 1));
+      }
+    } else {
+      for (size_t i = 0; i < memory_.size() && events.size() < max; ++i) {
+        events.push_back(memory_[i]);
+      }
+    }
+    return true;
+  }
+
+  // Marks the first `count` unacknowledged events as delivered. The disk syncs are done without holding
+  // the lock `Push()` takes, so that they do not hold up the stream listener.
+  void Ack(size_t count) {
+    if (!IsPersistent()) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      count = std::min(count, memory_.size());
+      memory_.erase(memory_.begin(), memory_.begin() + count);
+      acked_ += count;
+      return;
+    }
+    std::lock_guard<std::mutex> sync_lock(sync_mutex_);
+    size_t acked;
+    std::vector<std::string> files;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      acked = std::min(acked_ + count, log_.Size());
+      files = log_.FlushForSync();
+    }
+    // The events go to the disk before the cursor that moves past them.
+    segmented_log::SyncFiles(files);
+    const bool written = segmented_log::WriteFileAtomically(cursor_path_, std::to_string(acked) + '\n', true);
+    segmented_log::Log::Drop drop;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      acked_ = acked;
+      if (written) {
+        drop = log_.PlanDrop(acked_);
+      }
+    }
+    if (drop.segments && log_.WriteDrop(drop)) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      log_.CommitDrop(drop);
+    }
+  }
+
+  // Waits for `Stop()` for at most `timeout`. Returns `true` if the outbox is being stopped.
+  bool WaitForStop(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return condition_.wait_for(lock, timeout, [this]() { return stop_; });
+  }
+
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    condition_.notify_all();
+  }
+
+  size_t NextSourceIndex() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return next_source_index_;
+  }
+
+  size_t Acked() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return acked_;
+  }
+
+  size_t Dropped() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return dropped_;
+  }
+
+ private:
+  bool Pending() const { return IsPersistent() ? (acked_ < log_.Size()) : !memory_.empty(); }
+
+  static size_t SourceIndexOf(const std::string& entry) {
+    return static_cast<size_t>(std::strtoull(entry.c_str(), nullptr, 10));
+  }
+
+  const size_t max_pending_in_memory_;
+  std::string cursor_path_;
+
+  mutable std::mutex mutex_;
+  std::mutex sync_mutex_;  // One `Ack()` at a time, as the drops of the segments are done in steps.
+  std::condition_variable condition_;
+  segmented_log::Log log_;
+  std::deque<std::string> memory_;
+  size_t acked_ = 0;
+  size_t next_source_index_ = 0;
+  size_t dropped_ = 0;
+  bool stop_ = false;
+
+  Outbox() = delete;
+  Outbox(const Outbox&) = delete;
+  void operator=(const Outbox&) = delete;
+};
+
+}  // namespace outbox
+
+#endif  // OUTBOX_H
@@ -0,0 +1,368 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include "../Bricks/port.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// The front of the demo server run as several worker processes on this machine.
+//
+// `HashRing` maps each `demo_id` onto a worker, so that all the requests of one demo go to the same process.
+// `Proxy` accepts the connections, reads the head of the request to pick the worker by its path, and from
+// there on passes the bytes through in both directions as they arrive, so that the streams are not buffered.
+namespace router {
+
+// FNV-1a, 64 bit, with the bits mixed at the end, as nearby keys should land far apart on the ring.
+inline uint64_t Hash(const std::string& key) {
+  uint64_t hash = 14695981039346656037ull;
+  for (const char c : key) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+// Consistent hashing: adding or removing a worker only moves the keys of that worker.
+class HashRing final {
+ public:
+  explicit HashRing(size_t workers, size_t points_per_worker = 128) : workers_(workers) {
+    for (size_t w = 0; w < workers; ++w) {
+      for (size_t i = 0; i < points_per_worker; ++i) {
+        ring_.emplace_back(Hash("worker" + std::to_string(w) + '#' + std::to_string(i)), w);
+      }
+    }
+    std::sort(ring_.begin(), ring_.end());
+  }
+
+  size_t WorkersCount() const { return workers_; }
+
+  size_t WorkerOf(const std::string& key) const {
+    if (ring_.empty()) {
+      throw std::logic_error("router::HashRing has no workers.");
+    }
+    const std::pair<uint64_t, size_t> point(Hash(key), 0u);
+    const auto cit = std::lower_bound(ring_.begin(), ring_.end(), point);
+    return (cit != ring_.end() ? cit : ring_.begin())->second;
+  }
+
+  // The first worker clockwise from `key` that is not `taken`, or `WorkerOf(key)` if all of them are.
+  size_t WorkerOf(const std::string& key, const std::vector<bool>& taken) const {
+    const size_t worker = WorkerOf(key);
+    const std::pair<uint64_t, size_t> point(Hash(key), 0u);
+    size_t i = static_cast<size_t>(std::lower_bound(ring_.begin(), ring_.end(), point) - ring_.begin());
+    for (size_t step = 0; step < ring_.size(); ++step, ++i) {
+      const size_t candidate = ring_[i % ring_.size()].second;
+      if (candidate >= taken.size() || !taken[candidate]) {
+        return candidate;
+      }
+    }
+    return worker;
+  }
+
+ private:
+  size_t workers_;
+  std::vector<std::pair<uint64_t, size_t>> ring_;
+};
+
+// The first segment of the path, `abcde` for `/abcde/a/`, or an empty string for `/` or `/new`.
+inline std::string DemoIdOf(const std::string& path) {
+  if (path.length() < 2 || path[0] != '/') {
+    return "";
+  }
+  const size_t end = path.find_first_of("/?", 1);
+  if (end == std::string::npos || path[end] != '/') {
+    return "";
+  }
+  return path.substr(1, end - 1);
+}
+
+// Adds up the plain text status pages of the workers, made of `Key: <number>[ unit]` lines, key by key,
+// in the order the keys first appear. The lines of any other form are dropped.
+inline std::string SumCounters(const std::vector<std::string>& bodies) {
+  std::vector<std::string> keys;
+  std::vector<std::pair<unsigned long long, std::string>> sums;  // The sum and the unit of each key.
+  for (const std::string& body : bodies) {
+    size_t begin = 0;
+    while (begin < body.length()) {
+      size_t end = body.find('\n', begin);
+      if (end == std::string::npos) {
+        end = body.length();
+      }
+      const std::string line = body.substr(begin, end - begin);
+      begin = end + 1;
+      const size_t colon = line.find(':');
+      if (colon == std::string::npos) {
+        continue;
+      }
+      size_t i = colon + 1;
+      while (i < line.length() && std::isspace(static_cast<unsigned char>(line[i]))) {
+        ++i;
+      }
+      if (i == line.length() || !std::isdigit(static_cast<unsigned char>(line[i]))) {
+        continue;
+      }
+      unsigned long long value = 0u;
+      while (i < line.length() && std::isdigit(static_cast<unsigned char>(line[i]))) {
+        value = value * 10u + static_cast<unsigned long long>(line[i] - '0');
+        ++i;
+      }
+      const std::string key = line.substr(0, colon);
+      const size_t index = static_cast<size_t>(std::find(keys.begin(), keys.end(), key) - keys.begin());
+      if (index == keys.size()) {
+        keys.push_back(key);
+        sums.emplace_back(0u, line.substr(i));
+      }
+      sums[index].first += value;
+    }
+  }
+  std::string result;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    result += keys[i] + ": " + std::to_string(sums[i].first) + sums[i].second + '\n';
+  }
+  return result;
+}
+
+class Proxy final {
+ public:
+  // Returns the port of the worker to forward the request to. May rewrite the path, query string included.
+  typedef std::function<int(const std::string& method, std::string& path)> route_type;
+
+  Proxy(int port, route_type route) : route_(route), listen_fd_(::socket(AF_INET, SOCK_STREAM, 0)) {
+    const int one = 1;
+    ::setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (listen_fd_ < 0 || ::bind(listen_fd_, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) ||
+        ::listen(listen_fd_, 1024)) {
+      if (listen_fd_ >= 0) {
+        ::close(listen_fd_);
+      }
+      throw std::runtime_error("Can not listen on port " + std::to_string(port) + '.');
+    }
+    acceptor_ = std::thread(&Proxy::AcceptThread, this);
+  }
+
+  // Stops accepting. The connections in progress run to completion in their own threads.
+  ~Proxy() {
+    stop_ = true;
+    ::shutdown(listen_fd_, SHUT_RDWR);
+    acceptor_.join();
+    ::close(listen_fd_);
+  }
+
+  size_t ConnectionsAccepted() const { return connections_accepted_; }
+
+ private:
+  void AcceptThread() {
+    while (!stop_) {
+      const int fd = ::accept(listen_fd_, nullptr, nullptr);
+      if (fd >= 0) {
+        ++connections_accepted_;
+        std::thread(&Proxy::ServeConnection, route_, fd).detach();
+      } else if (errno != EINTR && errno != ECONNABORTED) {
+        break;
+      }
+    }
+  }
+
+  static bool SendAll(int fd, const char* data, size_t length) {
+    while (length) {
+      const ssize_t sent = ::send(fd, data, length, MSG_NOSIGNAL);
+      if (sent <= 0) {
+        if (sent < 0 && errno == EINTR) {
+          continue;
+        }
+        return false;
+      }
+      data += sent;
+      length -= static_cast<size_t>(sent);
+    }
+    return true;
+  }
+
+  static int ConnectToWorker(int port) {
+    const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd >= 0 && ::connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address))) {
+      ::close(fd);
+      return -1;
+    }
+    if (fd >= 0) {
+      const int one = 1;
+      ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+  }
+
+  // Rewrites the head of the request for the worker: the new path, and `Connection: close`,
+  // so that the next request from the same client goes through the routing again.
+  static std::string RewriteHead(const std::string& head, const std::string& method, const std::string& path) {
+    const size_t request_line_end = head.find("\r\n");
+    const size_t version_begin = head.rfind(' ', request_line_end);
+    std::string result = method + ' ' + path;
+    result.append(head, version_begin, request_line_end - version_begin + 2);
+    size_t line_begin = request_line_end + 2;
+    while (line_begin < head.length()) {
+      size_t line_end = head.find("\r\n", line_begin);
+      if (line_end == std::string::npos) {
+        line_end = head.length();
+      }
+      if (line_end == line_begin) {
+        break;
+      }
+      std::string name = head.substr(line_begin, std::min(head.find(':', line_begin), line_end) - line_begin);
+      std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+      if (name != "connection" && name != "keep-alive") {
+        result.append(head, line_begin, line_end - line_begin + 2);
+      }
+      line_begin = line_end + 2;
+    }
+    return result + "Connection: close\r\n\r\n";
+  }
+
+  static void ServeConnection(route_type route, int client_fd) {
+    const int one = 1;
+    ::setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    std::string buffer;
+    size_t head_end;
+    char chunk[16384];
+    while ((head_end = buffer.find("\r\n\r\n")) == std::string::npos && buffer.length() < 65536) {
+      const ssize_t received = ::recv(client_fd, chunk, sizeof(chunk), 0);
+      if (received <= 0) {
+        ::close(client_fd);
+        return;
+      }
+      buffer.append(chunk, static_cast<size_t>(received));
+    }
+    const size_t method_end = buffer.find(' ');
+    const size_t path_end = buffer.find(' ', method_end + 1);
+    if (head_end == std::string::npos || method_end == std::string::npos || path_end == std::string::npos ||
+        path_end > head_end) {
+      const std::string bad_request =
+          "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+      SendAll(client_fd, bad_request.data(), bad_request.length());
+      ::close(client_fd);
+      return;
+    }
+    const std::string method = buffer.substr(0, method_end);
+    std::string path = buffer.substr(method_end + 1, path_end - method_end - 1);
+    int worker_fd = -1;
+    try {
+      worker_fd = ConnectToWorker(route(method, path));
+    } catch (const std::exception&) {
+      worker_fd = -1;
+    }
+    if (worker_fd < 0) {
+      const std::string unavailable =
+          "HTTP/1.1 502 Bad Gateway\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+      SendAll(client_fd, unavailable.data(), unavailable.length());
+      ::close(client_fd);
+      return;
+    }
+    const std::string head = RewriteHead(buffer.substr(0, head_end + 4), method, path);
+    if (SendAll(worker_fd, head.data(), head.length()) &&
+        SendAll(worker_fd, buffer.data() + head_end + 4, buffer.length() - head_end - 4)) {
+      Pump(client_fd, worker_fd);
+    }
+    ::close(worker_fd);
+    ::close(client_fd);
+  }
+
+  // Passes the bytes both ways until the worker is done with the response, or either side disconnects.
+  static void Pump(int client_fd, int worker_fd) {
+    char chunk[16384];
+    bool client_open = true;
+    while (true) {
+      // A negative descriptor is ignored by `poll()`.
+      struct pollfd fds[2] = {{worker_fd, POLLIN, 0}, {client_open ? client_fd : -1, POLLIN, 0}};
+      if (::poll(fds, 2, -1) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return;
+      }
+      if (fds[0].revents) {
+        const ssize_t received = ::recv(worker_fd, chunk, sizeof(chunk), 0);
+        if (received <= 0 || !SendAll(client_fd, chunk, static_cast<size_t>(received))) {
+          return;
+        }
+      }
+      if (fds[1].revents) {
+        const ssize_t received = ::recv(client_fd, chunk, sizeof(chunk), 0);
+        if (received <= 0) {
+          // The client is done sending. Any response in progress, such as a stream, carries on
+          // until the client actually closes the connection, which makes sending to it fail.
+          client_open = false;
+          ::shutdown(worker_fd, SHUT_WR);
+        } else if (!SendAll(worker_fd, chunk, static_cast<size_t>(received))) {
+          return;
+        }
+      }
+    }
+  }
+
+  const route_type route_;
+  const int listen_fd_;
+  std::atomic_bool stop_{false};
+  std::atomic_size_t connections_accepted_{0u};
+  std::thread acceptor_;
+
+  Proxy(const Proxy&) = delete;
+  void operator=(const Proxy&) = delete;
+};
+
+}  // namespace router
+
+#endif  // ROUTER_H
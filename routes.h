@@ -0,0 +1,414 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+#ifndef ROUTES_H
+#define ROUTES_H
+
+#include "../Bricks/port.h"
+
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "../Bricks/time/chrono.h"
+#include "../Bricks/net/api/api.h"
+
+// The HTTP routes of the demos.
+//
+// `Dispatcher` serves all the routes of all the demos on one port. It looks the demo up by the first segment
+// of the path in a hash map, then the handler by the rest of the path in the table of the demo, which is
+// a vector indexed by the number of the sub-route, shared by all the demos.
+//
+// The HTTP server matches the paths exactly. Behind the `router::Proxy`, which rewrites the path of each
+// request of a demo into `Routed(path)`, the dispatcher registers that one path with the server, and the table
+// of the server does not grow with the demos at all. Run as a single process, with no front to rewrite the
+// paths, each path of each demo is registered with the server, all of them leading to the dispatcher; what
+// it then saves is the churn, as hibernating or waking a demo up only swaps the handlers in its own table.
+//
+// `DemoRoutes` are the routes of one part of a demo, such as its `Storage`, added and removed together.
+namespace routes {
+
+typedef std::function<void(Request)> handler_type;
+
+// The one path the front sends all the requests of the demos to, with the original path as a URL parameter.
+const char kRoutedPath[] = "/.routed";
+const char kRoutedPathParameter[] = "routed_path";
+
+// Percent-encodes the path for a URL parameter value, keeping the unreserved characters and the slashes.
+inline std::string EncodedPath(const std::string& path) {
+  static const char kHex[] = "0123456789ABCDEF";
+  std::string result;
+  for (const char c : path) {
+    const unsigned char u = static_cast<unsigned char>(c);
+    if (std::isalnum(u) || c == '-' || c == '_' || c == '.' || c == '~' || c == '/') {
+      result += c;
+    } else {
+      result += '%';
+      result += kHex[u >> 4];
+      result += kHex[u & 15];
+    }
+  }
+  return result;
+}
+
+// Decodes the name of a URL parameter, the way the HTTP server does.
+inline std::string DecodedName(const std::string& name) {
+  std::string result;
+  for (size_t i = 0; i < name.length(); ++i) {
+    if (name[i] == '%' && i + 2 < name.length() && std::isxdigit(static_cast<unsigned char>(name[i + 1])) &&
+        std::isxdigit(static_cast<unsigned char>(name[i + 2]))) {
+      result += static_cast<char>(std::stoi(name.substr(i + 1, 2), nullptr, 16));
+      i += 2;
+    } else {
+      result += (name[i] == '+') ? ' ' : name[i];
+    }
+  }
+  return result;
+}
+
+// Rewrites `/abcde/a/matrix?x=1` into `/.routed?routed_path=/abcde/a/matrix&x=1`, keeping the URL parameters.
+// The path is percent-encoded, as it comes from the client. The `routed_path` parameters the client has sent,
+// if any, are dropped, so that the one inserted here is the only one.
+inline std::string Routed(const std::string& path) {
+  const size_t query = path.find('?');
+  std::string result =
+      std::string(kRoutedPath) + '?' + kRoutedPathParameter + '=' + EncodedPath(path.substr(0, query));
+  size_t begin = (query == std::string::npos) ? path.length() : query + 1;
+  while (begin < path.length()) {
+    size_t end = path.find('&', begin);
+    if (end == std::string::npos) {
+      end = path.length();
+    }
+    const std::string parameter = path.substr(begin, end - begin);
+    if (!parameter.empty() && DecodedName(parameter.substr(0, parameter.find('='))) != kRoutedPathParameter) {
+      result += '&' + parameter;
+    }
+    begin = end + 1;
+  }
+  return result;
+}
+
+// The path of the request as sent by the client, before the front has rewritten it, if it has.
+inline std::string PathOf(Request& r) {
+  return r.url.path == kRoutedPath ? r.url.query[kRoutedPathParameter] : r.url.path;
+}
+
+// Splits `/abcde/a/matrix` into `abcde` and `/a/matrix`, and `/abcde` into `abcde` and an empty string.
+inline std::pair<std::string, std::string> SplitPath(const std::string& path) {
+  const size_t end = path.find('/', 1);
+  if (end == std::string::npos) {
+    return std::make_pair(path.substr(1), std::string());
+  }
+  return std::make_pair(path.substr(1, end - 1), path.substr(end));
+}
+
+class Dispatcher final {
+ public:
+  // With `port` of zero, does not register the paths with any HTTP server. For benchmarking the lookups.
+  explicit Dispatcher(int port) : port_(port) {}
+
+  // Registers `kRoutedPath` with the HTTP server in place of the paths of the demos, for the requests
+  // rewritten by the front. To be called before any demo is added.
+  void ServeRouted() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!routed_) {
+      routed_ = true;
+      if (port_) {
+        HTTP(port_).Register(kRoutedPath, [this](Request r) { Dispatch(std::move(r)); });
+      }
+    }
+  }
+
+  static Dispatcher& ForPort(int port) {
+    static std::mutex mutex;
+    static std::map<int, std::unique_ptr<Dispatcher>> dispatchers;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unique_ptr<Dispatcher>& dispatcher = dispatchers[port];
+    if (!dispatcher) {
+      dispatcher.reset(new Dispatcher(port));
+    }
+    return *dispatcher;
+  }
+
+  void Add(const std::string& path, std::shared_ptr<const handler_type> handler) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto split = SplitPath(path);
+    const size_t sub_routes_count = sub_route_paths_.size();
+    const size_t index = SubRoute(split.second);
+    if (index == sub_routes_count) {
+      // A new sub-route, to be registered for all the retained demos too.
+      for (auto& kv : demos_) {
+        if (kv.second.fallback) {
+          Register(kv.first, kv.second, index);
+        }
+      }
+    }
+    Demo& demo = demos_[split.first];
+    if (demo.handlers.size() <= index) {
+      demo.handlers.resize(index + 1);
+    }
+    demo.handlers[index] = handler;
+    Register(split.first, demo, index);
+  }
+
+  // Unregisters the path, unless the demo is retained.
+  void Remove(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto split = SplitPath(path);
+    const auto demo = demos_.find(split.first);
+    const auto sub_route = sub_routes_.find(split.second);
+    if (demo != demos_.end() && sub_route != sub_routes_.end() &&
+        sub_route->second < demo->second.handlers.size()) {
+      demo->second.handlers[sub_route->second] = nullptr;
+      if (!demo->second.fallback) {
+        UnRegisterUnused(demo);
+      }
+    }
+  }
+
+  // Keeps all the known sub-routes of the demo registered, with or without their handlers.
+  // The requests to the routes without handlers go to `fallback`, which, say, brings the demo back.
+  void Retain(const std::string& demo_id, handler_type fallback) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Demo& demo = demos_[demo_id];
+    demo.fallback = std::make_shared<const handler_type>(fallback);
+    for (size_t index = 0; index < sub_route_paths_.size(); ++index) {
+      Register(demo_id, demo, index);
+    }
+  }
+
+  void Release(const std::string& demo_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto demo = demos_.find(demo_id);
+    if (demo != demos_.end()) {
+      demo->second.fallback = nullptr;
+      UnRegisterUnused(demo);
+    }
+  }
+
+  // The handler for the path, or the fallback of its demo, or `nullptr`.
+  std::shared_ptr<const handler_type> Resolve(const std::string& path) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto split = SplitPath(path);
+    const auto demo = demos_.find(split.first);
+    if (demo == demos_.end()) {
+      return nullptr;
+    }
+    const auto sub_route = sub_routes_.find(split.second);
+    if (sub_route != sub_routes_.end() && sub_route->second < demo->second.handlers.size() &&
+        demo->second.handlers[sub_route->second]) {
+      return demo->second.handlers[sub_route->second];
+    }
+    return demo->second.fallback;
+  }
+
+  void Dispatch(Request r) const {
+    const std::shared_ptr<const handler_type> handler = Resolve(PathOf(r));
+    if (handler) {
+      (*handler)(std::move(r));
+    } else {
+      r("", HTTPResponseCode.NotFound);
+    }
+  }
+
+  size_t DemosCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return demos_.size();
+  }
+
+  size_t SubRoutesCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return sub_route_paths_.size();
+  }
+
+ private:
+  struct Demo {
+    std::vector<std::shared_ptr<const handler_type>> handlers;  // By the index of the sub-route.
+    std::vector<bool> registered;                               // By the same index.
+    std::shared_ptr<const handler_type> fallback;               // Set while the demo is retained.
+  };
+
+  // All the below should be called with `mutex_` locked.
+  size_t SubRoute(const std::string& sub_path) {
+    const auto cit = sub_routes_.find(sub_path);
+    if (cit != sub_routes_.end()) {
+      return cit->second;
+    }
+    sub_routes_[sub_path] = sub_route_paths_.size();
+    sub_route_paths_.push_back(sub_path);
+    return sub_route_paths_.size() - 1;
+  }
+
+  void Register(const std::string& demo_id, Demo& demo, size_t index) {
+    if (demo.registered.size() <= index) {
+      demo.registered.resize(index + 1);
+    }
+    if (!demo.registered[index]) {
+      demo.registered[index] = true;
+      if (port_ && !routed_) {
+        HTTP(port_).Register("/" + demo_id + sub_route_paths_[index],
+                             [this](Request r) { Dispatch(std::move(r)); });
+      }
+    }
+  }
+
+  void UnRegisterUnused(std::unordered_map<std::string, Demo>::iterator demo) {
+    bool empty = true;
+    for (size_t index = 0; index < demo->second.registered.size(); ++index) {
+      if (demo->second.registered[index]) {
+        if (index < demo->second.handlers.size() && demo->second.handlers[index]) {
+          empty = false;
+        } else {
+          demo->second.registered[index] = false;
+          if (port_ && !routed_) {
+            HTTP(port_).UnRegister("/" + demo->first + sub_route_paths_[index]);
+          }
+        }
+      }
+    }
+    if (empty) {
+      demos_.erase(demo);
+    }
+  }
+
+  const int port_;
+  mutable std::mutex mutex_;
+  bool routed_ = false;
+  std::unordered_map<std::string, size_t> sub_routes_;
+  std::vector<std::string> sub_route_paths_;
+  std::unordered_map<std::string, Demo> demos_;
+
+  Dispatcher(const Dispatcher&) = delete;
+  void operator=(const Dispatcher&) = delete;
+};
+
+// Records the time of the last request, for the demo to be hibernated when idle, and keeps the handlers
+// to dispatch the requests to directly. The handlers run concurrently, the mutex only guards the check of
+// `closed` and the count of the handlers in progress. After `Close()`, the requests that still arrive at these
+// routes are handed to the fallback instead, and no handler runs once `Close()` has returned.
+class DemoRoutes final {
+ public:
+  explicit DemoRoutes(int port) : dispatcher_(Dispatcher::ForPort(port)), state_(std::make_shared<State>()) {}
+
+  ~DemoRoutes() {
+    Close();
+    UnRegisterAll();
+  }
+
+  void Register(const std::string& path, handler_type handler) {
+    std::shared_ptr<State> state = state_;
+    const auto guarded = std::make_shared<const handler_type>([state, handler](Request r) {
+      state->last_request_ms = static_cast<uint64_t>(bricks::time::Now());
+      {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        if (state->closed) {
+          const handler_type fallback = state->fallback;
+          lock.unlock();
+          if (fallback) {
+            fallback(std::move(r));
+          } else {
+            r("", HTTPResponseCode.ServiceUnavailable);
+          }
+          return;
+        }
+        ++state->in_flight;
+      }
+      const auto done = [&state]() {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (!--state->in_flight) {
+          state->condition.notify_all();
+        }
+      };
+      try {
+        handler(std::move(r));
+      } catch (...) {
+        done();
+        throw;
+      }
+      done();
+    });
+    dispatcher_.Add(path, guarded);
+    handlers_[path] = guarded;
+  }
+
+  void UnRegisterAll() {
+    for (const auto& kv : handlers_) {
+      dispatcher_.Remove(kv.first);
+    }
+    handlers_.clear();
+  }
+
+  // Sends all the further requests to `fallback`, and waits for the handlers in progress, if any.
+  void Close(handler_type fallback = nullptr) {
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    state_->closed = true;
+    state_->fallback = fallback;
+    state_->condition.wait(lock, [this]() { return !state_->in_flight; });
+  }
+
+  // Serves the request with the handler registered for its path, or the fallback once closed, bypassing
+  // the dispatcher. Returns `false` and leaves the request intact if there is no such handler.
+  bool Dispatch(Request& r) const {
+    const auto cit = handlers_.find(PathOf(r));
+    if (cit == handlers_.end()) {
+      return false;
+    }
+    (*cit->second)(std::move(r));
+    return true;
+  }
+
+  // In epoch milliseconds, zero if there were no requests.
+  uint64_t LastRequestMs() const { return state_->last_request_ms; }
+
+ private:
+  // Shared with the handlers in the dispatcher, which may still be calling them after `Close()`.
+  struct State {
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool closed = false;
+    size_t in_flight = 0u;
+    handler_type fallback;
+    std::atomic<uint64_t> last_request_ms{0u};
+  };
+
+  Dispatcher& dispatcher_;
+  std::shared_ptr<State> state_;
+  std::map<std::string, std::shared_ptr<const handler_type>> handlers_;
+
+  DemoRoutes(const DemoRoutes&) = delete;
+  void operator=(const DemoRoutes&) = delete;
+};
+
+}  // namespace routes
+
+#endif  // ROUTES_H
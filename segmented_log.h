@@ -0,0 +1,639 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+#ifndef SEGMENTED_LOG_H
+#define SEGMENTED_LOG_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// An append-only log of immutable serialized entries, which keeps only its hot tail in memory.
+//
+// Each entry is written through to the active segment, a pair of append-only files: `*.data` with the bytes
+// and `*.index` with a fixed-size `IndexRecord` per entry. Once the active segment is full, it is sealed and
+// memory-mapped, and its entries are dropped from memory, other than the last `Retain()`-ed ones. Reads of old
+// entries go to the mapped files, and copy the entry out of them.
+//
+// An in-memory log keeps all of its entries, unless told to `Retain()` only the recent ones. A persistent one
+// keeps all of its sealed segments, unless told to `DropBefore()` the entries no longer needed, which removes
+// the segments they fill, files included. The indexes of the entries do not change as the old ones are dropped,
+// and `FirstAvailable()` is the first one that can be read.
+//
+// Opening a log over the files written earlier recovers it, dropping the incomplete trailing entry, if any.
+// Without `Open()` the log is purely in-memory.
+//
+// A log can be started on top of a `SharedPrefix()` of another log, which becomes its first entries. The prefix
+// is immutable and shared by all the logs started on top of it, and only the entries appended after it are
+// stored, and persisted, by each of them. The prefix refers to the sealed segments of the log it is taken
+// from, which stay mapped for as long as it is used, and holds only the entries not yet sealed in memory.
+namespace segmented_log {
+
+struct IndexRecord {
+  uint64_t offset;
+  uint64_t length;
+  uint64_t ms;
+};
+
+struct Entry {
+  uint64_t ms;
+  std::shared_ptr<const std::string> data;
+};
+
+inline bool FileExists(const std::string& path) {
+  struct stat info;
+  return !::stat(path.c_str(), &info);
+}
+
+inline uint64_t FileSize(const std::string& path) {
+  struct stat info;
+  return ::stat(path.c_str(), &info) ? 0u : static_cast<uint64_t>(info.st_size);
+}
+
+// Replaces the file by writing to `<path>.tmp` and renaming it, so that the file is never seen half-written.
+// With `sync`, the new contents and the rename both reach the disk before this function returns.
+inline bool WriteFileAtomically(const std::string& path, const std::string& contents, bool sync) {
+  const std::string tmp_path = path + ".tmp";
+  FILE* f = std::fopen(tmp_path.c_str(), "w");
+  if (!f) {
+    return false;
+  }
+  const bool written = std::fwrite(contents.data(), 1, contents.length(), f) == contents.length() &&
+                       !std::fflush(f) && (!sync || !::fsync(::fileno(f)));
+  std::fclose(f);
+  if (!written || std::rename(tmp_path.c_str(), path.c_str())) {
+    return false;
+  }
+  if (sync) {
+    const size_t slash = path.rfind('/');
+    const int fd = ::open(slash == std::string::npos ? "." : path.substr(0, slash + 1).c_str(), O_RDONLY);
+    if (fd >= 0) {
+      ::fsync(fd);
+      ::close(fd);
+    }
+  }
+  return true;
+}
+
+// Syncs the files to the disk. The ones that are no longer there are skipped.
+inline void SyncFiles(const std::vector<std::string>& paths) {
+  for (const std::string& path : paths) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd >= 0) {
+      ::fsync(fd);
+      ::close(fd);
+    }
+  }
+}
+
+// A sealed segment. Immutable, memory-mapped, read-only.
+class Segment final {
+ public:
+  Segment(const std::string& data_path, const std::string& index_path)
+      : data_(Map(data_path, data_size_)), index_(Map(index_path, index_size_)) {}
+
+  ~Segment() {
+    Unmap(data_, data_size_);
+    Unmap(index_, index_size_);
+  }
+
+  size_t Size() const { return index_size_ / sizeof(IndexRecord); }
+
+  const IndexRecord& Index(size_t i) const { return reinterpret_cast<const IndexRecord*>(index_)[i]; }
+
+  std::shared_ptr<const std::string> Data(size_t i) const {
+    const IndexRecord& record = Index(i);
+    return std::make_shared<const std::string>(reinterpret_cast<const char*>(data_) + record.offset,
+                                               static_cast<size_t>(record.length));
+  }
+
+ private:
+  static void* Map(const std::string& path, size_t& size) {
+    size = static_cast<size_t>(FileSize(path));
+    if (!size) {
+      return nullptr;
+    }
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("Can not open `" + path + "`.");
+    }
+    void* result = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (result == MAP_FAILED) {
+      throw std::runtime_error("Can not mmap `" + path + "`.");
+    }
+    return result;
+  }
+
+  static void Unmap(void* ptr, size_t size) {
+    if (ptr) {
+      ::munmap(ptr, size);
+    }
+  }
+
+  size_t data_size_;
+  size_t index_size_;
+  void* data_;
+  void* index_;
+
+  Segment(const Segment&) = delete;
+  void operator=(const Segment&) = delete;
+};
+
+// The first entries of a log, immutable: the parts of the sealed segments, and the entries that were in memory.
+class Prefix final {
+ public:
+  Prefix() = default;
+
+  size_t size() const { return size_; }
+
+  Entry operator[](size_t index) const {
+    const Part& part = PartOf(index);
+    if (part.segment) {
+      return Entry{part.segment->Index(index).ms, part.segment->Data(index)};
+    }
+    return (*part.entries)[index];
+  }
+
+  uint64_t TimestampAt(size_t index) const {
+    const Part& part = PartOf(index);
+    return part.segment ? part.segment->Index(index).ms : (*part.entries)[index].ms;
+  }
+
+  // The number of the entries kept in memory, rather than in the segments.
+  size_t EntriesInMemory() const {
+    size_t result = 0;
+    for (const Part& part : parts_) {
+      if (part.entries) {
+        result += part.size;
+      }
+    }
+    return result;
+  }
+
+ private:
+  friend class Log;
+
+  struct Part {
+    size_t begin;
+    size_t size;
+    std::shared_ptr<const Segment> segment;
+    std::shared_ptr<const std::vector<Entry>> entries;
+  };
+
+  // The part of the entry, with `index` made relative to it.
+  const Part& PartOf(size_t& index) const {
+    const size_t i =
+        static_cast<size_t>(std::upper_bound(begins_.begin(), begins_.end(), index) - begins_.begin()) - 1;
+    index -= parts_[i].begin;
+    return parts_[i];
+  }
+
+  // Appends the first `size` entries of the segment or of the vector.
+  void Add(size_t size,
+           std::shared_ptr<const Segment> segment,
+           std::shared_ptr<const std::vector<Entry>> entries) {
+    parts_.push_back(Part{size_, size, std::move(segment), std::move(entries)});
+    begins_.push_back(size_);
+    size_ += size;
+  }
+
+  // Appends the parts of the first `n` entries of `other`.
+  void AddPrefixOf(const Prefix& other, size_t n) {
+    for (const Part& part : other.parts_) {
+      if (part.begin >= n) {
+        break;
+      }
+      Add(std::min(part.size, n - part.begin), part.segment, part.entries);
+    }
+  }
+
+  std::vector<Part> parts_;
+  std::vector<size_t> begins_;
+  size_t size_ = 0;
+
+  Prefix(const Prefix&) = delete;
+  void operator=(const Prefix&) = delete;
+};
+
+typedef std::shared_ptr<const Prefix> SharedEntries;
+
+class Log final {
+ public:
+  Log() = default;
+
+  ~Log() { CloseActiveSegment(); }
+
+  // Starts the log on top of the `base` entries. Must be called before `Open()` and the first `Append()`.
+  void SetBase(SharedEntries base) {
+    if (Size()) {
+      throw std::logic_error("segmented_log::Log::SetBase() should be called on an empty log.");
+    }
+    base_ = std::move(base);
+  }
+
+  // Makes the log persistent. Must be called before the first `Append()`.
+  void Open(const std::string& directory, const std::string& name, size_t entries_per_segment = 4096) {
+    if (Size() != BaseSize()) {
+      throw std::logic_error("segmented_log::Log::Open() should be called on an empty log.");
+    }
+    prefix_ = directory + '/' + name;
+    entries_per_segment_ = std::max(entries_per_segment, static_cast<size_t>(1));
+    Recover();
+  }
+
+  bool IsPersistent() const { return !prefix_.empty(); }
+
+  // Keeps the last `entries` entries in memory, for the readers that start from the recent ones.
+  // A persistent log keeps them on top of the unsealed entries, an in-memory one drops all the older ones.
+  void Retain(size_t entries) {
+    retain_ = entries;
+    Trim();
+  }
+
+  // Removes the files of a persistent log. The log should not be open.
+  static void RemoveFiles(const std::string& directory, const std::string& name) {
+    const std::string prefix = directory + '/' + name;
+    // The segments before the first one left by `DropBefore()` may still be there if it has been interrupted.
+    const size_t first_segment = ReadFirst(prefix).first;
+    for (size_t segment = 0;; ++segment) {
+      const std::string data_path = prefix + '.' + std::to_string(segment) + ".data";
+      const std::string index_path = prefix + '.' + std::to_string(segment) + ".index";
+      if (segment >= first_segment && !FileExists(data_path) && !FileExists(index_path)) {
+        break;
+      }
+      ::unlink(data_path.c_str());
+      ::unlink(index_path.c_str());
+    }
+    ::unlink((prefix + ".first").c_str());
+  }
+
+  // Removes the sealed segments of a persistent log all the entries of which are before `index`,
+  // files included.
+  void DropBefore(size_t index) {
+    const Drop drop = PlanDrop(index);
+    if (drop.segments) {
+      if (!WriteDrop(drop)) {
+        throw std::runtime_error("Can not write `" + prefix_ + ".first`.");
+      }
+      CommitDrop(drop);
+    }
+  }
+
+  // `DropBefore()` in three steps, for the caller to only hold its lock while the log changes in memory:
+  // `PlanDrop()` picks the segments, `WriteDrop()` records the new first segment and removes the files of
+  // the dropped ones, touching nothing but the files, and `CommitDrop()` forgets them.
+  // Only one drop may be in progress at a time.
+  struct Drop {
+    size_t segments = 0;
+    size_t first_entry = 0;
+  };
+
+  Drop PlanDrop(size_t index) const {
+    Drop drop;
+    if (!IsPersistent() || index <= BaseSize()) {
+      return drop;
+    }
+    index -= BaseSize();
+    // The index of the first entry of the segment `s`, or past the sealed ones.
+    const auto begin_of = [this](size_t s) {
+      return (s < segments_.size()) ? segment_begin_[s] : sealed_entries_;
+    };
+    while (drop.segments < segments_.size() && begin_of(drop.segments + 1) <= index) {
+      ++drop.segments;
+    }
+    drop.first_entry = begin_of(drop.segments);
+    return drop;
+  }
+
+  bool WriteDrop(const Drop& drop) const {
+    // The new first segment is recorded before the files are removed, for the recovery to never find a gap.
+    const std::string first =
+        std::to_string(first_segment_ + drop.segments) + ' ' + std::to_string(drop.first_entry);
+    if (!WriteFileAtomically(prefix_ + ".first", first + '\n', true)) {
+      return false;
+    }
+    for (size_t i = 0; i < drop.segments; ++i) {
+      ::unlink(DataPath(first_segment_ + i).c_str());
+      ::unlink(IndexPath(first_segment_ + i).c_str());
+    }
+    return true;
+  }
+
+  void CommitDrop(const Drop& drop) {
+    segments_.erase(segments_.begin(), segments_.begin() + drop.segments);
+    segment_begin_.erase(segment_begin_.begin(), segment_begin_.begin() + drop.segments);
+    first_segment_ += drop.segments;
+    first_entry_ = drop.first_entry;
+  }
+
+  size_t Size() const { return BaseSize() + tail_begin_ + tail_.size(); }
+
+  // The index of the first entry that has not been dropped.
+  size_t FirstAvailable() const {
+    if (IsPersistent()) {
+      return first_entry_ ? BaseSize() + first_entry_ : 0u;
+    }
+    return tail_begin_ ? BaseSize() + tail_begin_ : 0u;
+  }
+
+  // The index of the first entry of the tail kept in memory, past the `base` and the sealed segments.
+  size_t FirstInMemory() const { return BaseSize() + tail_begin_; }
+
+  size_t BaseSize() const { return base_ ? base_->size() : 0u; }
+
+  // The entries of the tail kept in memory, and their bytes, not counting the `base`.
+  size_t EntriesInMemory() const { return tail_.size(); }
+  size_t BytesInMemory() const { return tail_bytes_; }
+
+  size_t SegmentsCount() const { return segments_.size(); }
+
+  void Append(uint64_t ms, std::shared_ptr<const std::string> data) {
+    if (IsPersistent()) {
+      if (!data_file_) {
+        OpenActiveSegment();
+      }
+      const IndexRecord record{active_data_size_, static_cast<uint64_t>(data->length()), ms};
+      if (std::fwrite(data->data(), 1, data->length(), data_file_) != data->length() ||
+          std::fwrite(&record, sizeof(record), 1, index_file_) != 1) {
+        throw std::runtime_error("Can not append to `" + prefix_ + "`.");
+      }
+      active_data_size_ += record.length;
+    }
+    tail_bytes_ += data->length();
+    tail_.push_back(Entry{ms, std::move(data)});
+    if (IsPersistent() && Size() - BaseSize() - sealed_entries_ >= entries_per_segment_) {
+      Seal();
+    }
+    Trim();
+  }
+
+  std::shared_ptr<const std::string> Get(size_t index) const {
+    if (index < BaseSize()) {
+      return (*base_)[index].data;
+    }
+    index -= BaseSize();
+    if (index >= tail_begin_) {
+      return tail_[index - tail_begin_].data;
+    } else if (index >= first_entry_ && index < sealed_entries_) {
+      const size_t s = FindSegment(index);
+      return segments_[s]->Data(index - segment_begin_[s]);
+    } else {
+      throw std::out_of_range("segmented_log::Log::Get() of a dropped entry.");
+    }
+  }
+
+  uint64_t TimestampAt(size_t index) const {
+    if (index < BaseSize()) {
+      return base_->TimestampAt(index);
+    }
+    index -= BaseSize();
+    if (index >= tail_begin_) {
+      return tail_[index - tail_begin_].ms;
+    } else if (index >= first_entry_ && index < sealed_entries_) {
+      const size_t s = FindSegment(index);
+      return segments_[s]->Index(index - segment_begin_[s]).ms;
+    } else {
+      throw std::out_of_range("segmented_log::Log::TimestampAt() of a dropped entry.");
+    }
+  }
+
+  // The first `n` entries, for other logs to start on top of. The entries are shared, not copied: the sealed
+  // ones stay in the mapped segments. Repeated calls for the same `n` return the very same prefix.
+  SharedEntries SharedPrefix(size_t n) {
+    if (n == BaseSize()) {
+      return base_ ? base_ : std::make_shared<const Prefix>();
+    }
+    if (!shared_prefix_ || shared_prefix_->size() != n) {
+      const std::shared_ptr<Prefix> prefix = std::make_shared<Prefix>();
+      if (base_) {
+        prefix->AddPrefixOf(*base_, n);
+      }
+      for (size_t s = 0; s < segments_.size() && prefix->size() < n; ++s) {
+        if (BaseSize() + segment_begin_[s] != prefix->size()) {
+          throw std::out_of_range("segmented_log::Log::SharedPrefix() of the dropped entries.");
+        }
+        prefix->Add(std::min(segments_[s]->Size(), n - prefix->size()), segments_[s], nullptr);
+      }
+      if (prefix->size() < n) {
+        std::vector<Entry> entries;
+        entries.reserve(n - prefix->size());
+        for (size_t i = prefix->size(); i < n; ++i) {
+          entries.push_back(Entry{TimestampAt(i), Get(i)});
+        }
+        const size_t size = entries.size();
+        prefix->Add(size, nullptr, std::make_shared<const std::vector<Entry>>(std::move(entries)));
+      }
+      shared_prefix_ = prefix;
+    }
+    return shared_prefix_;
+  }
+
+  // Pushes the buffered writes of the active segment to the OS, and returns the files to pass to `SyncFiles()`
+  // for all the entries appended so far to reach the disk: those of the segments sealed since the previous
+  // call, and of the active one. For the caller to sync them without holding the lock that guards the log.
+  std::vector<std::string> FlushForSync() {
+    Flush();
+    std::vector<std::string> files;
+    for (const size_t segment : unsynced_segments_) {
+      files.push_back(DataPath(segment));
+      files.push_back(IndexPath(segment));
+    }
+    unsynced_segments_.clear();
+    if (data_file_) {
+      files.push_back(DataPath(first_segment_ + segments_.size()));
+      files.push_back(IndexPath(first_segment_ + segments_.size()));
+    }
+    return files;
+  }
+
+  // Pushes the buffered writes of the active segment to the OS, and optionally to the disk.
+  // The data goes first, so that the index never refers to the bytes that are not there.
+  void Flush(bool sync = false) {
+    if (data_file_) {
+      std::fflush(data_file_);
+      std::fflush(index_file_);
+      if (sync) {
+        ::fsync(::fileno(data_file_));
+        ::fsync(::fileno(index_file_));
+      }
+    }
+  }
+
+ private:
+  // The number of the first segment left by `DropBefore()`, and the index of its first entry.
+  static std::pair<size_t, size_t> ReadFirst(const std::string& prefix) {
+    std::pair<size_t, size_t> result(0u, 0u);
+    FILE* f = std::fopen((prefix + ".first").c_str(), "r");
+    if (f) {
+      unsigned long long segment = 0;
+      unsigned long long entry = 0;
+      if (std::fscanf(f, "%llu %llu", &segment, &entry) == 2) {
+        result = std::make_pair(static_cast<size_t>(segment), static_cast<size_t>(entry));
+      }
+      std::fclose(f);
+    }
+    return result;
+  }
+
+  std::string DataPath(size_t segment) const { return prefix_ + '.' + std::to_string(segment) + ".data"; }
+  std::string IndexPath(size_t segment) const { return prefix_ + '.' + std::to_string(segment) + ".index"; }
+
+  size_t FindSegment(size_t index) const {
+    return static_cast<size_t>(std::upper_bound(segment_begin_.begin(), segment_begin_.end(), index) -
+                               segment_begin_.begin()) -
+           1;
+  }
+
+  void OpenActiveSegment() {
+    const size_t segment = first_segment_ + segments_.size();
+    data_file_ = std::fopen(DataPath(segment).c_str(), "ab");
+    index_file_ = std::fopen(IndexPath(segment).c_str(), "ab");
+    if (!data_file_ || !index_file_) {
+      CloseActiveSegment();
+      throw std::runtime_error("Can not open `" + DataPath(segment) + "` for writing.");
+    }
+  }
+
+  void CloseActiveSegment() {
+    if (data_file_) {
+      std::fclose(data_file_);
+      data_file_ = nullptr;
+    }
+    if (index_file_) {
+      std::fclose(index_file_);
+      index_file_ = nullptr;
+    }
+  }
+
+  void Seal() {
+    Flush();
+    CloseActiveSegment();
+    const size_t segment = first_segment_ + segments_.size();
+    segments_.emplace_back(new Segment(DataPath(segment), IndexPath(segment)));
+    segment_begin_.push_back(sealed_entries_);
+    sealed_entries_ = tail_begin_ + tail_.size();
+    unsynced_segments_.push_back(segment);
+    active_data_size_ = 0;
+  }
+
+  // Drops the entries from memory that are neither unsealed nor among the last `retain_` ones.
+  // Without `retain_`, an in-memory log keeps everything.
+  void Trim() {
+    if (!IsPersistent() && !retain_) {
+      return;
+    }
+    const size_t unsealed = IsPersistent() ? (tail_begin_ + tail_.size() - sealed_entries_) : 0u;
+    const size_t keep = std::max(retain_, unsealed);
+    while (tail_.size() > keep) {
+      tail_bytes_ -= tail_.front().data->length();
+      tail_.pop_front();
+      ++tail_begin_;
+    }
+  }
+
+  // Maps the full segments, and loads the last, partial, one into memory to continue appending to it.
+  void Recover() {
+    const std::pair<size_t, size_t> first = ReadFirst(prefix_);
+    first_segment_ = first.first;
+    first_entry_ = first.second;
+    sealed_entries_ = first_entry_;
+    tail_begin_ = first_entry_;
+    for (size_t segment = first_segment_; FileExists(DataPath(segment)) && FileExists(IndexPath(segment));
+         ++segment) {
+      const uint64_t data_size = FileSize(DataPath(segment));
+      std::vector<IndexRecord> index(static_cast<size_t>(FileSize(IndexPath(segment)) / sizeof(IndexRecord)));
+      if (!index.empty()) {
+        FILE* f = std::fopen(IndexPath(segment).c_str(), "rb");
+        index.resize(f ? std::fread(&index[0], sizeof(IndexRecord), index.size(), f) : 0u);
+        if (f) {
+          std::fclose(f);
+        }
+      }
+      // Drop the trailing entries the bytes of which have not made it to the disk.
+      while (!index.empty() && index.back().offset + index.back().length > data_size) {
+        index.pop_back();
+      }
+      const uint64_t valid_data_size = index.empty() ? 0u : (index.back().offset + index.back().length);
+      if (::truncate(DataPath(segment).c_str(), static_cast<off_t>(valid_data_size)) ||
+          ::truncate(IndexPath(segment).c_str(), static_cast<off_t>(index.size() * sizeof(IndexRecord)))) {
+        throw std::runtime_error("Can not recover `" + DataPath(segment) + "`.");
+      }
+      if (index.size() >= entries_per_segment_) {
+        segments_.emplace_back(new Segment(DataPath(segment), IndexPath(segment)));
+        segment_begin_.push_back(sealed_entries_);
+        sealed_entries_ += index.size();
+        tail_begin_ = sealed_entries_;
+      } else {
+        const Segment partial(DataPath(segment), IndexPath(segment));
+        for (size_t i = 0; i < partial.Size(); ++i) {
+          tail_.push_back(Entry{partial.Index(i).ms, partial.Data(i)});
+          tail_bytes_ += tail_.back().data->length();
+        }
+        active_data_size_ = valid_data_size;
+        break;
+      }
+    }
+  }
+
+  std::string prefix_;
+  size_t entries_per_segment_ = 0;
+
+  SharedEntries base_;
+  SharedEntries shared_prefix_;
+
+  std::vector<std::shared_ptr<const Segment>> segments_;  // Shared with the prefixes taken.
+  std::vector<size_t> segment_begin_;
+  size_t sealed_entries_ = 0;
+  size_t first_segment_ = 0;  // The number of the files of `segments_[0]`, past the ones dropped.
+  size_t first_entry_ = 0;
+  std::vector<size_t> unsynced_segments_;  // Sealed since the last `FlushForSync()`.
+
+  // The entries in memory, from the index `tail_begin_` on, not counting the `base_`.
+  size_t retain_ = 0;
+  std::deque<Entry> tail_;
+  size_t tail_begin_ = 0;
+  size_t tail_bytes_ = 0;
+  FILE* data_file_ = nullptr;
+  FILE* index_file_ = nullptr;
+  uint64_t active_data_size_ = 0;
+
+  Log(const Log&) = delete;
+  void operator=(const Log&) = delete;
+};
+
+}  // namespace segmented_log
+
+#endif  // SEGMENTED_LOG_H
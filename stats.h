@@ -0,0 +1,132 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include "../Bricks/port.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "schema.h"
+
+#include "../Bricks/cerealize/cerealize.h"
+
+// Per-question statistics of the answers, kept up to date by the `Consumer` as the records come in.
+//
+// Each answer adds to the tally of its question, and a changed answer first takes the previous one back,
+// so that an update costs the same regardless of how many answers the demo has.
+namespace stats {
+
+// The answers to one question.
+struct Tally {
+  uint64_t agree = 0;
+  uint64_t disagree = 0;
+  uint64_t na = 0;
+
+  // From 0, when everyone agrees or everyone disagrees, to 1, when the answers are split in half.
+  // The `NA` answers do not count.
+  double Controversy() const {
+    const uint64_t total = agree + disagree;
+    return total ? 2.0 * static_cast<double>(agree < disagree ? agree : disagree) / total : 0.0;
+  }
+
+  uint64_t& Count(schema::ANSWER answer) {
+    return answer == schema::ANSWER::AGREE ? agree : (answer == schema::ANSWER::DISAGREE ? disagree : na);
+  }
+};
+
+// The `/stats` response for one question.
+struct QuestionStats {
+  size_t qid;
+  std::string text;
+  uint64_t agree;
+  uint64_t disagree;
+  uint64_t na;
+  double controversy;
+
+  template <typename A>
+  void serialize(A& ar) {
+    ar(CEREAL_NVP(qid),
+       CEREAL_NVP(text),
+       CEREAL_NVP(agree),
+       CEREAL_NVP(disagree),
+       CEREAL_NVP(na),
+       CEREAL_NVP(controversy));
+  }
+};
+
+// The `/stats` response for all the questions, in the order of their `qid`-s.
+struct AllQuestionsStats {
+  std::vector<QuestionStats> questions;
+
+  template <typename A>
+  void serialize(A& ar) {
+    ar(CEREAL_NVP(questions));
+  }
+};
+
+// The tallies of all the questions, indexed by `qid`.
+class Tallies final {
+ public:
+  void Add(schema::QID qid, schema::ANSWER answer) { ++Mutable(qid).Count(answer); }
+
+  // Takes back the `answer` the user has changed.
+  void Remove(schema::QID qid, schema::ANSWER answer) {
+    uint64_t& count = Mutable(qid).Count(answer);
+    if (count) {
+      --count;
+    }
+  }
+
+  // The tally of a question without answers is all zeroes.
+  const Tally& Get(schema::QID qid) const {
+    static const Tally empty;
+    const size_t index = static_cast<size_t>(qid);
+    return index < tallies_.size() ? tallies_[index] : empty;
+  }
+
+  QuestionStats Describe(schema::QID qid, const std::string& text) const {
+    const Tally& tally = Get(qid);
+    return QuestionStats{
+        static_cast<size_t>(qid), text, tally.agree, tally.disagree, tally.na, tally.Controversy()};
+  }
+
+ private:
+  Tally& Mutable(schema::QID qid) {
+    const size_t index = static_cast<size_t>(qid);
+    if (index >= tallies_.size()) {
+      tallies_.resize(index + 1);
+    }
+    return tallies_[index];
+  }
+
+  std::vector<Tally> tallies_;
+};
+
+}  // namespace stats
+
+#endif  // STATS_H
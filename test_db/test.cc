@@ -26,10 +26,27 @@ SOFTWARE.
 
 #include "../../Bricks/port.h"
 
+#include <map>
+#include <random>
+#include <sstream>
 #include <string>
 
 #include "../db.h"
 #include "../schema.h"
+#include "../dashboard.h"
+#include "../fanout.h"
+#include "../compression.h"
+#include "../segmented_log.h"
+#include "../actions.h"
+#include "../analytics.h"
+#include "../assets.h"
+#include "../http_client.h"
+#include "../mixpanel.h"
+#include "../router.h"
+#include "../routes.h"
+#include "../hosts.h"
+#include "../arena.h"
+#include "../stats.h"
 
 CEREAL_REGISTER_TYPE_WITH_NAME(schema::Record, "0");
 CEREAL_REGISTER_TYPE_WITH_NAME(schema::UserRecord, "U");
@@ -40,6 +57,7 @@ CEREAL_REGISTER_TYPE_WITH_NAME(schema::AnswerRecord, "A");
 #include "../bricks-cerealize-multikeyjson.h"
 #include "../bricks-cerealize-base64.h"
 
+#include "../../Bricks/file/file.h"
 #include "../../Bricks/dflags/dflags.h"
 #include "../../Bricks/3party/gtest/gtest-main-with-dflags.h"
 
@@ -47,6 +65,11 @@ using bricks::Singleton;
 using bricks::strings::Printf;
 
 DEFINE_int32(test_port, 8091, "Local port to use for the test.");
+DEFINE_string(test_data_dir, ".noshit", "The directory for the files created by the test.");
+DEFINE_int32(segmented_log_test_records,
+             1000000,
+             "The number of records to write. The 50M records scenario is "
+             "`--gtest_also_run_disabled_tests --gtest_filter=SegmentedLog.DISABLED_*`.");
 
 struct ListenOnTestPort {
   ListenOnTestPort() {
@@ -137,6 +160,1648 @@ TEST(AgreeDisagreeDemo, Users) {
   EXPECT_EQ(200, static_cast<int>(HTTP(GET(url_prefix + "/test3/u?uid=adam")).code));
 }
 
+TEST(AgreeDisagreeDemo, AnswersWithNoContent) {
+  db::Storage storage(FLAGS_test_port, "test_answers");
+  HTTP(FLAGS_test_port).Register("/test_answers/a/raw", std::ref(storage));
+  const std::string url_prefix = Printf("http://localhost:%d/test_answers", FLAGS_test_port);
+  bricks::time::SetNow(bricks::time::EPOCH_MILLISECONDS(1001));
+  EXPECT_EQ(200, static_cast<int>(HTTP(POST(url_prefix + "/u?uid=adam", "")).code));
+  EXPECT_EQ(200, static_cast<int>(HTTP(POST(url_prefix + "/q?text=Why%3F", "")).code));
+  // The client-side Actions page POST-s the answers, and needs nothing back.
+  const auto answered = HTTP(POST(url_prefix + "/a/answer?uid=adam&qid=1&answer=1", ""));
+  EXPECT_EQ(204, static_cast<int>(answered.code));
+  EXPECT_EQ("", answered.body);
+  EXPECT_EQ(400, static_cast<int>(HTTP(POST(url_prefix + "/a/answer?uid=eve&qid=1&answer=1", "")).code));
+  EXPECT_EQ(400, static_cast<int>(HTTP(POST(url_prefix + "/a/answer?uid=adam&qid=2&answer=1", "")).code));
+  EXPECT_EQ(405, static_cast<int>(HTTP(GET(url_prefix + "/a/answer?uid=adam&qid=1&answer=1")).code));
+  // The answer is in the stream, right after the user and the question.
+  const std::string answer = HTTP(GET(url_prefix + "/a/raw?since=2&cap=1")).body;
+  EXPECT_EQ(
+      "{\"record\":{\"polymorphic_id\":2147483649,\"polymorphic_name\":\"A\",\"ptr_wrapper\":"
+      "{\"valid\":1,\"data\":{\"ms\":1001,\"uid\":\"adam\",\"qid\":1,\"answer\":1}}"
+      "}}\n",
+      answer);
+  HTTP(FLAGS_test_port).UnRegister("/test_answers/a/raw");
+}
+
+struct FanoutTestPoint {
+  double x;
+  int y;
+  template <typename A>
+  void serialize(A& ar) {
+    ar(CEREAL_NVP(x), CEREAL_NVP(y));
+  }
+  bricks::time::EPOCH_MILLISECONDS ExtractTimestamp() const {
+    return static_cast<bricks::time::EPOCH_MILLISECONDS>(x);
+  }
+};
+
+TEST(AgreeDisagreeDemo, StorageRecoversItsIndexesAndRoutesAreClosable) {
+  const std::string url_prefix = Printf("http://localhost:%d/test_recovery", FLAGS_test_port);
+  segmented_log::Log::RemoveFiles(FLAGS_test_data_dir, "test_recovery_db");
+  {
+    db::Storage storage(FLAGS_test_port, "test_recovery", FLAGS_test_data_dir);
+    EXPECT_EQ(200, static_cast<int>(HTTP(POST(url_prefix + "/u?uid=adam", "")).code));
+    EXPECT_EQ(200, static_cast<int>(HTTP(POST(url_prefix + "/q?text=Why%3F", "")).code));
+    EXPECT_EQ(200, static_cast<int>(HTTP(POST(url_prefix + "/q?text=How%3F", "")).code));
+    EXPECT_EQ(3u, storage.Size());
+  }
+  {
+    // Woken up: the users and the questions are back, and the new question continues the numbering.
+    db::Storage storage(FLAGS_test_port, "test_recovery", FLAGS_test_data_dir);
+    EXPECT_EQ(3u, storage.Size());
+    EXPECT_EQ(200, static_cast<int>(HTTP(GET(url_prefix + "/u?uid=adam")).code));
+    EXPECT_EQ(400, static_cast<int>(HTTP(POST(url_prefix + "/q?text=Why%3F", "")).code));
+    EXPECT_EQ(204, static_cast<int>(HTTP(POST(url_prefix + "/a/answer?uid=adam&qid=2&answer=1", "")).code));
+    const auto added = HTTP(POST(url_prefix + "/q?text=What%3F", ""));
+    EXPECT_NE(std::string::npos, added.body.find("\"qid\":3"));
+    EXPECT_GT(storage.Routes().LastRequestMs(), 0u);
+
+    // Once closed, the routes send the requests to the fallback.
+    storage.Routes().Close([](Request r) { r("Waking up.\n", HTTPResponseCode.ServiceUnavailable); });
+    const auto closed = HTTP(GET(url_prefix + "/u?uid=adam"));
+    EXPECT_EQ(503, static_cast<int>(closed.code));
+    EXPECT_EQ("Waking up.\n", closed.body);
+  }
+  segmented_log::Log::RemoveFiles(FLAGS_test_data_dir, "test_recovery_db");
+}
+
+TEST(AgreeDisagreeDemo, ForkedStorageSharesTheHistory) {
+  const std::string parent_url = Printf("http://localhost:%d/test_parent", FLAGS_test_port);
+  const std::string fork_url = Printf("http://localhost:%d/test_fork", FLAGS_test_port);
+  db::Storage parent(FLAGS_test_port, "test_parent");
+  EXPECT_EQ(200, static_cast<int>(HTTP(POST(parent_url + "/u?uid=adam", "")).code));
+  EXPECT_EQ(200, static_cast<int>(HTTP(POST(parent_url + "/q?text=Why%3F", "")).code));
+
+  db::Storage fork(FLAGS_test_port, "test_fork", "", parent.SharedPrefix(parent.Size()));
+  EXPECT_EQ(2u, fork.Size());
+  EXPECT_EQ((*parent.SharedPrefix(2))[1].data, (*fork.SharedPrefix(2))[1].data);
+  EXPECT_EQ(200, static_cast<int>(HTTP(GET(fork_url + "/u?uid=adam")).code));
+  EXPECT_EQ(400, static_cast<int>(HTTP(POST(fork_url + "/q?text=Why%3F", "")).code));
+  EXPECT_EQ(204, static_cast<int>(HTTP(POST(fork_url + "/a/answer?uid=adam&qid=1&answer=1", "")).code));
+
+  // After the fork, the two demos go their own ways.
+  EXPECT_EQ(200, static_cast<int>(HTTP(POST(parent_url + "/u?uid=bob", "")).code));
+  EXPECT_EQ(404, static_cast<int>(HTTP(GET(fork_url + "/u?uid=bob")).code));
+  EXPECT_EQ(3u, parent.Size());
+  EXPECT_EQ(3u, fork.Size());
+  EXPECT_NE(*(*parent.SharedPrefix(3))[2].data, *(*fork.SharedPrefix(3))[2].data);
+}
+
+TEST(AgreeDisagreeDemo, ForkWaitsForTheRecordsToBeReplayed) {
+  // The consumer of a woken up demo is replaying its records, and a fork reads its state once all are in.
+  std::vector<int> consumed;
+  db::AtRecords<std::vector<int>> at_records;
+  std::vector<size_t> forked_at;
+  const auto fork = [&forked_at](std::vector<int>& state) { forked_at.push_back(state.size()); };
+  at_records.Add(3, consumed.size(), consumed, fork);
+  at_records.Add(1, consumed.size(), consumed, fork);
+  EXPECT_EQ(2u, at_records.PendingCount());
+  EXPECT_TRUE(forked_at.empty());
+  for (int record = 0; record < 3; ++record) {
+    consumed.push_back(record);
+    at_records.Consumed(consumed.size(), consumed);
+  }
+  EXPECT_EQ(std::vector<size_t>({1u, 3u}), forked_at);
+  EXPECT_EQ(0u, at_records.PendingCount());
+
+  // Once all the records are in, right away.
+  at_records.Add(2, consumed.size(), consumed, fork);
+  EXPECT_EQ(std::vector<size_t>({1u, 3u, 3u}), forked_at);
+}
+
+TEST(AgreeDisagreeDemo, SerializeOnceFanout) {
+  Singleton<ListenOnTestPort>();
+  fanout::Stream<FanoutTestPoint> stream("test_fanout", "point");
+  stream.Publish(FanoutTestPoint{1, 2});
+  stream.Publish(FanoutTestPoint{3, 4});
+  EXPECT_EQ(2u, stream.Size());
+  EXPECT_EQ(JSON(FanoutTestPoint{1, 2}, "point") + "\n", *stream.EncodedEntryAt(0));
+
+  // All the subscribers are served the very same pre-serialized buffers.
+  HTTP(FLAGS_test_port).Register("/test_fanout", std::ref(stream));
+  const std::string url_prefix = Printf("http://localhost:%d/test_fanout", FLAGS_test_port);
+  EXPECT_EQ(*stream.EncodedEntryAt(0) + *stream.EncodedEntryAt(1), HTTP(GET(url_prefix + "?cap=2")).body);
+  EXPECT_EQ(*stream.EncodedEntryAt(1), HTTP(GET(url_prefix + "?recent=1&n_min=1&cap=1")).body);
+  EXPECT_EQ(*stream.EncodedEntryAt(1), HTTP(GET(url_prefix + "?since=1&cap=1")).body);
+  HTTP(FLAGS_test_port).UnRegister("/test_fanout");
+}
+
+struct FanoutTestCounter {
+  std::atomic_size_t entries{0u};
+  bool Entry(FanoutTestPoint&, size_t, size_t) {
+    ++entries;
+    return true;
+  }
+  void Terminate() {}
+};
+
+TEST(AgreeDisagreeDemo, FanoutListenerScopesAndTermination) {
+  Singleton<ListenOnTestPort>();
+  std::unique_ptr<fanout::Stream<FanoutTestPoint>> stream(
+      new fanout::Stream<FanoutTestPoint>("test_fanout_terminated", "point"));
+  stream->Publish(FanoutTestPoint{1, 1});
+
+  // Assigning to a scope unsubscribes the listener it has been keeping.
+  FanoutTestCounter first;
+  FanoutTestCounter second;
+  fanout::ListenerScope scope = stream->Subscribe(first);
+  while (first.entries < 1u) {
+    std::this_thread::yield();
+  }
+  scope = stream->Subscribe(second);
+  stream->Publish(FanoutTestPoint{2, 2});
+  while (second.entries < 2u) {
+    std::this_thread::yield();
+  }
+  EXPECT_EQ(1u, static_cast<size_t>(first.entries));
+  scope = fanout::ListenerScope();
+
+  // The entries of a terminated stream are still served, and then the response ends.
+  std::string expected;
+  for (size_t i = 0; i < 2; ++i) {
+    const std::string json = *stream->EncodedEntryAt(i);
+    expected += "{\"stream\":\"/d/t\",\"entry\":" + json.substr(0, json.length() - 1) + "}\n";
+  }
+  fanout::Feed feed;
+  feed.Add("/d/t", stream->Source());
+  stream.reset();
+  HTTP(FLAGS_test_port).Register("/test_fanout_terminated/feed", std::ref(feed));
+  const std::string url = Printf("http://localhost:%d/test_fanout_terminated/feed", FLAGS_test_port);
+  EXPECT_EQ(expected, HTTP(GET(url + "?compress=0")).body);
+  HTTP(FLAGS_test_port).UnRegister("/test_fanout_terminated/feed");
+}
+
+struct FanoutTestCollector {
+  std::vector<std::pair<size_t, int>> entries;  // The indexes and the `y`-s. Read once the listener is done.
+  std::atomic_size_t count{0u};
+  std::atomic_bool terminated{false};
+  bool Entry(FanoutTestPoint& entry, size_t index, size_t) {
+    entries.emplace_back(index, entry.y);
+    ++count;
+    return true;
+  }
+  void Terminate() { terminated = true; }
+};
+
+TEST(AgreeDisagreeDemo, FanoutListenersSkipTheEntriesThatDoNotParse) {
+  const std::string name = "test_fanout_torn";
+  segmented_log::Log::RemoveFiles(FLAGS_test_data_dir, name);
+  {
+    // As if the process had crashed in the middle of writing the second entry.
+    segmented_log::Log log;
+    log.Open(FLAGS_test_data_dir, name);
+    log.Append(1, std::make_shared<const std::string>(JSON(FanoutTestPoint{1, 10}, "point") + '\n'));
+    log.Append(2, std::make_shared<const std::string>("{\"point\":{\"x\":2,"));
+    log.Flush();
+  }
+  FanoutTestCollector collector;
+  {
+    // The recovered entries are parsed, the one published since is handed over as is.
+    fanout::Stream<FanoutTestPoint> stream(name, "point", FLAGS_test_data_dir);
+    stream.Publish(FanoutTestPoint{3, 30});
+    fanout::ListenerScope scope = stream.Subscribe(collector);
+    while (collector.count < 2u) {
+      std::this_thread::yield();
+    }
+  }
+  EXPECT_TRUE(collector.terminated);
+  ASSERT_EQ(2u, collector.entries.size());
+  EXPECT_EQ(0u, collector.entries[0].first);
+  EXPECT_EQ(10, collector.entries[0].second);
+  EXPECT_EQ(2u, collector.entries[1].first);
+  EXPECT_EQ(30, collector.entries[1].second);
+  segmented_log::Log::RemoveFiles(FLAGS_test_data_dir, name);
+}
+
+TEST(Routes, DispatcherResolvesTenThousandDemos) {
+  // Not attached to an HTTP server.
+  routes::Dispatcher dispatcher(0);
+  const std::vector<std::string> sub_routes = {"/u", "/q", "/a/answer", "/a/raw", "/a/matrix", "/a/table", "/a",
+                                               "/a/", "/", "/config", "/layout", "/layout/meta", "/layout/d/u",
+                                               "/layout/d/q", "/layout/d/e", "/layout/d/i",
+                                               "/layout/d/i/viz.png", "/static/app.js", "/static/vendor.js",
+                                               "/data"};
+  const size_t demos = 10000;
+  for (size_t i = 0; i < demos; ++i) {
+    for (const auto& sub_route : sub_routes) {
+      const std::string path = "/demo" + std::to_string(i) + sub_route;
+      dispatcher.Add(path, std::make_shared<const routes::handler_type>([](Request) {}));
+    }
+  }
+  EXPECT_EQ(demos, dispatcher.DemosCount());
+  EXPECT_EQ(sub_routes.size(), dispatcher.SubRoutesCount());
+  EXPECT_FALSE(dispatcher.Resolve("/demo1/nope"));
+  EXPECT_FALSE(dispatcher.Resolve("/nope/u"));
+
+  // A retained demo keeps its routes with no handlers, and they lead to the fallback.
+  dispatcher.Retain("demo42", [](Request) {});
+  for (const auto& sub_route : sub_routes) {
+    dispatcher.Remove("/demo42" + sub_route);
+  }
+  EXPECT_EQ(demos, dispatcher.DemosCount());
+  ASSERT_TRUE(dispatcher.Resolve("/demo42/a/raw"));
+  EXPECT_EQ(dispatcher.Resolve("/demo42/a/raw"), dispatcher.Resolve("/demo42/nope"));
+  EXPECT_NE(dispatcher.Resolve("/demo42/a/raw"), dispatcher.Resolve("/demo41/a/raw"));
+  dispatcher.Release("demo42");
+  EXPECT_EQ(demos - 1, dispatcher.DemosCount());
+  EXPECT_FALSE(dispatcher.Resolve("/demo42/a/raw"));
+}
+
+TEST(Router, HashRingIsBalancedAndStable) {
+  const router::HashRing three(3);
+  const router::HashRing four(4);
+  std::vector<size_t> counts(3);
+  size_t moved = 0;
+  const size_t n = 30000;
+  for (size_t i = 0; i < n; ++i) {
+    const std::string demo_id = Printf("demo%d", static_cast<int>(i));
+    const size_t worker = three.WorkerOf(demo_id);
+    ++counts[worker];
+    // With a worker added, the keys only move onto the new worker.
+    const size_t new_worker = four.WorkerOf(demo_id);
+    if (new_worker != worker) {
+      EXPECT_EQ(3u, new_worker);
+      ++moved;
+    }
+  }
+  for (const size_t count : counts) {
+    EXPECT_GT(count, n / 3 * 8 / 10);
+  }
+  EXPECT_GT(moved, n / 4 * 7 / 10);
+  EXPECT_LT(moved, n / 4 * 13 / 10);
+
+  EXPECT_EQ("abcde", router::DemoIdOf("/abcde/a/"));
+  EXPECT_EQ("abcde", router::DemoIdOf("/abcde/"));
+  EXPECT_EQ("", router::DemoIdOf("/abcde"));
+  EXPECT_EQ("", router::DemoIdOf("/new?demo_id=x/y"));
+  EXPECT_EQ("", router::DemoIdOf("/"));
+
+  EXPECT_EQ("Active: 5\nVmRSS: 3072 kB\nRedirects: 0\nh2.example.com: 1\n",
+            router::SumCounters({"Active: 2\nVmRSS:\t    1024 kB\nRedirects: 0\n",
+                                 "Active: 3\nThe end\nVmRSS: 2048 kB\nh2.example.com: 1\n"}));
+  EXPECT_EQ("", router::SumCounters({}));
+}
+
+TEST(Router, ProxyPassesRequestsAndStreamsThrough) {
+  Singleton<ListenOnTestPort>();
+  fanout::Stream<FanoutTestPoint> stream("test_router_stream", "point");
+  stream.Publish(FanoutTestPoint{1, 2});
+  HTTP(FLAGS_test_port).Register("/test_router/stream", std::ref(stream));
+  HTTP(FLAGS_test_port).Register("/test_router/new", [](Request r) {
+    r(r.method + ' ' + r.url.query["demo_id"] + ' ' + r.body + '\n');
+  });
+
+  std::atomic_size_t routed(0u);
+  router::Proxy proxy(FLAGS_test_port + 1, [&routed](const std::string& method, std::string& path) {
+    ++routed;
+    if (method == "POST" && path == "/new") {
+      path = "/test_router/new?demo_id=abcde";
+    }
+    return static_cast<int>(FLAGS_test_port);
+  });
+  http_client::Client client(Printf("http://localhost:%d/new", FLAGS_test_port + 1));
+
+  // The request line is rewritten, the body is passed through.
+  const http_client::Response created = client.Post("sinks=udp", "application/x-www-form-urlencoded");
+  EXPECT_EQ(200, created.code);
+  EXPECT_EQ("POST abcde sinks=udp\n", created.body);
+
+  // The stream is passed through as it goes: the second entry is published after the response has started.
+  std::thread publisher([&stream]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    stream.Publish(FanoutTestPoint{3, 4});
+  });
+  const http_client::Response streamed = client.Get("/test_router/stream?cap=2");
+  publisher.join();
+  EXPECT_EQ(200, streamed.code);
+  EXPECT_EQ(*stream.EncodedEntryAt(0) + *stream.EncodedEntryAt(1), streamed.body);
+
+  // Each request goes through the routing, as the proxy closes the connection after each response.
+  EXPECT_EQ(2u, routed);
+  EXPECT_EQ(2u, proxy.ConnectionsAccepted());
+  HTTP(FLAGS_test_port).UnRegister("/test_router/stream");
+  HTTP(FLAGS_test_port).UnRegister("/test_router/new");
+}
+
+TEST(Routes, DispatcherServesTheRoutedPathOnly) {
+  Singleton<ListenOnTestPort>();
+  routes::Dispatcher dispatcher(FLAGS_test_port);
+  dispatcher.ServeRouted();
+  dispatcher.Add("/test_routed/a/raw", std::make_shared<const routes::handler_type>([](Request r) {
+    r(routes::PathOf(r) + ' ' + r.url.query["x"] + '\n');
+  }));
+  EXPECT_EQ("/.routed?routed_path=/test_routed/a/raw&x=1", routes::Routed("/test_routed/a/raw?x=1"));
+  // The path is encoded, and the `routed_path` sent by the client is dropped.
+  EXPECT_EQ("/.routed?routed_path=/test_routed/a%26b%25%23&x=1", routes::Routed("/test_routed/a&b%#?x=1"));
+  EXPECT_EQ("/.routed?routed_path=/test_routed/a/raw&x=1",
+            routes::Routed("/test_routed/a/raw?routed_path=/other&x=1&routed%5Fpath=/another"));
+
+  router::Proxy proxy(FLAGS_test_port + 1, [](const std::string&, std::string& path) {
+    path = routes::Routed(path);
+    return static_cast<int>(FLAGS_test_port);
+  });
+  const http_client::Response routed =
+      http_client::Client(Printf("http://localhost:%d", FLAGS_test_port + 1)).Get("/test_routed/a/raw?x=1");
+  EXPECT_EQ(200, routed.code);
+  EXPECT_EQ("/test_routed/a/raw 1\n", routed.body);
+  EXPECT_EQ("/test_routed/a/raw 1\n",
+            http_client::Client(Printf("http://localhost:%d", FLAGS_test_port + 1))
+                .Get("/test_routed/a/raw?routed_path=/test_routed/other&x=1")
+                .body);
+
+  // The path of the demo itself is not registered with the HTTP server.
+  const std::string direct = Printf("http://localhost:%d/test_routed/a/raw", FLAGS_test_port);
+  EXPECT_EQ(404, static_cast<int>(HTTP(GET(direct)).code));
+  HTTP(FLAGS_test_port).UnRegister(routes::kRoutedPath);
+}
+
+TEST(Hosts, StreamsAreCountedPerHost) {
+  std::vector<std::string> hostnames;
+  for (int i = 0; i < 10; ++i) {
+    hostnames.push_back(Printf("d%d.test.local", i));
+  }
+  hosts::Sharding sharding(hostnames);
+
+  // Virtual hosts, with no `/etc/hosts` entries needed.
+  Singleton<ListenOnTestPort>();
+  fanout::Stream<FanoutTestPoint> stream("test_hosts", "point");
+  stream.Publish(FanoutTestPoint{1, 2});
+  const std::string& data_host = hostnames[3];
+  const std::string& other = hostnames[7];
+  const fanout::Subscriptions subscriptions;
+  HTTP(FLAGS_test_port).Register("/test_hosts", sharding.Handler(stream, subscriptions));
+  const auto get = [](const std::string& host, const std::string& path) -> http_client::Response {
+    http_client::Client client(Printf("http://localhost:%d", FLAGS_test_port));
+    std::vector<http_client::Request> requests(1);
+    requests[0].method = "GET";
+    requests[0].path = path;
+    requests[0].headers["Host"] = host + Printf(":%d", FLAGS_test_port);
+    return std::move(client.Pipeline(requests)[0]);
+  };
+
+  // Any data hostname, and any other host, serves the stream where the request arrives.
+  EXPECT_EQ(*stream.EncodedEntryAt(0), get(other, "/test_hosts?cap=1&compress=0").body);
+  EXPECT_EQ(*stream.EncodedEntryAt(0), get(data_host, "/test_hosts?cap=1&compress=0").body);
+  EXPECT_EQ(*stream.EncodedEntryAt(0), get("localhost", "/test_hosts?cap=1&compress=0").body);
+
+  // The open streams are counted per host while they are open, and in the `subscriptions` they are served with.
+  const auto open_via = [&sharding](const std::string& hostname) -> size_t {
+    for (const auto& count : sharding.ConnectionCounts()) {
+      if (count.first == hostname) {
+        return count.second;
+      }
+    }
+    return static_cast<size_t>(-1);
+  };
+  const auto wait_for = [&open_via](const std::string& hostname, size_t expected) -> size_t {
+    for (int i = 0; i < 1000 && open_via(hostname) != expected; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return open_via(hostname);
+  };
+  EXPECT_EQ(0u, wait_for(data_host, 0u));
+  EXPECT_EQ(0u, wait_for("other", 0u));
+  EXPECT_EQ(0u, subscriptions.Count());
+  std::thread subscriber([&get, &data_host]() { get(data_host, "/test_hosts?since=1&cap=1&compress=0"); });
+  EXPECT_EQ(1u, wait_for(data_host, 1u));
+  EXPECT_EQ(0u, open_via(other));
+  EXPECT_EQ(1u, subscriptions.Count());
+  stream.Publish(FanoutTestPoint{3, 4});
+  subscriber.join();
+  EXPECT_EQ(0u, wait_for(data_host, 0u));
+  EXPECT_EQ(0u, subscriptions.Count());
+  HTTP(FLAGS_test_port).UnRegister("/test_hosts");
+}
+
+TEST(Compression, NegotiateEncoding) {
+  EXPECT_EQ(compression::Encoding::GZIP, compression::NegotiateEncoding("gzip, deflate, sdch"));
+  EXPECT_EQ(compression::Encoding::DEFLATE, compression::NegotiateEncoding("deflate"));
+  EXPECT_EQ(compression::Encoding::DEFLATE, compression::NegotiateEncoding("gzip;q=0, deflate;q=0.5"));
+  EXPECT_EQ(compression::Encoding::IDENTITY, compression::NegotiateEncoding(""));
+  EXPECT_EQ(compression::Encoding::IDENTITY, compression::NegotiateEncoding("br"));
+  EXPECT_EQ(compression::Encoding::BROTLI, compression::NegotiateEncoding("gzip, deflate, br", true));
+  EXPECT_EQ(compression::Encoding::GZIP, compression::NegotiateEncoding("gzip, br;q=0", true));
+}
+
+TEST(Compression, StreamingChunksAreDecodableRightAway) {
+  compression::StreamingDeflater deflater(compression::Encoding::GZIP);
+  z_stream inflater;
+  inflater.zalloc = Z_NULL;
+  inflater.zfree = Z_NULL;
+  inflater.opaque = Z_NULL;
+  inflater.next_in = Z_NULL;
+  inflater.avail_in = 0;
+  ASSERT_EQ(Z_OK, inflateInit2(&inflater, 15 + 16));
+  std::string expected;
+  std::string decoded;
+  for (int i = 0; i < 100; ++i) {
+    const std::string chunk = Printf("{\"point\":{\"x\":%d,\"y\":42}}\n", i);
+    expected += chunk;
+    std::string compressed = deflater.Compress(chunk);
+    char buffer[1024];
+    inflater.next_in = reinterpret_cast<Bytef*>(&compressed[0]);
+    inflater.avail_in = static_cast<uInt>(compressed.length());
+    inflater.next_out = reinterpret_cast<Bytef*>(buffer);
+    inflater.avail_out = sizeof(buffer);
+    ASSERT_EQ(Z_OK, inflate(&inflater, Z_SYNC_FLUSH));
+    decoded.append(buffer, sizeof(buffer) - inflater.avail_out);
+    // Each chunk is fully decodable as soon as it is received.
+    EXPECT_EQ(expected, decoded);
+  }
+  inflateEnd(&inflater);
+  // Highly repetitive JSON compresses well with a persistent context.
+  EXPECT_LT(deflater.BytesOut() * 2, deflater.BytesIn());
+}
+
+TEST(Compression, CountedPerStreamAndInTotal) {
+  const uint64_t total_in = fanout::TotalCompressionStats().bytes_in;
+  fanout::CompressionStats stream;
+  compression::StreamingDeflater deflater(compression::Encoding::GZIP);
+  std::string chunk;
+  for (int i = 0; i < 100; ++i) {
+    chunk += Printf("{\"point\":{\"x\":%d,\"y\":42}}\n", i);
+  }
+  const std::string compressed = fanout::CompressChunk(deflater, chunk, &stream);
+  const std::string trailer = fanout::CompressChunk(deflater, "", &stream, true);
+  EXPECT_EQ(chunk.length(), stream.bytes_in);
+  EXPECT_EQ(compressed.length() + trailer.length(), stream.bytes_out);
+  EXPECT_LT(stream.bytes_out * 2, stream.bytes_in);
+  EXPECT_LE(total_in + chunk.length(), fanout::TotalCompressionStats().bytes_in);
+}
+
+TEST(Assets, CompressedOnceAndRevalidated) {
+  std::string script;
+  for (int i = 0; i < 1000; ++i) {
+    script += Printf("function f%d() { return %d; }\n", i, i);
+  }
+  assets::Cache cache;
+  cache.Add("js/app.js", script);
+  cache.Add("index.html", "<html></html>");
+  const assets::Asset& asset = cache.Get("js/app.js");
+  EXPECT_EQ("application/javascript; charset=utf-8", asset.content_type);
+  EXPECT_LT(asset.gzip.length() * 4, script.length());
+  EXPECT_LT(asset.brotli.length(), asset.gzip.length());
+  EXPECT_EQ(std::vector<std::string>({"js/app.js"}), cache.List("js/"));
+  // Too short to benefit from compression.
+  EXPECT_TRUE(cache.Get("index.html").gzip.empty());
+  EXPECT_NE(asset.etag, assets::ETag(script + ' '));
+
+  HTTP(FLAGS_test_port).Register("/test_assets/app.js", cache.Handler("js/app.js"));
+  http_client::Client client(Printf("http://localhost:%d/test_assets/app.js", FLAGS_test_port));
+  std::vector<http_client::Request> requests(4);
+  for (auto& request : requests) {
+    request.method = "GET";
+    request.path = "/test_assets/app.js";
+  }
+  requests[1].headers["Accept-Encoding"] = "gzip, deflate";
+  requests[2].headers["Accept-Encoding"] = "gzip, deflate, br";
+  requests[3].headers["If-None-Match"] = asset.etag;
+  const std::vector<http_client::Response> responses = client.Pipeline(requests);
+
+  EXPECT_EQ(200, responses[0].code);
+  EXPECT_EQ(script, responses[0].body);
+  EXPECT_EQ(0u, responses[0].headers.count("content-encoding"));
+  EXPECT_EQ(asset.etag, responses[0].headers.at("etag"));
+  EXPECT_EQ(assets::kCacheForever, responses[0].headers.at("cache-control"));
+
+  EXPECT_EQ("gzip", responses[1].headers.at("content-encoding"));
+  EXPECT_EQ(asset.gzip, responses[1].body);
+  EXPECT_EQ("br", responses[2].headers.at("content-encoding"));
+  EXPECT_EQ(asset.brotli, responses[2].body);
+
+  EXPECT_EQ(304, responses[3].code);
+  EXPECT_EQ("", responses[3].body);
+  EXPECT_EQ(1u, cache.RequestsNotModified());
+  EXPECT_EQ(script.length() * 3, cache.BytesIdentity());
+  EXPECT_EQ(script.length() + asset.gzip.length() + asset.brotli.length(), cache.BytesSent());
+  HTTP(FLAGS_test_port).UnRegister("/test_assets/app.js");
+}
+
+TEST(AgreeDisagreeDemo, FeedMultiplexesTheStreams) {
+  Singleton<ListenOnTestPort>();
+  std::vector<std::unique_ptr<fanout::Stream<FanoutTestPoint>>> streams;
+  fanout::Feed feed;
+  for (int i = 0; i < 4; ++i) {
+    streams.emplace_back(new fanout::Stream<FanoutTestPoint>(Printf("test_feed_%d", i), "point"));
+    streams.back()->Publish(FanoutTestPoint{static_cast<double>(i), i});
+    feed.Add(Printf("/d/%d", i), streams.back()->Source());
+    HTTP(FLAGS_test_port).Register(Printf("/test_feed/d/%d", i), std::ref(*streams.back()));
+  }
+  HTTP(FLAGS_test_port).Register("/test_feed/feed", std::ref(feed));
+  const auto tagged = [&streams](int stream, size_t index) {
+    const std::string json = *streams[stream]->EncodedEntryAt(index);
+    return Printf("{\"stream\":\"/d/%d\",\"entry\":", stream) + json.substr(0, json.length() - 1) + "}\n";
+  };
+
+  // The entries of all the streams, tagged, and `since` per stream.
+  const std::string url_prefix = Printf("http://localhost:%d/test_feed/feed", FLAGS_test_port);
+  EXPECT_EQ(tagged(0, 0) + tagged(1, 0) + tagged(2, 0) + tagged(3, 0),
+            HTTP(GET(url_prefix + "?cap=4&compress=0")).body);
+  EXPECT_EQ(tagged(2, 0), HTTP(GET(url_prefix + "?since=1,1,0,1&cap=1&compress=0")).body);
+
+  // The new entries of any of the streams wake the subscriber up.
+  std::string live;
+  std::thread subscriber([&live, &url_prefix]() {
+    live = HTTP(GET(url_prefix + "?since=1,1,1,1&cap=2&compress=0")).body;
+  });
+  streams[3]->Publish(FanoutTestPoint{10, 10});
+  streams[1]->Publish(FanoutTestPoint{11, 11});
+  subscriber.join();
+  // In the order of publishing, or of the streams, if both are picked up during the same wakeup.
+  EXPECT_TRUE(live == tagged(3, 1) + tagged(1, 1) || live == tagged(1, 1) + tagged(3, 1));
+
+  // Compressed, and counted for the feed and in the totals.
+  const uint64_t total_in = fanout::TotalCompressionStats().bytes_in;
+  http_client::Client client(url_prefix);
+  http_client::Request request;
+  request.method = "GET";
+  request.path = "/test_feed/feed?since=1,1,1,1&cap=2";
+  request.headers["Accept-Encoding"] = "gzip";
+  const http_client::Response compressed = client.Pipeline({request})[0];
+  EXPECT_EQ("gzip", compressed.headers.at("content-encoding"));
+  EXPECT_EQ((tagged(1, 1) + tagged(3, 1)).length(), feed.Compression().bytes_in);
+  EXPECT_EQ(compressed.body.length(), feed.Compression().bytes_out);
+  EXPECT_LE(total_in + feed.Compression().bytes_in, fanout::TotalCompressionStats().bytes_in);
+
+  HTTP(FLAGS_test_port).UnRegister("/test_feed/feed");
+  for (int i = 0; i < 4; ++i) {
+    HTTP(FLAGS_test_port).UnRegister(Printf("/test_feed/d/%d", i));
+  }
+}
+
+// Writes `n` records into a persistent log, checks that only its unsealed segment stays in memory, and reads
+// them back. The RSS it takes is in `bench/`, as `segmented_log/rss_growth_writing_1m_records`.
+inline void SpillAndRecover(size_t n) {
+  const std::string name = "segmented_log_test";
+  segmented_log::Log::RemoveFiles(FLAGS_test_data_dir, name);
+  const auto record = [](size_t i) {
+    return std::make_shared<const std::string>(
+        Printf("{\"record\":{\"polymorphic_id\":2147483649,\"polymorphic_name\":\"A\",\"ptr_wrapper\":"
+               "{\"valid\":1,\"data\":{\"ms\":%d,\"uid\":\"user%d\",\"qid\":%d,\"answer\":1}}}}\n",
+               static_cast<int>(i),
+               static_cast<int>(i % 1000),
+               static_cast<int>(i % 200)));
+  };
+  {
+    segmented_log::Log log;
+    log.Open(FLAGS_test_data_dir, name);
+    size_t max_entries_in_memory = 0;
+    size_t max_bytes_in_memory = 0;
+    for (size_t i = 0; i < n; ++i) {
+      log.Append(i, record(i));
+      max_entries_in_memory = std::max(max_entries_in_memory, log.EntriesInMemory());
+      max_bytes_in_memory = std::max(max_bytes_in_memory, log.BytesInMemory());
+    }
+    EXPECT_EQ(n, log.Size());
+    EXPECT_EQ(n % 4096, log.EntriesInMemory());
+    EXPECT_GE(4095u, max_entries_in_memory);
+    EXPECT_GE(4095u * record(n - 1)->length(), max_bytes_in_memory);
+    // Both the spilled entries and the hot tail read back.
+    for (size_t i = 0; i < n; i += (n / 1000 + 1)) {
+      EXPECT_EQ(*record(i), *log.Get(i));
+      EXPECT_EQ(i, log.TimestampAt(i));
+    }
+    EXPECT_EQ(*record(n - 1), *log.Get(n - 1));
+  }
+  {
+    // The log is recovered from disk, and can be appended to.
+    segmented_log::Log log;
+    log.Open(FLAGS_test_data_dir, name);
+    EXPECT_EQ(n, log.Size());
+    EXPECT_EQ(*record(n / 2), *log.Get(n / 2));
+    log.Append(n, record(n));
+    EXPECT_EQ(*record(n), *log.Get(n));
+  }
+  segmented_log::Log::RemoveFiles(FLAGS_test_data_dir, name);
+}
+
+TEST(SegmentedLog, SpillsRecoversAndKeepsMemoryFlat) {
+  SpillAndRecover(static_cast<size_t>(FLAGS_segmented_log_test_records));
+}
+
+// About 9GB on disk under `--test_data_dir`, and a few minutes.
+TEST(SegmentedLog, DISABLED_SpillsFiftyMillionRecords) { SpillAndRecover(50000000); }
+
+TEST(SegmentedLog, RetainsOnlyTheRecentEntriesInMemory) {
+  const auto entry = [](size_t i) {
+    return std::make_shared<const std::string>(Printf("%d\n", static_cast<int>(i)));
+  };
+
+  // An in-memory log drops the older entries, and their indexes stay.
+  segmented_log::Log in_memory;
+  in_memory.Retain(10);
+  for (size_t i = 0; i < 100; ++i) {
+    in_memory.Append(i, entry(i));
+  }
+  EXPECT_EQ(100u, in_memory.Size());
+  EXPECT_EQ(90u, in_memory.FirstAvailable());
+  EXPECT_EQ(*entry(90), *in_memory.Get(90));
+  EXPECT_EQ(99u, in_memory.TimestampAt(99));
+  bool thrown = false;
+  try {
+    in_memory.Get(89);
+  } catch (const std::out_of_range&) {
+    thrown = true;
+  }
+  EXPECT_TRUE(thrown);
+
+  // A persistent log keeps the retained entries in memory across the seals, and reads the older ones from disk.
+  const std::string name = "segmented_log_retain_test";
+  segmented_log::Log::RemoveFiles(FLAGS_test_data_dir, name);
+  {
+    segmented_log::Log persistent;
+    persistent.Open(FLAGS_test_data_dir, name, 16);
+    persistent.Retain(20);
+    for (size_t i = 0; i < 100; ++i) {
+      persistent.Append(i, entry(i));
+    }
+    EXPECT_EQ(0u, persistent.FirstAvailable());
+    EXPECT_EQ(6u, persistent.SegmentsCount());
+    const std::shared_ptr<const std::string> recent = persistent.Get(80);
+    EXPECT_EQ(recent.get(), persistent.Get(80).get());
+    EXPECT_EQ(*entry(80), *recent);
+    EXPECT_EQ(*entry(0), *persistent.Get(0));
+  }
+  segmented_log::Log::RemoveFiles(FLAGS_test_data_dir, name);
+}
+
+TEST(SegmentedLog, DropsTheSegmentsBeforeAnIndex) {
+  const auto entry = [](size_t i) {
+    return std::make_shared<const std::string>(Printf("%d\n", static_cast<int>(i)));
+  };
+  const std::string name = "segmented_log_drop_test";
+  segmented_log::Log::RemoveFiles(FLAGS_test_data_dir, name);
+  const std::string prefix = FLAGS_test_data_dir + '/' + name;
+  {
+    segmented_log::Log log;
+    log.Open(FLAGS_test_data_dir, name, 10);
+    for (size_t i = 0; i < 35; ++i) {
+      log.Append(i, entry(i));
+    }
+    // Only the segments all the entries of which are before the index go, files included.
+    log.DropBefore(25);
+    EXPECT_EQ(35u, log.Size());
+    EXPECT_EQ(20u, log.FirstAvailable());
+    EXPECT_EQ(1u, log.SegmentsCount());
+    EXPECT_FALSE(segmented_log::FileExists(prefix + ".1.data"));
+    EXPECT_TRUE(segmented_log::FileExists(prefix + ".2.data"));
+    EXPECT_EQ(*entry(20), *log.Get(20));
+    bool thrown = false;
+    try {
+      log.Get(19);
+    } catch (const std::out_of_range&) {
+      thrown = true;
+    }
+    EXPECT_TRUE(thrown);
+  }
+  {
+    // The recovered log keeps the indexes, and continues the numbering of the segments.
+    segmented_log::Log log;
+    log.Open(FLAGS_test_data_dir, name, 10);
+    EXPECT_EQ(35u, log.Size());
+    EXPECT_EQ(20u, log.FirstAvailable());
+    EXPECT_EQ(*entry(34), *log.Get(34));
+    for (size_t i = 35; i < 45; ++i) {
+      log.Append(i, entry(i));
+    }
+    EXPECT_EQ(2u, log.SegmentsCount());
+    EXPECT_TRUE(segmented_log::FileExists(prefix + ".4.data"));
+    log.DropBefore(45);
+    EXPECT_EQ(40u, log.FirstAvailable());
+    EXPECT_EQ(0u, log.SegmentsCount());
+  }
+  segmented_log::Log::RemoveFiles(FLAGS_test_data_dir, name);
+  EXPECT_FALSE(segmented_log::FileExists(prefix + ".first"));
+  EXPECT_FALSE(segmented_log::FileExists(prefix + ".4.data"));
+}
+
+// Counts the events in the body of a Mixpanel batch request, `data=<URL-encoded Base64 of a JSON array>`.
+inline int CountEventsInMixpanelBatch(const std::string& body) {
+  const std::string alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string base64;
+  for (size_t i = 5; i < body.length(); ++i) {
+    if (body[i] == '%' && i + 2 < body.length()) {
+      base64 += static_cast<char>(strtol(body.substr(i + 1, 2).c_str(), nullptr, 16));
+      i += 2;
+    } else {
+      base64 += body[i];
+    }
+  }
+  std::string json;
+  int bits = 0;
+  int value = 0;
+  for (const char c : base64) {
+    const size_t d = alphabet.find(c);
+    if (d == std::string::npos) {
+      break;
+    }
+    value = (value << 6) | static_cast<int>(d);
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      json += static_cast<char>((value >> bits) & 0xff);
+    }
+  }
+  int events = 0;
+  for (size_t pos = 0; (pos = json.find("\"event\"", pos)) != std::string::npos; ++pos) {
+    ++events;
+  }
+  return events;
+}
+
+// A local stand-in for `api.mixpanel.com/track`. Fails the first `failures_left` requests,
+// and then every `failure_period`-th one, if it is set.
+struct MixpanelStandIn {
+  std::atomic_int requests;
+  std::atomic_int events;
+  std::atomic_int failures_left;
+  std::atomic_int failure_period;
+  explicit MixpanelStandIn(const std::string& path, int failures = 0)
+      : requests(0), events(0), failures_left(failures), failure_period(0) {
+    HTTP(FLAGS_test_port).Register(path, [this](Request r) {
+      const int request = ++requests;
+      if (r.method != "POST" || r.body.substr(0, 5) != "data=") {
+        r("0\n", HTTPResponseCode.BadRequest);
+      } else if (failures_left > 0) {
+        --failures_left;
+        r("0\n", HTTPResponseCode.ServiceUnavailable);
+      } else if (failure_period && !(request % failure_period)) {
+        r("0\n", HTTPResponseCode.ServiceUnavailable);
+      } else {
+        events += CountEventsInMixpanelBatch(r.body);
+        r("1\n");
+      }
+    });
+  }
+};
+
+inline std::unique_ptr<schema::Base> MixpanelTestUser(size_t i) {
+  std::unique_ptr<schema::UserRecord> user(new schema::UserRecord());
+  user->ms = static_cast<bricks::time::EPOCH_MILLISECONDS>(i);
+  user->uid = Printf("user%d", static_cast<int>(i));
+  return std::unique_ptr<schema::Base>(std::move(user));
+}
+
+inline analytics::Event MixpanelTestEvent(size_t i) {
+  return analytics::Event(analytics::UserEvent(dynamic_cast<const schema::UserRecord&>(*MixpanelTestUser(i))));
+}
+
+TEST(SegmentedLog, ForksShareTheirPrefix) {
+  // A 1k-user demo: the users, twenty questions, and ten answers per user.
+  const size_t n = 1000 + 20 + 10000;
+  const auto record = [](size_t i) {
+    return std::make_shared<const std::string>(
+        Printf("{\"record\":{\"polymorphic_id\":2147483649,\"polymorphic_name\":\"A\",\"ptr_wrapper\":"
+               "{\"valid\":1,\"data\":{\"ms\":%d,\"uid\":\"user%d\",\"qid\":%d,\"answer\":1}}}}\n",
+               static_cast<int>(i),
+               static_cast<int>(i % 1000),
+               static_cast<int>(i % 20)));
+  };
+  segmented_log::Log parent;
+  for (size_t i = 0; i < n; ++i) {
+    parent.Append(i, record(i));
+  }
+
+  std::vector<std::unique_ptr<segmented_log::Log>> forks;
+  for (size_t i = 0; i < 100; ++i) {
+    forks.emplace_back(new segmented_log::Log());
+    forks.back()->SetBase(parent.SharedPrefix(n));
+    forks.back()->Append(n, record(n + i));
+  }
+
+  // The records are shared, and the new records of the parent and of the forks are their own.
+  EXPECT_EQ(parent.SharedPrefix(n), parent.SharedPrefix(n));
+  EXPECT_EQ(parent.Get(42), forks[0]->Get(42));
+  EXPECT_EQ(parent.Get(42), forks[99]->Get(42));
+  parent.Append(n, record(n));
+  EXPECT_EQ(n + 1, forks[7]->Size());
+  EXPECT_EQ(*record(n + 7), *forks[7]->Get(n));
+  EXPECT_EQ(*record(n), *parent.Get(n));
+
+  // A fork of a fork shares the same records too.
+  segmented_log::Log grandchild;
+  grandchild.SetBase(forks[7]->SharedPrefix(n + 1));
+  EXPECT_EQ(parent.Get(42), grandchild.Get(42));
+  EXPECT_EQ(forks[7]->Get(n), grandchild.Get(n));
+
+  // A persistent fork only writes, and recovers, its own records, on top of the same base.
+  const std::string name = "segmented_log_fork_test";
+  segmented_log::Log::RemoveFiles(FLAGS_test_data_dir, name);
+  {
+    segmented_log::Log fork;
+    fork.SetBase(parent.SharedPrefix(n));
+    fork.Open(FLAGS_test_data_dir, name);
+    fork.Append(n, record(n + 1));
+  }
+  EXPECT_EQ(sizeof(segmented_log::IndexRecord),
+            segmented_log::FileSize(FLAGS_test_data_dir + '/' + name + ".0.index"));
+  {
+    segmented_log::Log fork;
+    fork.SetBase(parent.SharedPrefix(n));
+    fork.Open(FLAGS_test_data_dir, name);
+    EXPECT_EQ(n + 1, fork.Size());
+    EXPECT_EQ(*record(n + 1), *fork.Get(n));
+  }
+  segmented_log::Log::RemoveFiles(FLAGS_test_data_dir, name);
+
+  // The prefix of a persistent log refers to its sealed segments,
+  // and keeps only the unsealed entries in memory.
+  const std::string sealed_name = "segmented_log_fork_sealed_test";
+  segmented_log::Log::RemoveFiles(FLAGS_test_data_dir, sealed_name);
+  {
+    segmented_log::Log sealed;
+    sealed.Open(FLAGS_test_data_dir, sealed_name, 1000);
+    for (size_t i = 0; i < n; ++i) {
+      sealed.Append(i, record(i));
+    }
+    const segmented_log::SharedEntries prefix = sealed.SharedPrefix(n);
+    EXPECT_EQ(n, prefix->size());
+    EXPECT_EQ(n % 1000, prefix->EntriesInMemory());
+    sealed.DropBefore(n);
+    segmented_log::Log fork;
+    fork.SetBase(prefix);
+    EXPECT_EQ(*record(42), *fork.Get(42));
+    EXPECT_EQ(n - 1, fork.TimestampAt(n - 1));
+  }
+  segmented_log::Log::RemoveFiles(FLAGS_test_data_dir, sealed_name);
+}
+
+// The answers of one demo, allocated from the arena of the demo if it has one, and from the heap otherwise.
+struct ArenaTestDemo {
+  std::unique_ptr<arena::Arena> arena;
+  arena::Map<schema::QID, arena::Map<schema::UID, schema::ANSWER>> answers;
+  explicit ArenaTestDemo(bool use_arena)
+      : arena(use_arena ? new arena::Arena() : nullptr), answers(arena::Allocator<char>(arena.get())) {}
+};
+
+// Creates and destroys 10k demos, a hundred of them alive at a time, with twenty questions and fifty users
+// each, while the rest of the process keeps making small long-lived allocations in between.
+// The RSS the arenas save over the heap is in `bench/`, as `arena/rss_growth_after_10k_demos`.
+TEST(Arena, TenThousandDemosReleaseTheirMemory) {
+  std::vector<std::unique_ptr<std::string>> long_lived;
+  std::vector<std::unique_ptr<ArenaTestDemo>> demos(100);
+  size_t max_bytes_reserved = 0;
+  for (size_t i = 0; i < 10000; ++i) {
+    std::unique_ptr<ArenaTestDemo>& demo = demos[i % demos.size()];
+    demo.reset(new ArenaTestDemo(true));
+    for (size_t a = 0; a < 1000; ++a) {
+      const schema::QID qid = static_cast<schema::QID>(1 + (a * 7 + i) % 20);
+      const schema::UID uid = Printf("user%d", static_cast<int>((a * 13 + i) % 50));
+      if (a % 5 == 4) {
+        demo->answers[qid].erase(uid);
+      } else {
+        demo->answers[qid][uid] = (a % 2) ? schema::ANSWER::AGREE : schema::ANSWER::DISAGREE;
+      }
+      if (a % 250 == 0) {
+        long_lived.emplace_back(new std::string(Printf("demo%d", static_cast<int>(i))));
+      }
+    }
+    max_bytes_reserved = std::max(max_bytes_reserved, static_cast<size_t>(arena::Arena::TotalBytesReserved()));
+  }
+  // The hundred demos alive at a time take one chunk each.
+  EXPECT_EQ(100u * arena::kChunkSize, max_bytes_reserved);
+  demos.clear();
+  EXPECT_EQ(0u, static_cast<size_t>(arena::Arena::TotalBytesReserved()));
+  EXPECT_EQ(40000u, long_lived.size());
+
+  // The freed nodes are reused, and the arena only grows by whole chunks.
+  arena::Arena arena;
+  {
+    arena::Set<std::string> set{arena::Allocator<std::string>(&arena)};
+    for (size_t i = 0; i < 1000; ++i) {
+      set.insert(Printf("%d", static_cast<int>(i)));
+    }
+    const size_t in_use = arena.BytesInUse();
+    EXPECT_EQ(arena::kChunkSize, arena.BytesReserved());
+    set.clear();
+    EXPECT_EQ(0u, arena.BytesInUse());
+    for (size_t i = 0; i < 1000; ++i) {
+      set.insert(Printf("%d", static_cast<int>(i)));
+    }
+    EXPECT_EQ(in_use, arena.BytesInUse());
+    EXPECT_EQ(arena::kChunkSize, arena.BytesReserved());
+  }
+  EXPECT_EQ(0u, arena.BytesInUse());
+}
+
+TEST(MixpanelUploader, SendsBatchesInTheBackgroundAndRetries) {
+  Singleton<ListenOnTestPort>();
+  const std::string path = "/mixpanel_standin_batches";
+  MixpanelStandIn stand_in(path, 2);
+  const std::string demo_id = "test_mixpanel";
+  const std::string token = "token";
+  const size_t n = 1000;
+  {
+    analytics::Exporter exporter(demo_id);
+    MixpanelUploader* uploader =
+        new MixpanelUploader(demo_id, token, Printf("http://localhost:%d", FLAGS_test_port) + path);
+    exporter.AddSink(std::unique_ptr<analytics::Sink>(uploader));
+    for (size_t i = 0; i < n; ++i) {
+      // The listener returns right away, regardless of the network.
+      EXPECT_TRUE(exporter.Entry(MixpanelTestUser(i), i, n));
+    }
+    while (uploader->EventsSent() < n) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_EQ(n, uploader->EventsSent());
+    EXPECT_EQ(0u, uploader->EventsDropped());
+  }
+  // Two failed attempts, then batches of at most 50 events.
+  EXPECT_GE(stand_in.requests, static_cast<int>(2 + n / MixpanelUploader::kMaxBatchSize));
+  EXPECT_LT(stand_in.requests, static_cast<int>(n / 2));
+  EXPECT_EQ(static_cast<int>(n), stand_in.events);
+  HTTP(FLAGS_test_port).UnRegister(path);
+}
+
+TEST(MixpanelUploader, DurableOutboxResumesAfterRestartWithoutResending) {
+  Singleton<ListenOnTestPort>();
+  const std::string path = "/mixpanel_standin_outbox";
+  const std::string url = Printf("http://localhost:%d", FLAGS_test_port) + path;
+  const std::string demo_id = "test_outbox";
+  const std::string token = "token";
+  const auto cleanup = [&demo_id]() {
+    segmented_log::Log::RemoveFiles(FLAGS_test_data_dir, demo_id + "_mixpanel_outbox");
+    unlink((FLAGS_test_data_dir + "/" + demo_id + "_mixpanel_outbox.acked").c_str());
+  };
+  cleanup();
+  // Mixpanel is down.
+  MixpanelStandIn stand_in(path, 1000000);
+  {
+    MixpanelUploader uploader(demo_id, token, url, FLAGS_test_data_dir);
+    for (size_t i = 0; i < 100; ++i) {
+      uploader.Push(i, MixpanelTestEvent(i));
+    }
+    while (stand_in.requests < 2) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_EQ(0u, uploader.EventsSent());
+  }
+  // The process restarts, and Mixpanel is back, yet fails every third request.
+  EXPECT_EQ(0, stand_in.events);
+  stand_in.failures_left = 0;
+  stand_in.failure_period = 3;
+  {
+    MixpanelUploader uploader(demo_id, token, url, FLAGS_test_data_dir);
+    // The stream, with 120 entries stored by now, resumes from the first one not in the outbox, and continues.
+    EXPECT_EQ(100u, uploader.NextSourceIndex(120));
+    for (size_t i = uploader.NextSourceIndex(120); i < 150; ++i) {
+      uploader.Push(i, MixpanelTestEvent(i));
+    }
+    while (uploader.EventsSent() < 150) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  EXPECT_EQ(150, stand_in.events);
+  {
+    // After one more restart, there is nothing to resume, and nothing is sent again even if replayed.
+    MixpanelUploader uploader(demo_id, token, url, FLAGS_test_data_dir);
+    EXPECT_EQ(150u, uploader.NextSourceIndex(150));
+    for (size_t i = 0; i < 150; ++i) {
+      uploader.Push(i, MixpanelTestEvent(i));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    EXPECT_EQ(0u, uploader.EventsSent());
+  }
+  EXPECT_EQ(150, stand_in.events);
+  HTTP(FLAGS_test_port).UnRegister(path);
+  cleanup();
+}
+
+// A keep-alive HTTP server on a raw socket, which simulates the network latency: it waits `latency` after
+// accepting a connection and after each read, before responding to all the requests read. Responds `1`
+// to every request, unless `silent`, or `204 No Content` after a `100 Continue` if `no_content`.
+// With `close_after`, closes each connection after that many responses.
+struct KeepAliveStandIn {
+  std::chrono::milliseconds latency;
+  std::atomic_bool silent;
+  std::atomic_bool no_content;
+  std::atomic_int close_after;
+  std::atomic_int connections;
+  std::atomic_int requests;
+  std::atomic_bool stop;
+  int listen_fd;
+  int port;
+  std::thread acceptor;
+  std::vector<std::thread> handlers;  // Only touched by the `acceptor` thread until it is joined.
+
+  explicit KeepAliveStandIn(std::chrono::milliseconds latency)
+      : latency(latency),
+        silent(false),
+        no_content(false),
+        close_after(0),
+        connections(0),
+        requests(0),
+        stop(false) {
+    listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ::bind(listen_fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address));
+    ::listen(listen_fd, 64);
+    socklen_t length = sizeof(address);
+    ::getsockname(listen_fd, reinterpret_cast<struct sockaddr*>(&address), &length);
+    port = ntohs(address.sin_port);
+    acceptor = std::thread([this]() {
+      while (!stop) {
+        struct pollfd p{listen_fd, POLLIN, 0};
+        if (::poll(&p, 1, 10) > 0) {
+          const int fd = ::accept(listen_fd, nullptr, nullptr);
+          ++connections;
+          handlers.emplace_back(&KeepAliveStandIn::Serve, this, fd);
+        }
+      }
+    });
+  }
+
+  ~KeepAliveStandIn() {
+    stop = true;
+    acceptor.join();
+    for (auto& handler : handlers) {
+      handler.join();
+    }
+    ::close(listen_fd);
+  }
+
+  std::string URL() const { return Printf("http://localhost:%d/track", port); }
+
+  void Serve(int fd) {
+    std::this_thread::sleep_for(latency);
+    std::string buffer;
+    char chunk[16384];
+    int responded = 0;
+    while (!stop) {
+      struct pollfd p{fd, POLLIN, 0};
+      if (::poll(&p, 1, 10) <= 0) {
+        continue;
+      }
+      const ssize_t received = ::recv(fd, chunk, sizeof(chunk), 0);
+      if (received <= 0) {
+        break;
+      }
+      buffer.append(chunk, static_cast<size_t>(received));
+      std::this_thread::sleep_for(latency);
+      std::string responses;
+      size_t headers_end;
+      while ((headers_end = buffer.find("\r\n\r\n")) != std::string::npos) {
+        const size_t content_length_pos = buffer.find("Content-Length: ");
+        const size_t content_length = (content_length_pos < headers_end)
+                                          ? static_cast<size_t>(atoi(buffer.c_str() + content_length_pos + 16))
+                                          : 0u;
+        if (buffer.length() < headers_end + 4 + content_length) {
+          break;
+        }
+        buffer.erase(0, headers_end + 4 + content_length);
+        ++requests;
+        if (!close_after || responded < close_after) {
+          ++responded;
+          responses += no_content ? "HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 204 No Content\r\n\r\n"
+                                  : "HTTP/1.1 200 OK\r\nContent-Length: 1\r\n\r\n1";
+        }
+      }
+      if (!silent) {
+        ::send(fd, responses.data(), responses.length(), MSG_NOSIGNAL);
+      }
+      if (close_after && responded >= close_after) {
+        break;
+      }
+    }
+    ::close(fd);
+  }
+};
+
+TEST(HTTPClient, KeepAlivePipeliningAndTimeouts) {
+  const size_t n = 50;
+  KeepAliveStandIn stand_in(std::chrono::milliseconds(2));
+  const auto microseconds_since = [](std::chrono::steady_clock::time_point begin) {
+    const auto elapsed = std::chrono::steady_clock::now() - begin;
+    return static_cast<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+  };
+
+  // A new connection per request.
+  http_client::Options no_keep_alive;
+  no_keep_alive.max_idle_connections_per_host = 0;
+  http_client::Pool pool;
+  {
+    http_client::Client client(stand_in.URL(), no_keep_alive, pool);
+    for (size_t i = 0; i < n; ++i) {
+      EXPECT_EQ("1", client.Post("data=1", "application/x-www-form-urlencoded").body);
+    }
+  }
+  EXPECT_EQ(static_cast<int>(n), stand_in.connections);
+
+  // Keep-alive.
+  stand_in.connections = 0;
+  http_client::Client client(stand_in.URL(), http_client::Options(), pool);
+  for (size_t i = 0; i < n; ++i) {
+    const http_client::Response response = client.Post("data=1", "application/x-www-form-urlencoded");
+    EXPECT_EQ(200, response.code);
+    EXPECT_EQ("1", response.body);
+  }
+  EXPECT_EQ(1, stand_in.connections);
+
+  // Keep-alive and pipelining. How much faster it is, is measured by `bench/`.
+  const http_client::Request post{"POST", "/track", "data=1", "application/x-www-form-urlencoded", {}};
+  {
+    const std::vector<http_client::Request> requests(n, post);
+    const std::vector<http_client::Response> responses = client.Pipeline(requests);
+    ASSERT_EQ(n, responses.size());
+    for (const auto& response : responses) {
+      EXPECT_EQ("1", response.body);
+    }
+  }
+  EXPECT_EQ(1, stand_in.connections);
+  EXPECT_EQ(static_cast<int>(3 * n), stand_in.requests);
+
+  // The connection closed half way. The POST-s past the last response are not sent again, as the server may
+  // have got them already, while the GET-s are sent again on a fresh connection.
+  {
+    stand_in.close_after = 4;
+    stand_in.connections = 0;
+    http_client::Pool closing_pool;
+    http_client::Client closing_client(stand_in.URL(), http_client::Options(), closing_pool);
+    EXPECT_EQ(4u, closing_client.Pipeline(std::vector<http_client::Request>(10, post)).size());
+    EXPECT_EQ(1, stand_in.connections);
+    const http_client::Request get{"GET", "/track", "", "", {}};
+    EXPECT_EQ(10u, closing_client.Pipeline(std::vector<http_client::Request>(10, get)).size());
+    EXPECT_EQ(4, stand_in.connections);
+    stand_in.close_after = 0;
+  }
+
+  // The responses with no body and no `Content-Length` keep the connection, rather than being read till EOF.
+  {
+    stand_in.no_content = true;
+    stand_in.connections = 0;
+    http_client::Options impatient;
+    impatient.io_timeout = std::chrono::milliseconds(500);
+    http_client::Pool no_content_pool;
+    http_client::Client no_content_client(stand_in.URL(), impatient, no_content_pool);
+    const auto begin = std::chrono::steady_clock::now();
+    const std::vector<http_client::Response> responses =
+        no_content_client.Pipeline(std::vector<http_client::Request>(10, post));
+    ASSERT_EQ(10u, responses.size());
+    for (const auto& response : responses) {
+      EXPECT_EQ(204, response.code);
+      EXPECT_EQ("", response.body);
+    }
+    EXPECT_EQ(204, no_content_client.Post("data=1", "application/x-www-form-urlencoded").code);
+    EXPECT_LT(microseconds_since(begin), 500000);
+    EXPECT_EQ(1, stand_in.connections);
+    stand_in.no_content = false;
+  }
+
+  // Timeouts.
+  stand_in.silent = true;
+  http_client::Options impatient;
+  impatient.io_timeout = std::chrono::milliseconds(50);
+  http_client::Client impatient_client(stand_in.URL(), impatient, pool);
+  const auto begin = std::chrono::steady_clock::now();
+  ASSERT_THROW(impatient_client.Post("data=1", "application/x-www-form-urlencoded"), http_client::Error);
+  EXPECT_LT(microseconds_since(begin), 1000000);
+}
+
+// Collects the events pushed into it, to test the `analytics::Exporter` without the network.
+struct AnalyticsTestSink : analytics::Sink {
+  std::vector<std::pair<size_t, std::string>>& events;
+  // The entry to resume from, as a durable sink would report it, or `-1` for an at-most-once sink.
+  const size_t next_source_index;
+  explicit AnalyticsTestSink(std::vector<std::pair<size_t, std::string>>& events,
+                             size_t next_source_index = static_cast<size_t>(-1))
+      : events(events), next_source_index(next_source_index) {}
+  void Push(size_t source_index, const analytics::Event& event) override {
+    events.emplace_back(source_index, event.WithProperty("token", "T"));
+  }
+  size_t NextSourceIndex(size_t live) const override {
+    return next_source_index == static_cast<size_t>(-1) ? live : next_source_index;
+  }
+};
+
+TEST(Analytics, OneListenerEncodesOnceForAllSinks) {
+  const std::string ndjson_path = FLAGS_test_data_dir + "/test_analytics.ndjson";
+  unlink(ndjson_path.c_str());
+
+  // A local UDP collector.
+  const int collector = ::socket(AF_INET, SOCK_DGRAM, 0);
+  ASSERT_GE(collector, 0);
+  struct sockaddr_in address;
+  std::memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = 0;
+  ASSERT_EQ(0, ::bind(collector, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)));
+  socklen_t address_length = sizeof(address);
+  ASSERT_EQ(0, ::getsockname(collector, reinterpret_cast<struct sockaddr*>(&address), &address_length));
+
+  // The addresses without a valid port are rejected rather than sent to port 0 or to a made up one.
+  EXPECT_TRUE(analytics::UDPSink(Printf("127.0.0.1:%d", static_cast<int>(ntohs(address.sin_port)))).IsOpen());
+  EXPECT_TRUE(analytics::UDPSink("localhost:8125").IsOpen());
+  EXPECT_FALSE(analytics::UDPSink("127.0.0.1").IsOpen());
+  EXPECT_FALSE(analytics::UDPSink("127.0.0.1:").IsOpen());
+  EXPECT_FALSE(analytics::UDPSink("127.0.0.1:0").IsOpen());
+  EXPECT_FALSE(analytics::UDPSink("127.0.0.1:65536").IsOpen());
+  EXPECT_FALSE(analytics::UDPSink("127.0.0.1:81x").IsOpen());
+  EXPECT_FALSE(analytics::UDPSink("8125").IsOpen());
+
+  std::vector<std::pair<size_t, std::string>> events;
+  {
+    analytics::Exporter exporter("test_analytics");
+    exporter.AddSink(std::unique_ptr<analytics::Sink>(new AnalyticsTestSink(events)));
+    exporter.AddSink(std::unique_ptr<analytics::Sink>(new analytics::NDJSONFileSink(ndjson_path)));
+    exporter.AddSink(std::unique_ptr<analytics::Sink>(
+        new analytics::UDPSink(Printf("127.0.0.1:%d", static_cast<int>(ntohs(address.sin_port))))));
+    EXPECT_EQ(3u, exporter.SinksCount());
+
+    std::unique_ptr<schema::AnswerRecord> answer(new schema::AnswerRecord());
+    answer->ms = static_cast<bricks::time::EPOCH_MILLISECONDS>(5000);
+    answer->uid = "alice";
+    answer->qid = static_cast<schema::QID>(2);
+    answer->answer = schema::ANSWER::AGREE;
+    std::unique_ptr<schema::QuestionRecord> question(new schema::QuestionRecord());
+    question->ms = static_cast<bricks::time::EPOCH_MILLISECONDS>(1000);
+
+    EXPECT_TRUE(exporter.Entry(MixpanelTestUser(1000), 0, 3));
+    EXPECT_TRUE(exporter.Entry(std::unique_ptr<schema::Base>(std::move(question)), 1, 3));
+    EXPECT_TRUE(exporter.Entry(std::unique_ptr<schema::Base>(std::move(answer)), 2, 3));
+  }
+
+  // Questions are not exported.
+  ASSERT_EQ(2u, events.size());
+  EXPECT_EQ(0u, events[0].first);
+  EXPECT_EQ(2u, events[1].first);
+  EXPECT_EQ("{\"event\":\"User\",\"properties\":{\"token\":\"T\",\"distinct_id\":\"user1000\",\"time\":1}}",
+            events[0].second);
+  EXPECT_EQ(
+      "{\"event\":\"Answer\",\"properties\":{\"token\":\"T\",\"distinct_id\":\"alice\",\"time\":5,"
+      "\"Question\":2,\"Answer\":1}}",
+      events[1].second);
+
+  const std::string user_json = "{\"event\":\"User\",\"properties\":{\"distinct_id\":\"user1000\",\"time\":1}}";
+  const std::string ndjson = bricks::FileSystem::ReadFileAsString(ndjson_path);
+  EXPECT_EQ(0u, ndjson.find(user_json + '\n'));
+  EXPECT_EQ(2u, static_cast<size_t>(std::count(ndjson.begin(), ndjson.end(), '\n')));
+
+  char buffer[1024];
+  const ssize_t length = ::recv(collector, buffer, sizeof(buffer), 0);
+  ASSERT_GT(length, 0);
+  EXPECT_EQ(user_json, std::string(buffer, static_cast<size_t>(length)));
+  ::close(collector);
+  unlink(ndjson_path.c_str());
+}
+
+TEST(Analytics, ResumesFromTheEarliestDurableSink) {
+  std::vector<std::pair<size_t, std::string>> durable;
+  std::vector<std::pair<size_t, std::string>> at_most_once;
+  analytics::Exporter exporter("test_analytics_resume");
+  exporter.AddSink(std::unique_ptr<analytics::Sink>(new AnalyticsTestSink(durable, 3)));
+  exporter.AddSink(std::unique_ptr<analytics::Sink>(new AnalyticsTestSink(at_most_once)));
+
+  // Of the 5 entries recovered, the durable sink has got the first 3. The other one only gets the new ones.
+  const size_t begin = exporter.ResumeFrom(5);
+  EXPECT_EQ(3u, begin);
+  for (size_t i = begin; i < 7; ++i) {
+    EXPECT_TRUE(exporter.Entry(MixpanelTestUser(1000 + i), i, 7));
+  }
+  ASSERT_EQ(4u, durable.size());
+  EXPECT_EQ(3u, durable.front().first);
+  EXPECT_EQ(6u, durable.back().first);
+  ASSERT_EQ(2u, at_most_once.size());
+  EXPECT_EQ(5u, at_most_once.front().first);
+  EXPECT_EQ(6u, at_most_once.back().first);
+
+  // A sink that is ahead does not move the start past the entries the stream has.
+  analytics::Exporter ahead("test_analytics_ahead");
+  ahead.AddSink(std::unique_ptr<analytics::Sink>(new AnalyticsTestSink(durable, 10)));
+  EXPECT_EQ(5u, ahead.ResumeFrom(5));
+}
+
+// The rendering of the Actions page as it was done on each page view before `actions::TableCache`.
+typedef std::map<schema::QID, std::map<schema::UID, schema::ANSWER>> ActionsTestAnswers;
+inline std::string RenderActionsTableFromScratch(const std::vector<std::string>& users,
+                                                 const std::vector<std::string>& questions,
+                                                 ActionsTestAnswers& answers) {
+  std::ostringstream table;
+  table << "<tr><td></td>";
+  for (const auto& u : users) {
+    table << "<td align=center><b>" << u << "</b></td>";
+  }
+  table << "<tr>\n";
+  for (size_t qi = 0; qi < questions.size(); ++qi) {
+    table << "<tr><td align=right><b>" << questions[qi] << "</b></td>";
+    std::map<schema::UID, schema::ANSWER>& current_answers = answers[static_cast<schema::QID>(qi + 1)];
+    for (const auto& u : users) {
+      table << "<td align=center>";
+      static const char* const texts[3] = {"No", "N/A", "Yes"};
+      static const char* const colors[3] = {"red", "gray", "green"};
+      const int current_answer = static_cast<int>(current_answers[u]);
+      for (int i = 0; i < 3; ++i) {
+        if (i) {
+          table << " | ";
+        }
+        if (i - 1 != current_answer) {
+          table << Printf("<a href='add_answer?uid=%s&qid=%d&answer=%d'>%s</a>",
+                          u.c_str(),
+                          static_cast<int>(qi + 1),
+                          i - 1,
+                          texts[i]);
+        } else {
+          table << Printf("<b><font color=%s>%s</font></b>", colors[i], texts[i]);
+        }
+      }
+      table << "</td>";
+    }
+    table << "</tr>\n";
+  }
+  return table.str();
+}
+
+// The whole table: the page of the window of all of it, without the navigation row.
+inline std::string ActionsTableOf(actions::TableCache& cache) {
+  actions::Window everything;
+  everything.q_limit = cache.QuestionsCount() + 1;
+  everything.u_limit = cache.UsersCount() + 1;
+  const std::vector<std::string> chunks = cache.Page(everything);
+  std::string table;
+  for (size_t i = 0; i + 1 < chunks.size(); ++i) {
+    table += chunks[i];
+  }
+  return table;
+}
+
+TEST(ActionsTable, IncrementalUpdatesMatchFullRendering) {
+  const size_t n_users = 1000;
+  const size_t n_questions = 200;
+  std::vector<std::string> users;
+  std::vector<std::string> questions;
+  ActionsTestAnswers answers;
+  actions::TableCache cache;
+  for (size_t i = 0; i < n_users; ++i) {
+    users.push_back(Printf("u%d", static_cast<int>(i)));
+    cache.AddUser(users.back());
+  }
+  for (size_t i = 0; i < n_questions; ++i) {
+    questions.push_back(Printf("Question %d?", static_cast<int>(i + 1)));
+    cache.AddQuestion(questions.back());
+  }
+  for (size_t i = 0; i < n_users * n_questions / 10; ++i) {
+    const schema::QID qid = static_cast<schema::QID>(1 + (i * 7) % n_questions);
+    const schema::ANSWER answer = (i % 3) ? schema::ANSWER::AGREE : schema::ANSWER::DISAGREE;
+    answers[qid][users[(i * 13) % n_users]] = answer;
+    cache.SetAnswer(qid, users[(i * 13) % n_users], answer);
+  }
+
+  EXPECT_EQ(RenderActionsTableFromScratch(users, questions, answers), ActionsTableOf(cache));
+
+  // A new answer, a new user, and a new question, each followed by a page view.
+  answers[static_cast<schema::QID>(5)]["u42"] = schema::ANSWER::NA;
+  cache.SetAnswer(static_cast<schema::QID>(5), "u42", schema::ANSWER::NA);
+  EXPECT_EQ(RenderActionsTableFromScratch(users, questions, answers), ActionsTableOf(cache));
+
+  users.push_back("newcomer");
+  cache.AddUser("newcomer");
+  EXPECT_EQ(RenderActionsTableFromScratch(users, questions, answers), ActionsTableOf(cache));
+
+  questions.push_back("One more question?");
+  cache.AddQuestion("One more question?");
+  answers[static_cast<schema::QID>(n_questions + 1)]["newcomer"] = schema::ANSWER::AGREE;
+  cache.SetAnswer(static_cast<schema::QID>(n_questions + 1), "newcomer", schema::ANSWER::AGREE);
+  EXPECT_EQ(RenderActionsTableFromScratch(users, questions, answers), ActionsTableOf(cache));
+}
+
+TEST(ActionsTable, ForksShareTheRowsUntilChanged) {
+  actions::TableCache parent;
+  for (size_t i = 0; i < 1000; ++i) {
+    parent.AddUser(Printf("u%d", static_cast<int>(i)));
+  }
+  for (size_t i = 0; i < 20; ++i) {
+    parent.AddQuestion(Printf("Question %d?", static_cast<int>(i + 1)));
+  }
+  const std::string parent_table = ActionsTableOf(parent);
+
+  std::vector<std::unique_ptr<actions::TableCache>> forks;
+  for (size_t i = 0; i < 100; ++i) {
+    forks.emplace_back(new actions::TableCache());
+    forks.back()->ShareFrom(parent);
+  }
+
+  EXPECT_EQ(parent_table, ActionsTableOf(*forks[0]));
+  forks[0]->SetAnswer(static_cast<schema::QID>(3), "u42", schema::ANSWER::AGREE);
+  forks[0]->AddUser("newcomer");
+  EXPECT_NE(parent_table, ActionsTableOf(*forks[0]));
+  EXPECT_EQ(parent_table, ActionsTableOf(parent));
+  EXPECT_EQ(parent_table, ActionsTableOf(*forks[1]));
+  parent.SetAnswer(static_cast<schema::QID>(3), "u42", schema::ANSWER::DISAGREE);
+  EXPECT_NE(parent_table, ActionsTableOf(parent));
+  EXPECT_EQ(parent_table, ActionsTableOf(*forks[1]));
+  EXPECT_EQ(1001u, forks[0]->UsersCount());
+  EXPECT_EQ(1000u, forks[1]->UsersCount());
+}
+
+TEST(ActionsTable, PagesOnlyCoverTheirWindow) {
+  actions::TableCache cache;
+  for (size_t i = 0; i < 120; ++i) {
+    cache.AddUser(Printf("u%d", static_cast<int>(i)));
+  }
+  for (size_t i = 0; i < 70; ++i) {
+    cache.AddQuestion(Printf("Question %d?", static_cast<int>(i + 1)));
+  }
+  cache.SetAnswer(static_cast<schema::QID>(60), "u110", schema::ANSWER::AGREE);
+
+  const auto count = [](const std::string& haystack, const std::string& needle) {
+    size_t result = 0;
+    for (size_t pos = haystack.find(needle); pos != std::string::npos; pos = haystack.find(needle, pos + 1)) {
+      ++result;
+    }
+    return result;
+  };
+
+  // The window that covers the whole table is the whole table, plus the navigation row.
+  std::vector<std::string> users;
+  for (size_t i = 0; i < 120; ++i) {
+    users.push_back(Printf("u%d", static_cast<int>(i)));
+  }
+  std::vector<std::string> questions;
+  for (size_t i = 0; i < 70; ++i) {
+    questions.push_back(Printf("Question %d?", static_cast<int>(i + 1)));
+  }
+  ActionsTestAnswers answers;
+  answers[static_cast<schema::QID>(60)]["u110"] = schema::ANSWER::AGREE;
+  actions::Window everything;
+  everything.q_limit = 1000;
+  everything.u_limit = 1000;
+  std::vector<std::string> chunks = cache.Page(everything);
+  ASSERT_EQ(72u, chunks.size());
+  std::string page;
+  for (size_t i = 0; i + 1 < chunks.size(); ++i) {
+    page += chunks[i];
+  }
+  EXPECT_EQ(RenderActionsTableFromScratch(users, questions, answers), page);
+
+  // A narrower window is assembled from the cells.
+  actions::Window middle;
+  middle.q_offset = 59;
+  middle.q_limit = 1;
+  middle.u_offset = 100;
+  middle.u_limit = 20;
+  EXPECT_EQ(1u, count(cache.Page(middle)[1], "<b><font color=green>Yes</font></b>"));
+
+  // The default window.
+  chunks = cache.Page(actions::Window());
+  ASSERT_EQ(52u, chunks.size());
+  EXPECT_EQ(50u, count(chunks[0], "<td align=center><b>"));
+  EXPECT_EQ(50u, count(chunks[1], "<td align=center>"));
+  EXPECT_EQ(1u, count(chunks.back(), "?q_offset=50&q_limit=50&u_offset=0&u_limit=50'>Questions &darr;"));
+  EXPECT_EQ(1u, count(chunks.back(), "?q_offset=0&q_limit=50&u_offset=50&u_limit=50'>Users &rarr;"));
+  EXPECT_EQ(0u, count(chunks.back(), "&uarr;"));
+  EXPECT_EQ(0u, count(chunks.back(), "&larr;"));
+
+  // The last window, which is not full.
+  actions::Window last;
+  last.q_offset = 50;
+  last.u_offset = 100;
+  chunks = cache.Page(last);
+  ASSERT_EQ(22u, chunks.size());
+  EXPECT_EQ(20u, count(chunks[0], "<td align=center><b>"));
+  EXPECT_EQ(1u, count(chunks[10], "<b><font color=green>Yes</font></b>"));
+  EXPECT_EQ(1u, count(chunks.back(), "Questions 51&ndash;70 of 70"));
+  EXPECT_EQ(1u, count(chunks.back(), "Users 101&ndash;120 of 120"));
+  EXPECT_EQ(0u, count(chunks.back(), "&darr;"));
+  EXPECT_EQ(0u, count(chunks.back(), "&rarr;"));
+
+  // Out of range.
+  actions::Window beyond;
+  beyond.q_offset = 1000;
+  beyond.u_offset = 1000;
+  EXPECT_EQ(2u, cache.Page(beyond).size());
+}
+
+TEST(Stats, TalliesFollowTheChangedAnswers) {
+  const schema::QID q1 = static_cast<schema::QID>(1);
+  const schema::QID q2 = static_cast<schema::QID>(2);
+  stats::Tallies tallies;
+  EXPECT_EQ(0u, tallies.Get(q1).agree);
+  EXPECT_EQ(0.0, tallies.Get(q1).Controversy());
+
+  // Split in half, the `NA` answers do not count.
+  tallies.Add(q1, schema::ANSWER::AGREE);
+  tallies.Add(q1, schema::ANSWER::DISAGREE);
+  tallies.Add(q1, schema::ANSWER::NA);
+  tallies.Add(q2, schema::ANSWER::AGREE);
+  EXPECT_EQ(1u, tallies.Get(q1).agree);
+  EXPECT_EQ(1u, tallies.Get(q1).disagree);
+  EXPECT_EQ(1u, tallies.Get(q1).na);
+  EXPECT_EQ(1.0, tallies.Get(q1).Controversy());
+  EXPECT_EQ(0.0, tallies.Get(q2).Controversy());
+
+  // A forked demo starts from a copy of the tallies.
+  const stats::Tallies fork = tallies;
+
+  // The user who disagreed changes their mind.
+  tallies.Remove(q1, schema::ANSWER::DISAGREE);
+  tallies.Add(q1, schema::ANSWER::AGREE);
+  EXPECT_EQ(2u, tallies.Get(q1).agree);
+  EXPECT_EQ(0u, tallies.Get(q1).disagree);
+  EXPECT_EQ(0.0, tallies.Get(q1).Controversy());
+  tallies.Add(q1, schema::ANSWER::DISAGREE);
+  EXPECT_EQ(2.0 / 3, tallies.Get(q1).Controversy());
+  EXPECT_EQ(1.0, fork.Get(q1).Controversy());
+
+  const stats::QuestionStats described = tallies.Describe(q1, "Why?");
+  EXPECT_EQ(1u, described.qid);
+  EXPECT_EQ("Why?", described.text);
+  EXPECT_EQ(2u, described.agree);
+  EXPECT_EQ(1u, described.disagree);
+  EXPECT_EQ(1u, described.na);
+  EXPECT_EQ(tallies.Get(q1).Controversy(), described.controversy);
+  EXPECT_EQ(0u, tallies.Describe(static_cast<schema::QID>(42), "Not answered yet?").agree);
+}
+
+TEST(Dashboard, ParsedTemplateRendersLikeFindAndReplace) {
+  const std::vector<std::string> placeholders = {"<style id=\"a-placeholder\"></style>",
+                                                 "<div id=\"b-placeholder\"></div>"};
+  std::string text = "<html><head>" + placeholders[0] + "</head><body>";
+  for (size_t i = 0; i < 200; ++i) {
+    text += Printf("<p>Paragraph %d, to make the template realistically long.</p>\n", static_cast<int>(i));
+    if (i == 100) {
+      text += placeholders[1] + placeholders[1];
+    }
+  }
+  text += placeholders[1] + "</body></html>";
+  const std::map<std::string, std::string> replacements = {{placeholders[0], "<style></style>"},
+                                                           {placeholders[1], "<div>Actions</div>"}};
+
+  // What the `/config` handler used to do on every request.
+  const auto find_and_replace = [&text, &replacements]() {
+    std::string output = text;
+    for (const auto& kv : replacements) {
+      std::size_t pos = 0;
+      while (std::string::npos != (pos = output.find(kv.first, pos))) {
+        output.replace(pos, kv.first.length(), kv.second);
+        pos += kv.second.length();
+      }
+    }
+    return JSON(dashboard::Config("/demo/layout", output), "config") + '\n';
+  };
+
+  const dashboard::Template parsed(text, placeholders);
+  const dashboard::Config config("/demo/layout", parsed.Render(replacements));
+  const std::string cached = JSON(config, "config") + '\n';
+  EXPECT_EQ(find_and_replace(), cached);
+  EXPECT_EQ(text, parsed.Render(std::map<std::string, std::string>()));
+}
+
+TEST(Dashboard, BootstrapBundlesTheFirstPaint) {
+  Singleton<ListenOnTestPort>();
+  using namespace dashboard::layout;
+  const dashboard::Config dashboard_config("/test_bootstrap/layout", "<html></html>");
+  const std::string config = JSON(dashboard_config, "config") + '\n';
+  const std::string layout = JSON(Layout(Row({Cell("/u_meta"), Cell("/q_meta")})), "layout") + '\n';
+  const std::string u_meta = JSON(dashboard::PlotMeta(), "meta") + '\n';
+  const std::string q_meta = JSON(dashboard::ImageMeta(), "meta") + '\n';
+  fanout::Stream<FanoutTestPoint> u("test_bootstrap_u", "point");
+  fanout::Stream<FanoutTestPoint> q("test_bootstrap_q", "point");
+  dashboard::Bootstrap bootstrap(config, layout, {{"/u_meta", u_meta}, {"/q_meta", q_meta}});
+  bootstrap.AddStream("/d/u", [&u]() { return u.Size(); }, [&u]() { return u.Latest(); });
+  bootstrap.AddStream("/d/q", [&q]() { return q.Size(); }, [&q]() { return q.Latest(); });
+
+  // The very same documents as the separate responses, and the latest points.
+  const auto without_newline = [](const std::string& s) { return s.substr(0, s.length() - 1); };
+  const std::string prefix = "{\"config\":" + without_newline(config) + ",\"layout\":" +
+                             without_newline(layout) + ",\"meta\":{\"/u_meta\":" + without_newline(u_meta) +
+                             ",\"/q_meta\":" + without_newline(q_meta) + "},\"latest\":{";
+  u.Publish(FanoutTestPoint{1, 1});
+  EXPECT_EQ(prefix + "\"/d/u\":" + without_newline(*u.Latest()) + ",\"/d/q\":null}}\n", bootstrap.Render());
+  u.Publish(FanoutTestPoint{2, 2});
+  q.Publish(FanoutTestPoint{3, 3});
+  EXPECT_EQ(JSON(FanoutTestPoint{2, 2}, "point") + '\n', *u.Latest());
+  const std::string rendered = bootstrap.Render();
+  EXPECT_EQ(prefix + "\"/d/u\":" + without_newline(*u.Latest()) + ",\"/d/q\":" + without_newline(*q.Latest()) +
+                "}}\n",
+            rendered);
+  EXPECT_EQ(rendered, bootstrap.Render());
+
+  // The latest entries are only read again once a stream has grown.
+  size_t latest_reads = 0;
+  dashboard::Bootstrap counted(config, layout, {});
+  counted.AddStream("/d/q", [&q]() { return q.Size(); }, [&q, &latest_reads]() {
+    ++latest_reads;
+    return q.Latest();
+  });
+  const std::string counted_rendered = counted.Render();
+  EXPECT_EQ(counted_rendered, counted.Render());
+  EXPECT_EQ(1u, latest_reads);
+  q.Publish(FanoutTestPoint{4, 4});
+  EXPECT_TRUE(counted_rendered != counted.Render());
+  EXPECT_EQ(2u, latest_reads);
+
+  // One request instead of the waterfall of the dashboard: the config, the layout, the metas, and the streams.
+  HTTP(FLAGS_test_port).Register("/test_bootstrap/bootstrap",
+                                 [&bootstrap](Request r) { r(bootstrap.Render()); });
+  EXPECT_EQ(bootstrap.Render(),
+            HTTP(GET(Printf("http://localhost:%d/test_bootstrap/bootstrap", FLAGS_test_port))).body);
+  HTTP(FLAGS_test_port).UnRegister("/test_bootstrap/bootstrap");
+}
+
 struct MultiKeyJSONTestObject {
   struct InnerObject {
     int inner_key = 1;